@@ -0,0 +1,410 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "cerebrum/benchmark.h"
+#include "cerebrum/size.h"
+#include "cerebrum/neural_networks.h"
+
+/* Micro-benchmarks of the layers, transfer functions and error functions,
+ * and benchmarks of whole networks (see benchmark.h for the method).
+ *
+ *   benchmarks [--build NAME] [--filter TEXT] [--max-seconds S]
+ *              [--output FILE] [--counters FILE]
+ *   benchmarks --compare FIRST.csv SECOND.csv
+ *
+ * `make bench` runs the suite built for the host CPU with Cerebrum's own
+ * kernels and with CBLAS, and compares the two. With --counters, the
+ * hardware counters of every layer of a few networks are also written to
+ * FILE as JSON (see CounterProfiler in profiler.h).
+ *
+ * FLOPs count the multiply-adds of the GEMMs and convolutions (two each);
+ * elementwise kernels report bandwidth only. Bytes count every array a
+ * call reads or writes once.
+ */
+
+template<typename T>
+void fill(T* values, size_t n, T low, T high, unsigned seed) {
+  std::default_random_engine e{seed};
+  std::uniform_real_distribution<T> next(low, high);
+  for (size_t i = 0; i < n; i++)
+    values[i] = next(e);
+}
+
+template<typename Array>
+void fill(Array& a, typename Array::value_type::value_type low,
+          typename Array::value_type::value_type high, unsigned seed) {
+  fill(a.data()->data(), a.size() * a[0].size(), low, high, seed);
+}
+
+std::string shape(size_t a, size_t b, size_t c = 0ul) {
+  std::ostringstream s;
+  s << a << "x" << b;
+  if (c)
+    s << "x" << c;
+  return s.str();
+}
+
+/* -------------------- Layers -------------------- */
+
+template<typename Layer, typename T, typename InputSize, size_t batch_size>
+struct LayerData {
+  using OutputSize = typename Layer::template OutputSize<InputSize>;
+
+  typename Layer::template Inputs<T, InputSize, batch_size> inputs;
+  typename Layer::template Inputs<T, InputSize, batch_size> prev_errors;
+  typename Layer::template Hidden<T, InputSize, batch_size> hidden;
+  typename Layer::template Outputs<T, InputSize, batch_size> outputs;
+  typename Layer::template Outputs<T, InputSize, batch_size> errors;
+  typename Layer::template Parameters<T, InputSize> parameters;
+  typename Layer::template Parameters<T, InputSize> gradient;
+
+  LayerData() {
+    fill(inputs, (T)-1, (T)1, 1u);
+    fill(errors, (T)-1, (T)1, 2u);
+    fill(parameters.data(), parameters.size(), (T)-0.05, (T)0.05, 3u);
+  }
+};
+
+/* Inference, training forward and backpropagation of one layer */
+template<typename Layer, typename T, typename InputSize, size_t batch_size>
+void bench_layer(Benchmark& b, const std::string& name,
+                 const std::string& layer_shape, double forward_flops) {
+  if (!b.selected(name))
+    return;
+  using Data = LayerData<Layer, T, InputSize, batch_size>;
+  std::unique_ptr<Data> d(new Data);
+  const double io = sizeof(d->inputs) + sizeof(d->outputs);
+  const double weights = sizeof(d->parameters);
+
+  b.run(name + "/inference", layer_shape, forward_flops, io + weights,
+        [&d]() {
+          Layer::template forward<T, InputSize, batch_size, false>(
+            d->inputs, d->parameters, d->hidden, d->outputs);
+        });
+  b.run(name + "/forward", layer_shape, forward_flops,
+        io + weights + sizeof(d->hidden), [&d]() {
+          Layer::template forward<T, InputSize, batch_size, true>(
+            d->inputs, d->parameters, d->hidden, d->outputs);
+        });
+  b.run(name + "/backprop", layer_shape, 2.0 * forward_flops,
+        2.0 * io + 2.0 * weights + sizeof(d->hidden) + sizeof(d->errors),
+        [&d]() {
+          Layer::template backpropagate<T, InputSize, batch_size>(
+            d->inputs, d->parameters, d->hidden, d->outputs, d->errors,
+            d->gradient, d->prev_errors);
+        });
+}
+
+template<typename T, size_t batch_size, size_t inputs_no, size_t outputs_no>
+void bench_fully_connected(Benchmark& b, const std::string& name) {
+  bench_layer<FullyConnected<outputs_no, ReLU>, T, Size<inputs_no>,
+              batch_size>(b, name, shape(batch_size, inputs_no, outputs_no),
+                          2.0 * batch_size * inputs_no * outputs_no);
+}
+
+template<typename T, size_t batch_size, size_t maps_no, size_t side,
+         size_t out_maps_no, size_t kernel, size_t stride>
+void bench_convolution(Benchmark& b, const std::string& name) {
+  using InputSize = Size<maps_no, side, side>;
+  using Layer = Convolution<out_maps_no, kernel, kernel, stride,
+                            FullConnection, ReLU>;
+  using OutputSize = typename Layer::template OutputSize<InputSize>;
+  bench_layer<Layer, T, InputSize, batch_size>(
+    b, name, shape(batch_size, InputSize::length, OutputSize::length),
+    2.0 * batch_size * OutputSize::length * maps_no * kernel * kernel);
+}
+
+/* -------------------- Transfer and error functions -------------------- */
+
+template<template<typename> class TransferFunction, typename T,
+         size_t batch_size, size_t length>
+void bench_transfer(Benchmark& b, const std::string& name) {
+  if (!b.selected(name))
+    return;
+  using F = TransferFunction<T>;
+  using Batch = typename F::template Batch<Size<length>, batch_size>;
+  std::unique_ptr<Batch> z(new Batch), a(new Batch), e(new Batch);
+  fill(*z, (T)-4, (T)4, 4u);
+  fill(*e, (T)-1, (T)1, 5u);
+  F::template f_batch<Size<length>, batch_size>(*z, *a);
+
+  b.run(name + "/f", shape(batch_size, length), 0.0, 2.0 * sizeof(Batch),
+        [&]() { F::template f_batch<Size<length>, batch_size>(*z, *a); });
+  b.run(name + "/df", shape(batch_size, length), 0.0, 3.0 * sizeof(Batch),
+        [&]() { F::template df_batch<Size<length>, batch_size>(*a, *e); });
+}
+
+template<typename T, size_t batch_size, size_t length>
+void bench_errors(Benchmark& b) {
+  using LayerSize = Size<length>;
+  using Outputs = std::array<std::array<T, length>, batch_size>;
+  std::unique_ptr<Outputs> a(new Outputs), t(new Outputs), y(new Outputs),
+    e(new Outputs);
+  fill(*a, (T)-4, (T)4, 6u);
+  for (size_t n = 0; n < batch_size; n++)
+    for (size_t i = 0; i < length; i++)
+      (*t)[n][i] = i == n % length ? (T)1 : (T)0;
+  SoftMax<T>::template f<LayerSize, batch_size>(*a, *y);
+  const std::string s = shape(batch_size, length);
+  const double array = sizeof(Outputs);
+
+  b.run("softmax/f", s, 0.0, 2.0 * array, [&]() {
+      SoftMax<T>::template f<LayerSize, batch_size>(*a, *y);
+    });
+  b.run("softmax/f_dError", s, 0.0, 4.0 * array, [&]() {
+      SoftMax<T>::template f_dError<LayerSize, batch_size>(*a, *t, *y, *e);
+    });
+  b.run("softmax/error", s, 0.0, 2.0 * array, [&]() {
+      volatile T err = SoftMax<T>::template error<LayerSize, batch_size>(
+        *y, *t);
+      (void)err;
+    });
+  b.run("sum_of_squares/error", s, 0.0, 2.0 * array, [&]() {
+      volatile T err = SumOfSquares<T>::template error<LayerSize,
+                                                       batch_size>(*y, *t);
+      (void)err;
+    });
+  b.run("sum_of_squares/dError", s, 0.0, 3.0 * array, [&]() {
+      SumOfSquares<T>::template dError<LayerSize, batch_size>(*y, *t, *e);
+    });
+  b.run("rmse/error", s, 0.0, 2.0 * array, [&]() {
+      volatile T err = RMSE<T>::template error<LayerSize, batch_size>(*y, *t);
+      (void)err;
+    });
+}
+
+/* -------------------- Networks -------------------- */
+
+/* forward_flops is the work of one inference of the whole batch */
+template<typename NN, size_t batch_size, template<typename> class Error>
+void bench_network(Benchmark& b, const std::string& name,
+                   double forward_flops) {
+  if (!b.selected(name))
+    return;
+  using T = typename NN::DataType;
+  using IC = typename NN::template InferenceComputation<batch_size, Error>;
+  using FC = typename NN::template ForwardComputation<batch_size, Error>;
+  using GC = typename NN::template GradientComputation<batch_size, Error>;
+
+  std::unique_ptr<typename NN::Parameters> p(new typename NN::Parameters);
+  std::unique_ptr<typename NN::Parameters> g(new typename NN::Parameters);
+  std::unique_ptr<typename FC::Inputs> x(new typename FC::Inputs);
+  std::unique_ptr<typename FC::NetOutputs> t(new typename FC::NetOutputs);
+  fill(p->data(), p->size(), (T)-0.05, (T)0.05, 7u);
+  fill(*x, (T)0, (T)1, 8u);
+  for (size_t n = 0; n < batch_size; n++)
+    for (size_t i = 0; i < NN::OutputSize::length; i++)
+      (*t)[n][i] = i == n % NN::OutputSize::length ? (T)1 : (T)0;
+  std::unique_ptr<IC> ic(new IC);
+  std::unique_ptr<FC> fc(new FC);
+  std::unique_ptr<GC> gc(new GC);
+
+  const std::string s = shape(batch_size, NN::InputSize::length,
+                              NN::OutputSize::length);
+  const double weights = NN::Parameters::size() * sizeof(T);
+  const double io = sizeof(*x) + sizeof(*t);
+
+  b.run(name + "/inference", s, forward_flops, weights + io,
+        [&]() { ic->forward(*x, *p); });
+  b.run(name + "/forward_error", s, forward_flops, weights + 2.0 * io,
+        [&]() {
+          fc->forward(*x, *p);
+          volatile T err = fc->error(*t);
+          (void)err;
+        });
+  b.run(name + "/gradient", s, 3.0 * forward_flops, 2.0 * weights + io,
+        [&]() { gc->computeGradient(*x, *p, *t, *g); });
+}
+
+/* -------------------- Counters -------------------- */
+
+/* The counters of every layer over `steps` gradient computations, after
+ * one to warm up. The table goes to stderr, the JSON to `json`. */
+template<typename NN, size_t batch_size, template<typename> class Error>
+void count_network(const std::string& name, size_t steps, bool first,
+                   std::ostream& json) {
+  using T = typename NN::DataType;
+  using GC = typename NN::template GradientComputation<batch_size, Error>;
+
+  std::unique_ptr<typename NN::Parameters> p(new typename NN::Parameters);
+  std::unique_ptr<typename NN::Parameters> g(new typename NN::Parameters);
+  std::unique_ptr<typename GC::Inputs> x(new typename GC::Inputs);
+  std::unique_ptr<typename GC::NetOutputs> t(new typename GC::NetOutputs);
+  fill(p->data(), p->size(), (T)-0.05, (T)0.05, 7u);
+  fill(*x, (T)0, (T)1, 8u);
+  for (size_t n = 0; n < batch_size; n++)
+    for (size_t i = 0; i < NN::OutputSize::length; i++)
+      (*t)[n][i] = i == n % NN::OutputSize::length ? (T)1 : (T)0;
+  std::unique_ptr<GC> gc(new GC);
+
+  CounterProfiler profiler;
+  if (first && !profiler.counters().any_available())
+    std::cerr << "no hardware counters (perf_event_open failed): only "
+              << "times, FLOPs and bytes are reported" << std::endl;
+  gc->computeGradient(*x, *p, *t, *g);
+  for (size_t s = 0; s < steps; s++)
+    gc->computeGradient(*x, *p, *t, *g, profiler);
+
+  std::cerr << std::endl << name << std::endl;
+  profiler.write_table(std::cerr);
+  json << (first ? "\n" : ",\n") << "\"" << name << "\": ";
+  profiler.write_json(json);
+}
+
+/* FullyConnected (with the GEMM of this build), Dropout and MaxPooling */
+void run_counters(const std::string& build, std::ostream& json) {
+  json << "{\"build\": \"" << build << "\", \"networks\": {";
+
+  using MLP = FeedForwardNet<float, Size<784>,
+                             FullyConnected<1000, ReLU>,
+                             Dropout<1000>,
+                             FullyConnected<1000, ReLU>,
+                             FullyConnected<10, Identity>>;
+  count_network<MLP, 64, SoftMax>("mlp", 20ul, true, json);
+
+  using Pooling = FeedForwardNet<float, Size<32, 32, 32>,
+                                 MaxPooling<2, 2>,
+                                 FullyConnected<10, Identity>>;
+  count_network<Pooling, 16, SoftMax>("max_pooling", 20ul, false, json);
+
+  json << "}}" << std::endl;
+}
+
+/* -------------------- Suite -------------------- */
+
+void run_suite(Benchmark& b) {
+  bench_fully_connected<float, 1, 784, 1000>(b, "fully_connected");
+  bench_fully_connected<float, 64, 784, 1000>(b, "fully_connected");
+  bench_fully_connected<float, 256, 1024, 1024>(b, "fully_connected");
+  bench_fully_connected<float, 64, 4096, 1024>(b, "fully_connected");
+  bench_fully_connected<float, 256, 1000, 10>(b, "fully_connected");
+  bench_fully_connected<double, 64, 784, 1000>(b, "fully_connected_double");
+
+  bench_convolution<float, 16, 16, 32, 32, 3, 1>(b, "convolution_3x3");
+  bench_convolution<float, 16, 8, 32, 16, 5, 1>(b, "convolution_5x5");
+  bench_convolution<float, 16, 16, 32, 32, 3, 2>(b, "convolution_3x3_s2");
+
+  bench_layer<MaxPooling<2, 2>, float, Size<32, 32, 32>, 16>(
+    b, "max_pooling", shape(16, 32 * 32 * 32), 0.0);
+  bench_layer<MaxPooling<3, 3, 2, 2>, float, Size<32, 32, 32>, 16>(
+    b, "max_pooling_3x3_s2", shape(16, 32 * 32 * 32), 0.0);
+  bench_layer<Dropout<2048>, float, Size<4096>, 64>(
+    b, "dropout", shape(64, 4096), 0.0);
+
+  bench_transfer<Identity, float, 64, 1024>(b, "identity");
+  bench_transfer<ReLU, float, 64, 1024>(b, "relu");
+  bench_transfer<Logistic, float, 64, 1024>(b, "logistic");
+  bench_transfer<FastLogistic, float, 64, 1024>(b, "fast_logistic");
+  bench_transfer<HyperbolicTangent, float, 64, 1024>(b, "tanh");
+  bench_transfer<FastHyperbolicTangent, float, 64, 1024>(b, "fast_tanh");
+  bench_transfer<Logistic, double, 64, 1024>(b, "logistic_double");
+
+  bench_errors<float, 64, 1000>(b);
+
+  using MLP = FeedForwardNet<float, Size<784>,
+                             FullyConnected<1000, ReLU>,
+                             FullyConnected<1000, ReLU>,
+                             FullyConnected<10, Identity>>;
+  bench_network<MLP, 64, SoftMax>(
+    b, "mlp", 2.0 * 64 * (784 * 1000 + 1000 * 1000 + 1000 * 10));
+
+  /* The network of feed_forward_test */
+  using Test = FeedForwardNet<double, Size<10>,
+                              FullyConnected<1000, Logistic>,
+                              MaxPooling<1, 1>,
+                              FullyConnected<1000, ReLU>,
+                              Dropout<500>,
+                              FullyConnected<2000, HyperbolicTangent>,
+                              FullyConnected<100, Identity>>;
+  bench_network<Test, 300, SoftMax>(
+    b, "test_network",
+    2.0 * 300 * (10 * 1000 + 1000 * 1000 + 1000 * 2000 + 2000 * 100));
+
+  /* 28 -conv 5x5-> 24 -pool-> 12 -conv 3x3-> 10 -pool-> 5 */
+  using ConvNet = FeedForwardNet<float, Size<1, 28, 28>,
+                                 Convolution<8, 5, 5, 1, FullConnection,
+                                             ReLU>,
+                                 MaxPooling<2, 2>,
+                                 Convolution<16, 3, 3, 1, FullConnection,
+                                             ReLU>,
+                                 MaxPooling<2, 2>,
+                                 FullyConnected<100, ReLU>,
+                                 FullyConnected<10, Identity>>;
+  bench_network<ConvNet, 32, SoftMax>(
+    b, "convnet",
+    2.0 * 32 * (8 * 24 * 24 * 25 + 16 * 10 * 10 * 8 * 9 + 400 * 100 +
+                100 * 10));
+}
+
+int main(int argc, char* argv[]) {
+#ifdef USE_CBLAS
+  std::string build = "cblas";
+#else
+  std::string build = "native";
+#endif
+  std::string filter;
+  std::string output;
+  std::string counters;
+  double max_seconds = 2.0;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--compare" && i + 2 < argc) {
+      std::ifstream first(argv[i + 1]);
+      std::ifstream second(argv[i + 2]);
+      if (!first || !second) {
+        std::cerr << "cannot read " << argv[i + 1] << " or " << argv[i + 2]
+                  << std::endl;
+        return 1;
+      }
+      Benchmark::compare(first, second, std::cout);
+      return 0;
+    } else if (arg == "--build" && i + 1 < argc) {
+      build = argv[++i];
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--max-seconds" && i + 1 < argc) {
+      max_seconds = std::stod(argv[++i]);
+    } else if (arg == "--output" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--counters" && i + 1 < argc) {
+      counters = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--build NAME] [--filter TEXT]"
+                << " [--max-seconds S] [--output FILE] [--counters FILE]"
+                << std::endl
+                << "       " << argv[0] << " --compare FIRST.csv SECOND.csv"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output);
+    if (!file) {
+      std::cerr << "cannot write " << output << std::endl;
+      return 1;
+    }
+  }
+  Benchmark b(build, output.empty() ? std::cout : file, filter);
+  b.max_seconds = max_seconds;
+  run_suite(b);
+
+  if (!counters.empty()) {
+    std::ofstream json(counters);
+    if (!json) {
+      std::cerr << "cannot write " << counters << std::endl;
+      return 1;
+    }
+    run_counters(build, json);
+  }
+  return 0;
+}
@@ -0,0 +1,58 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef ALIGNED_BUFFER_H
+#define ALIGNED_BUFFER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/* Heap storage aligned to a cache line. It only grows: asking for a smaller
+ * size keeps the old allocation, so scratch buffers can be reused between
+ * calls without touching the allocator.
+ */
+
+constexpr size_t cache_line_size = 64ul;
+
+template<typename T>
+class AlignedBuffer {
+ public:
+  AlignedBuffer() : data_(nullptr), size_(0ul) { }
+
+  explicit AlignedBuffer(size_t size) : data_(nullptr), size_(0ul) {
+    reserve(size);
+  }
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  AlignedBuffer(AlignedBuffer&& other) : data_(other.data_),
+                                         size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0ul;
+  }
+
+  ~AlignedBuffer() { std::free(data_); }
+
+  T* reserve(size_t size) {
+    if (size > size_) {
+      std::free(data_);
+      void* ptr = nullptr;
+      if (posix_memalign(&ptr, cache_line_size, size * sizeof(T)) != 0)
+        throw std::bad_alloc();
+      data_ = static_cast<T*>(ptr);
+      size_ = size;
+    }
+    return data_;
+  }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  T* data_;
+  size_t size_;
+};
+
+#endif
@@ -0,0 +1,273 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* A small harness for micro-benchmarks.
+ *
+ * Benchmark::run(name, shape, flops, bytes, f) calls f repeatedly:
+ *
+ *   - first for warmup_seconds, which also estimates the cost of a call;
+ *   - then in samples of `calls` consecutive calls, with `calls` chosen so
+ *     that a sample lasts at least min_sample_seconds (cheap kernels are
+ *     not measured against the resolution of the clock);
+ *   - until the relative standard error of the mean of the samples is
+ *     below target_error (the run is stable), or max_seconds have passed
+ *     (it is not).
+ *
+ * The times reported are per call. The median and p99_sample_mean are the
+ * median and the 99th percentile of the samples, i.e. of means over
+ * `calls` calls, which hide the slowest calls of a sample. Calls that last
+ * at least per_call_resolutions times the resolution of the clock are also
+ * timed one by one, and p99 is the 99th percentile of these times; for
+ * cheaper calls it is left out (0). flops and bytes are the useful work of
+ * one call and the bytes it has to read and write at least, so GFLOP/s and
+ * GB/s are computed from the median; a zero gives an empty column.
+ *
+ * Results go to a CSV stream, one line per benchmark, tagged with the name
+ * of the build; compare() puts the medians of two such files side by side.
+ */
+
+struct BenchmarkResult {
+  std::string build;
+  std::string name;
+  std::string shape;
+  double median;                              /* seconds per call */
+  double p99;                                 /* of single calls, or 0 */
+  double p99_sample_mean;
+  double gflops;
+  double gbps;
+  size_t samples;
+  size_t calls;                               /* calls per sample */
+  double error;                               /* relative standard error */
+  bool stable;
+};
+
+class Benchmark {
+ public:
+  double warmup_seconds = 0.05;
+  double min_sample_seconds = 20e-6;
+  double max_seconds = 2.0;
+  size_t min_samples = 20ul;
+  double target_error = 0.01;
+  double per_call_resolutions = 100.0;
+
+  /* Only the benchmarks whose name contains `filter` run */
+  Benchmark(const std::string& build, std::ostream& csv,
+            const std::string& filter = "")
+      : build_(build), csv_(csv), filter_(filter),
+        resolution_(_resolution()) {
+    csv_ << "build,benchmark,shape,median_us,p99_us,p99_sample_mean_us,"
+         << "gflops,gbps,samples,calls,error,stable" << std::endl;
+  }
+
+  bool selected(const std::string& name) const {
+    return name.find(filter_) != std::string::npos;
+  }
+
+  template<typename F>
+  void run(const std::string& name, const std::string& shape, double flops,
+           double bytes, F f) {
+    if (!selected(name))
+      return;
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    size_t warmup_calls = 0ul;
+    double elapsed = 0.0;
+    do {
+      f();
+      _clobber();
+      warmup_calls++;
+      elapsed = _seconds(start, Clock::now());
+    } while (elapsed < warmup_seconds);
+
+    const double per_call = elapsed / (double)warmup_calls;
+    const size_t calls =
+      std::max<size_t>(1ul, (size_t)std::ceil(min_sample_seconds / per_call));
+    const bool one_by_one = per_call >= per_call_resolutions * resolution_;
+
+    std::vector<double> samples;
+    std::vector<double> call_times;
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    double error = 1.0;
+    const Clock::time_point measured = Clock::now();
+    do {
+      const Clock::time_point a = Clock::now();
+      if (one_by_one) {
+        Clock::time_point before = a;
+        for (size_t c = 0; c < calls; c++) {
+          f();
+          _clobber();
+          const Clock::time_point after = Clock::now();
+          call_times.push_back(_seconds(before, after));
+          before = after;
+        }
+      } else {
+        for (size_t c = 0; c < calls; c++) {
+          f();
+          _clobber();
+        }
+      }
+      const double t = _seconds(a, Clock::now()) / (double)calls;
+      samples.push_back(t);
+      sum += t;
+      sum_squares += t * t;
+      const double n = (double)samples.size();
+      const double mean = sum / n;
+      const double variance =
+        std::max(0.0, (sum_squares - n * mean * mean) / std::max(1.0, n - 1));
+      error = std::sqrt(variance / n) / mean;
+    } while (samples.size() < min_samples ||
+             (error > target_error &&
+              _seconds(measured, Clock::now()) < max_seconds));
+
+    std::sort(samples.begin(), samples.end());
+    BenchmarkResult r;
+    r.build = build_;
+    r.name = name;
+    r.shape = shape;
+    r.median = _percentile(samples, 0.5);
+    r.p99_sample_mean = _percentile(samples, 0.99);
+    r.p99 = 0.0;
+    if (one_by_one) {
+      std::sort(call_times.begin(), call_times.end());
+      r.p99 = _percentile(call_times, 0.99);
+    }
+    r.gflops = flops / r.median * 1e-9;
+    r.gbps = bytes / r.median * 1e-9;
+    r.samples = samples.size();
+    r.calls = calls;
+    r.error = error;
+    r.stable = error <= target_error;
+    _write(r);
+  }
+
+  /* Reads two files written by Benchmark and prints, for the benchmarks in
+   * both, the two medians and how much faster the second build is */
+  static void compare(std::istream& first, std::istream& second,
+                      std::ostream& out) {
+    std::vector<std::pair<std::string, std::string>> order;
+    std::string a_name = "first";
+    std::string b_name = "second";
+    const std::map<std::string, double> a = _medians(first, &order,
+                                                     &a_name);
+    const std::map<std::string, double> b = _medians(second, nullptr,
+                                                     &b_name);
+
+    out << std::left << std::setw(36) << "benchmark" << std::setw(20)
+        << "shape" << std::right << std::setw(12) << (a_name + " us")
+        << std::setw(12) << (b_name + " us") << std::setw(10) << "speedup"
+        << std::endl;
+    for (const auto& key : order) {
+      const std::string id = key.first + "," + key.second;
+      if (b.find(id) == b.end())
+        continue;
+      const double ta = a.at(id);
+      const double tb = b.at(id);
+      out << std::left << std::setw(36) << key.first << std::setw(20)
+          << key.second << std::right << std::fixed << std::setprecision(2)
+          << std::setw(12) << ta << std::setw(12) << tb << std::setw(10)
+          << ta / tb << std::endl;
+    }
+  }
+
+ private:
+  static void _clobber() {
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#endif
+  }
+
+  static double _seconds(std::chrono::steady_clock::time_point a,
+                         std::chrono::steady_clock::time_point b) {
+    return std::chrono::duration<double>(b - a).count();
+  }
+
+  /* The smallest step between two readings of the clock (with the cost of
+   * reading it) */
+  static double _resolution() {
+    using Clock = std::chrono::steady_clock;
+    double resolution = 1.0;
+    for (size_t i = 0; i < 1000ul; i++) {
+      const Clock::time_point a = Clock::now();
+      Clock::time_point b;
+      do {
+        b = Clock::now();
+      } while (b == a);
+      resolution = std::min(resolution, _seconds(a, b));
+    }
+    return resolution;
+  }
+
+  /* Nearest rank */
+  static double _percentile(const std::vector<double>& sorted, double p) {
+    const size_t rank = (size_t)std::ceil(p * (double)sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(1ul, rank)) - 1ul];
+  }
+
+  void _write(const BenchmarkResult& r) {
+    std::ostringstream line;
+    line << r.build << "," << r.name << "," << r.shape << ","
+         << std::fixed << std::setprecision(3) << r.median * 1e6 << ",";
+    if (r.p99 > 0.0)
+      line << r.p99 * 1e6;
+    line << "," << r.p99_sample_mean * 1e6 << ",";
+    if (r.gflops > 0.0)
+      line << r.gflops;
+    line << ",";
+    if (r.gbps > 0.0)
+      line << r.gbps;
+    line << "," << r.samples << "," << r.calls << "," << std::setprecision(4)
+         << r.error << "," << (r.stable ? 1 : 0);
+    csv_ << line.str() << std::endl;
+    std::cerr << std::left << std::setw(36) << r.name << std::setw(20)
+              << r.shape << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << r.median * 1e6 << " us"
+              << (r.stable ? "" : "  (unstable)") << std::endl;
+  }
+
+  /* benchmark,shape -> median_us, in the order of the file */
+  static std::map<std::string, double>
+  _medians(std::istream& in,
+           std::vector<std::pair<std::string, std::string>>* order,
+           std::string* build) {
+    std::map<std::string, double> medians;
+    std::string line;
+    std::getline(in, line);                                /* header */
+    while (std::getline(in, line)) {
+      std::vector<std::string> fields;
+      std::istringstream columns(line);
+      std::string field;
+      while (std::getline(columns, field, ','))
+        fields.push_back(field);
+      if (fields.size() < 4ul)
+        continue;
+      *build = fields[0];
+      medians[fields[1] + "," + fields[2]] = std::stod(fields[3]);
+      if (order)
+        order->push_back(std::make_pair(fields[1], fields[2]));
+    }
+    return medians;
+  }
+
+  std::string build_;
+  std::ostream& csv_;
+  std::string filter_;
+  double resolution_;                         /* seconds */
+};
+
+#endif
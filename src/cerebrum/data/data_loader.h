@@ -0,0 +1,193 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cerebrum/aligned_buffer.h"
+
+/* Feeds a network with batches gathered on background threads.
+ *
+ * Batches are gathered into a ring of slots_no preallocated Batch objects,
+ * whose Inputs and NetOutputs are the types ForwardComputation and
+ * GradientComputation take. Batch b goes to slot b % slots_no; a worker
+ * fills it as soon as the consumer has given back the batch that used the
+ * slot before, so up to slots_no - 1 batches are ready while one is in use.
+ * next() only waits if the workers fall behind.
+ *
+ * An epoch is size / batch_size batches (the samples left over change from
+ * one epoch to the next). With shuffle on, the order of every epoch is a
+ * permutation drawn from seed + epoch, so runs are reproducible whatever the
+ * number of workers.
+ *
+ * Sources (IdxFile, RawFile, OneHot) provide size(), length() and
+ * read(index, T* out), which writes the length() values of one sample.
+ */
+
+template<typename T, size_t batch_size, typename InputSize,
+         typename OutputSize, typename InputSource, typename TargetSource>
+class _DataLoader {
+ public:
+  using Inputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  using NetOutputs = std::array<std::array<T, OutputSize::length>, batch_size>;
+
+  struct Batch {
+    alignas(cache_line_size) Inputs inputs;
+    alignas(cache_line_size) NetOutputs targets;
+  };
+
+  _DataLoader(InputSource inputs, TargetSource targets, bool shuffle = true,
+              size_t workers_no = 1ul, size_t slots_no = 4ul,
+              uint64_t seed = std::random_device()())
+      : inputs_(std::move(inputs)), targets_(std::move(targets)),
+        shuffle_(shuffle), seed_(seed), next_(0ul), consumed_(0ul),
+        started_(false), stop_(false) {
+    if (inputs_.length() != InputSize::length)
+      throw std::invalid_argument(
+        "inputs have " + std::to_string(inputs_.length()) +
+        " values per sample, the network takes " +
+        std::to_string(InputSize::length));
+    if (targets_.length() != OutputSize::length)
+      throw std::invalid_argument(
+        "targets have " + std::to_string(targets_.length()) +
+        " values per sample, the network gives " +
+        std::to_string(OutputSize::length));
+    if (inputs_.size() != targets_.size())
+      throw std::invalid_argument("inputs and targets differ in length");
+    if (inputs_.size() < batch_size)
+      throw std::invalid_argument("fewer samples than a batch");
+
+    batches_no_ = inputs_.size() / batch_size;
+    /* No more slots than batches in an epoch: then at most two epochs are
+     * being gathered at a time */
+    slots_no_ = std::max<size_t>(1ul, std::min(slots_no, batches_no_));
+    slots_.reserve(slots_no_);
+    slot_batch_.assign(slots_no_, std::numeric_limits<size_t>::max());
+    for (size_t e = 0; e < 2ul; e++) {
+      orders_[e].resize(inputs_.size());
+      std::iota(orders_[e].begin(), orders_[e].end(), 0ul);
+      ordered_epoch_[e] = std::numeric_limits<size_t>::max();
+    }
+    for (size_t w = 0; w < std::max<size_t>(1ul, workers_no); w++)
+      workers_.emplace_back(&_DataLoader::_work, this);
+  }
+
+  _DataLoader(const _DataLoader&) = delete;
+  _DataLoader& operator=(const _DataLoader&) = delete;
+
+  ~_DataLoader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    free_.notify_all();
+    for (std::thread& worker : workers_)
+      worker.join();
+  }
+
+  /* Gives back the previous batch and waits for the next one, which stays
+   * valid until the following call */
+  const Batch& next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (started_) {
+      consumed_++;
+      free_.notify_all();
+    }
+    started_ = true;
+    const size_t slot = consumed_ % slots_no_;
+    ready_.wait(lock, [this, slot]() {
+        return slot_batch_[slot] == consumed_;
+      });
+    return slots_.data()[slot];
+  }
+
+  size_t batches_per_epoch() const { return batches_no_; }
+
+  /* Epoch of the batch returned by the last call to next() */
+  size_t epoch() const { return consumed_ / batches_no_; }
+
+ private:
+  void _work() {
+    for (;;) {
+      size_t b;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        b = next_++;
+        free_.wait(lock, [this, b]() {
+            return stop_ || b < consumed_ + slots_no_;
+          });
+        if (stop_)
+          return;
+      }
+      _gather(b, slots_.data()[b % slots_no_]);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot_batch_[b % slots_no_] = b;
+      }
+      ready_.notify_all();
+    }
+  }
+
+  void _gather(size_t b, Batch& batch) {
+    const std::vector<size_t>& order = _order(b / batches_no_);
+    const size_t first = (b % batches_no_) * batch_size;
+    for (size_t n = 0; n < batch_size; n++) {
+      const size_t index = order[first + n];
+      inputs_.read(index, batch.inputs[n].data());
+      targets_.read(index, batch.targets[n].data());
+    }
+  }
+
+  /* Epochs e and e + 2 share an order: by the time a batch of e + 2 may be
+   * gathered, all the batches of e have been given back */
+  const std::vector<size_t>& _order(size_t epoch) {
+    std::lock_guard<std::mutex> lock(order_mutex_);
+    std::vector<size_t>& order = orders_[epoch % 2ul];
+    if (ordered_epoch_[epoch % 2ul] != epoch && shuffle_) {
+      std::iota(order.begin(), order.end(), 0ul);
+      std::mt19937_64 engine(seed_ + epoch);
+      std::shuffle(order.begin(), order.end(), engine);
+      ordered_epoch_[epoch % 2ul] = epoch;
+    }
+    return order;
+  }
+
+  InputSource inputs_;
+  TargetSource targets_;
+  const bool shuffle_;
+  const uint64_t seed_;
+  size_t batches_no_;
+
+  AlignedBuffer<Batch> slots_;
+  size_t slots_no_;
+  std::vector<size_t> slot_batch_;
+
+  std::mutex order_mutex_;
+  std::vector<size_t> orders_[2];
+  size_t ordered_epoch_[2];
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable free_;
+  size_t next_;
+  size_t consumed_;
+  bool started_;
+  bool stop_;
+  std::vector<std::thread> workers_;
+};
+
+#endif
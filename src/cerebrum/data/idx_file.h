@@ -0,0 +1,111 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef IDX_FILE_H
+#define IDX_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "cerebrum/mapped_file.h"
+
+/* A dataset in the IDX format of MNIST: two zero bytes, a type code, the
+ * number of dimensions, the dimensions as big-endian 32-bit integers and
+ * then the values, also big-endian. The first dimension counts the
+ * samples; the others make up one sample (a file of labels has a single
+ * dimension and one value per sample).
+ *
+ * The file is mapped, not read: read(index, out) converts one sample to T,
+ * multiplied by `scale` (e.g. 1 / 255 for the pixels of MNIST).
+ */
+
+template<typename Stored>
+inline Stored _from_big_endian(const char* bytes) {
+  Stored value;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  std::memcpy(&value, bytes, sizeof(Stored));
+#else
+  char swapped[sizeof(Stored)];
+  for (size_t b = 0; b < sizeof(Stored); b++)
+    swapped[b] = bytes[sizeof(Stored) - 1ul - b];
+  std::memcpy(&value, swapped, sizeof(Stored));
+#endif
+  return value;
+}
+
+class IdxFile {
+ public:
+  explicit IdxFile(const std::string& path, double scale = 1.0)
+      : file_(path), scale_(scale) {
+    const char* bytes = file_.data();
+    if (file_.size() < 4ul || bytes[0] != 0 || bytes[1] != 0)
+      _fail("not an IDX file", path);
+    type_ = (uint8_t)bytes[2];
+    value_size_ = _value_size(type_);
+    if (value_size_ == 0ul)
+      _fail("unknown value type", path);
+    const size_t dimensions_no = (uint8_t)bytes[3];
+    const size_t header_size = 4ul + 4ul * dimensions_no;
+    if (dimensions_no == 0ul || file_.size() < header_size)
+      _fail("truncated header", path);
+    size_ = _from_big_endian<uint32_t>(bytes + 4);
+    length_ = 1ul;
+    for (size_t d = 1; d < dimensions_no; d++)
+      length_ *= _from_big_endian<uint32_t>(bytes + 4ul + 4ul * d);
+    if (file_.size() - header_size < size_ * length_ * value_size_)
+      _fail("truncated data", path);
+    data_ = bytes + header_size;
+  }
+
+  /* Number of samples and number of values in a sample */
+  size_t size() const { return size_; }
+  size_t length() const { return length_; }
+
+  template<typename T>
+  void read(size_t index, T* out) const {
+    const char* sample = data_ + index * length_ * value_size_;
+    switch (type_) {
+    case 0x08: _convert<uint8_t>(sample, out); break;
+    case 0x09: _convert<int8_t>(sample, out); break;
+    case 0x0B: _convert<int16_t>(sample, out); break;
+    case 0x0C: _convert<int32_t>(sample, out); break;
+    case 0x0D: _convert<float>(sample, out); break;
+    case 0x0E: _convert<double>(sample, out); break;
+    }
+  }
+
+ private:
+  static size_t _value_size(uint8_t type) {
+    switch (type) {
+    case 0x08: case 0x09: return 1ul;
+    case 0x0B: return 2ul;
+    case 0x0C: case 0x0D: return 4ul;
+    case 0x0E: return 8ul;
+    default: return 0ul;
+    }
+  }
+
+  template<typename Stored, typename T>
+  void _convert(const char* sample, T* out) const {
+    const T scale = (T)scale_;
+    for (size_t i = 0; i < length_; i++)
+      out[i] =
+        (T)_from_big_endian<Stored>(sample + i * sizeof(Stored)) * scale;
+  }
+
+  static void _fail(const char* what, const std::string& path) {
+    throw std::runtime_error(path + ": " + what);
+  }
+
+  MappedFile file_;
+  double scale_;
+  const char* data_;
+  uint8_t type_;
+  size_t value_size_;
+  size_t size_;
+  size_t length_;
+};
+
+#endif
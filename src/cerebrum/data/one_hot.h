@@ -0,0 +1,56 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef ONE_HOT_H
+#define ONE_HOT_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+/* Turns a dataset of class labels (one value per sample) into targets for
+ * SoftMax: each label becomes a sample of classes_no values with a 1 at
+ * the label and 0 elsewhere. All labels are checked when it is built.
+ */
+
+template<typename Labels>
+class OneHot {
+ public:
+  OneHot(Labels labels, size_t classes_no)
+      : labels_(std::move(labels)), classes_no_(classes_no) {
+    if (labels_.length() != 1ul)
+      throw std::invalid_argument("labels must have one value per sample");
+    for (size_t index = 0; index < labels_.size(); index++)
+      if (_label(index) >= classes_no_)
+        throw std::invalid_argument("label " + std::to_string(_label(index)) +
+                                    " of sample " + std::to_string(index) +
+                                    " is not a class");
+  }
+
+  size_t size() const { return labels_.size(); }
+  size_t length() const { return classes_no_; }
+
+  template<typename T>
+  void read(size_t index, T* out) const {
+    for (size_t c = 0; c < classes_no_; c++)
+      out[c] = (T)0;
+    out[_label(index)] = (T)1;
+  }
+
+ private:
+  size_t _label(size_t index) const {
+    double label = -1.0;
+    labels_.read(index, &label);
+    return label >= 0.0 ? (size_t)label : classes_no_;
+  }
+
+  Labels labels_;
+  size_t classes_no_;
+};
+
+template<typename Labels>
+OneHot<Labels> one_hot(Labels labels, size_t classes_no) {
+  return OneHot<Labels>(std::move(labels), classes_no);
+}
+
+#endif
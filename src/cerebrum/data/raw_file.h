@@ -0,0 +1,61 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef RAW_FILE_H
+#define RAW_FILE_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "cerebrum/mapped_file.h"
+
+/* A dataset stored as samples of `length` values of type Stored, back to
+ * back and in native byte order, possibly after a header of header_size
+ * bytes that is skipped. The file is mapped; read(index, out) converts one
+ * sample to T and multiplies it by `scale`.
+ */
+
+template<typename Stored>
+class RawFile {
+ public:
+  RawFile(const std::string& path, size_t length, size_t header_size = 0ul,
+          double scale = 1.0)
+      : file_(path), scale_(scale), length_(length) {
+    const size_t sample_size = length * sizeof(Stored);
+    if (length == 0ul || file_.size() < header_size ||
+        (file_.size() - header_size) % sample_size != 0ul)
+      throw std::runtime_error(path + ": not a whole number of samples");
+    size_ = (file_.size() - header_size) / sample_size;
+    data_ = file_.data() + header_size;
+  }
+
+  /* Number of samples and number of values in a sample */
+  size_t size() const { return size_; }
+  size_t length() const { return length_; }
+
+  template<typename T>
+  void read(size_t index, T* out) const {
+    const char* sample = data_ + index * length_ * sizeof(Stored);
+    if (std::is_same<T, Stored>::value && scale_ == 1.0) {
+      std::memcpy(out, sample, length_ * sizeof(Stored));
+    } else {
+      const T scale = (T)scale_;
+      for (size_t i = 0; i < length_; i++) {
+        Stored value;
+        std::memcpy(&value, sample + i * sizeof(Stored), sizeof(Stored));
+        out[i] = (T)value * scale;
+      }
+    }
+  }
+
+ private:
+  MappedFile file_;
+  double scale_;
+  const char* data_;
+  size_t size_;
+  size_t length_;
+};
+
+#endif
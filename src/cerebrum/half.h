@@ -0,0 +1,157 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/* 16-bit storage types: IEEE 754 binary16 (Half: 5 exponent bits, 10
+ * mantissa bits, up to 65504) and bfloat16 (BFloat16: the upper half of a
+ * float, with its range and 7 mantissa bits).
+ *
+ * They only store values: there is no arithmetic on them. Converting to
+ * float is exact and implicit, so kernels written for float read them
+ * directly; converting from float rounds to nearest even, overflows to
+ * infinity and keeps NaNs, and has to be asked for. Half uses F16C when the
+ * header is compiled with it (e.g. `make native`) and bit manipulation
+ * otherwise; both give the same results, NaN payloads aside.
+ *
+ * convert(in, out, n) converts whole arrays between float and these types,
+ * with F16C vectors for Half where available.
+ */
+
+/* -------------------- Software conversions -------------------- */
+
+/* What Half does without F16C. They are defined either way, so that the
+ * two can be checked against each other (see tests.cc). */
+
+inline uint32_t _float_bits(float x) {
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+inline float _bits_float(uint32_t u) {
+  float x;
+  std::memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+/* Magnitudes below 2^-14 become subnormals: adding 0.5 aligns them so that
+ * the float unit does the rounding. The others get the exponent rebiased
+ * and the 13 dropped bits rounded to even. */
+inline uint16_t _half_from_float(float x) {
+  uint32_t u = _float_bits(x);
+  const uint16_t sign = (uint16_t)((u >> 16) & 0x8000u);
+  u &= 0x7FFFFFFFu;
+  uint16_t h;
+  if (u >= 0x47800000u) {                         /* >= 2^16, inf or NaN */
+    h = u > 0x7F800000u ? 0x7E00u : 0x7C00u;
+  } else if (u < 0x38800000u) {                   /* < 2^-14 */
+    const uint32_t magic = 0x3F000000u;           /* 0.5 */
+    h = (uint16_t)(_float_bits(_bits_float(u) + _bits_float(magic)) -
+                   magic);
+  } else {
+    u += 0xC8000FFFu + ((u >> 13) & 1u);          /* (15 - 127) << 23 */
+    h = (uint16_t)(u >> 13);
+  }
+  return sign | h;
+}
+
+inline float _half_to_float(uint16_t h) {
+  const uint32_t exponent = 0x7C00u << 13;
+  uint32_t u = (uint32_t)(h & 0x7FFFu) << 13;
+  const uint32_t e = u & exponent;
+  u += (127u - 15u) << 23;
+  if (e == exponent) {                            /* inf or NaN */
+    u += (128u - 16u) << 23;
+  } else if (e == 0u) {                           /* zero or subnormal */
+    u += 1u << 23;
+    u = _float_bits(_bits_float(u) - _bits_float(113u << 23));
+  }
+  return _bits_float(u | (uint32_t)(h & 0x8000u) << 16);
+}
+
+struct Half {
+  uint16_t bits;
+
+  Half() = default;
+  explicit Half(float x) : bits(_from_float(x)) { }
+
+  operator float() const { return _to_float(bits); }
+
+ private:
+#if defined(__F16C__)
+  static uint16_t _from_float(float x) {
+    return (uint16_t)_cvtss_sh(x, _MM_FROUND_TO_NEAREST_INT);
+  }
+
+  static float _to_float(uint16_t h) { return _cvtsh_ss(h); }
+#else
+  static uint16_t _from_float(float x) { return _half_from_float(x); }
+
+  static float _to_float(uint16_t h) { return _half_to_float(h); }
+#endif
+};
+
+struct BFloat16 {
+  uint16_t bits;
+
+  BFloat16() = default;
+  explicit BFloat16(float x) : bits(_from_float(x)) { }
+
+  operator float() const {
+    const uint32_t u = (uint32_t)bits << 16;
+    float x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+  }
+
+ private:
+  static uint16_t _from_float(float x) {
+    uint32_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u)          /* quiet NaN */
+      return (uint16_t)((u >> 16) | 0x40u);
+    return (uint16_t)((u + 0x7FFFu + ((u >> 16) & 1u)) >> 16);
+  }
+};
+
+/* -------------------- Array conversions -------------------- */
+
+template<typename From, typename To>
+inline void convert(const From* in, To* out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = To((float)in[i]);
+}
+
+#if defined(__F16C__)
+
+inline void convert(const float* in, Half* out, size_t n) {
+  size_t i = 0;
+  for (; i + 8ul <= n; i += 8ul)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                     _MM_FROUND_TO_NEAREST_INT));
+  for (; i < n; i++)
+    out[i] = Half(in[i]);
+}
+
+inline void convert(const Half* in, float* out, size_t n) {
+  size_t i = 0;
+  for (; i + 8ul <= n; i += 8ul)
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                       reinterpret_cast<const __m128i*>(in + i))));
+  for (; i < n; i++)
+    out[i] = in[i];
+}
+
+#endif
+
+#endif
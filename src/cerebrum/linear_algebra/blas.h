@@ -0,0 +1,70 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef BLAS_H
+#define BLAS_H
+
+#include <cstddef>
+
+#include "cerebrum/include_cblas.h"
+#include "cerebrum/linear_algebra/gemm.h"
+
+/* blas_gemm<trans_a, trans_b>(...) computes
+ *
+ *     C = alpha * op(A) * op(B) + beta * C      (all matrices row-major)
+ *
+ * with CBLAS for float and double when USE_CBLAS is defined, and with the
+ * native packed GEMM otherwise. `external` tells layers whether the product
+ * went to BLAS, i.e. whether a custom GEMM epilogue is available.
+ */
+
+template<bool trans_a, bool trans_b, typename T>
+struct _Blas {
+  static constexpr bool external = false;
+
+  inline static void
+  gemm(size_t m, size_t n, size_t k, T alpha, const T* a, size_t lda,
+       const T* b, size_t ldb, T beta, T* c, size_t ldc) {
+    ::gemm<trans_a, trans_b>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+};
+
+#ifdef USE_CBLAS
+
+template<bool trans_a, bool trans_b>
+struct _Blas<trans_a, trans_b, float> {
+  static constexpr bool external = true;
+
+  inline static void
+  gemm(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+       const float* b, size_t ldb, float beta, float* c, size_t ldc) {
+    cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+                trans_b ? CblasTrans : CblasNoTrans, m, n, k,
+                alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+};
+
+template<bool trans_a, bool trans_b>
+struct _Blas<trans_a, trans_b, double> {
+  static constexpr bool external = true;
+
+  inline static void
+  gemm(size_t m, size_t n, size_t k, double alpha, const double* a,
+       size_t lda, const double* b, size_t ldb, double beta, double* c,
+       size_t ldc) {
+    cblas_dgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+                trans_b ? CblasTrans : CblasNoTrans, m, n, k,
+                alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+};
+
+#endif
+
+template<bool trans_a, bool trans_b, typename T>
+inline void blas_gemm(size_t m, size_t n, size_t k,
+                      T alpha, const T* a, size_t lda, const T* b, size_t ldb,
+                      T beta, T* c, size_t ldc) {
+  _Blas<trans_a, trans_b, T>::gemm(m, n, k, alpha, a, lda, b, ldb,
+                                   beta, c, ldc);
+}
+
+#endif
@@ -0,0 +1,331 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+#include "cerebrum/simd.h"
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/half.h"
+
+/* Packed, cache-blocked matrix multiplication used when Cerebrum is built
+ * without BLAS:
+ *
+ *     C = alpha * op(A) * op(B) + beta * C      (all matrices row-major)
+ *
+ * The loop nest follows the usual Goto / BLIS decomposition: a kc x nc panel
+ * of op(B) is packed once and stays in L3, an mc x kc block of op(A) is
+ * packed into L2, and a register-tiled mr x nr micro-kernel streams through
+ * the packed panels from L1. The micro-kernel is written against Vector<T>,
+ * so the same code becomes AVX-512, AVX2, SSE2 or scalar depending on the flags
+ * the header is compiled with.
+ *
+ * A and B may be stored in another type than the one computed in (e.g. Half
+ * or BFloat16 for float, see half.h): their values are converted to T while
+ * they are packed, so the micro-kernel and the accumulation stay in T and
+ * only the reads of the operands get narrower.
+ */
+
+template<typename T>
+struct GemmBlocking {
+#if defined(__AVX512F__)
+  static constexpr size_t mr = 12ul;
+  static constexpr size_t nv = 2ul;
+#elif defined(__AVX2__) && defined(__FMA__)
+  static constexpr size_t mr = 6ul;
+  static constexpr size_t nv = 2ul;
+#elif defined(__SSE2__)
+  static constexpr size_t mr = 6ul;
+  static constexpr size_t nv = 2ul;
+#else
+  static constexpr size_t mr = 4ul;
+  static constexpr size_t nv = 4ul;
+#endif
+  static constexpr size_t nr = nv * Vector<T>::length;
+
+  /* kc x nr micro-panel of B in L1, mc x kc block of A in L2 */
+  static constexpr size_t kc = 256ul;
+  static constexpr size_t mc = mr * (96ul * 1024ul / (kc * sizeof(T) * mr));
+  static constexpr size_t nc = nr * (4096ul / nr);
+};
+
+template<typename T>
+struct MicroKernel {
+  using Blocking = GemmBlocking<T>;
+  using V = Vector<T>;
+  static constexpr size_t mr = Blocking::mr;
+  static constexpr size_t nv = Blocking::nv;
+  static constexpr size_t nr = Blocking::nr;
+
+  /* tile (mr x nr, row-major) = packed_a (kc x mr) * packed_b (kc x nr) */
+  inline static void
+  compute(size_t kc, const T* packed_a, const T* packed_b, T* tile) {
+    typename V::Type acc[mr][nv];
+#pragma GCC unroll 32
+    for (size_t i = 0; i < mr; i++)
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        acc[i][v] = V::zero();
+
+    for (size_t p = 0; p < kc; p++) {
+      typename V::Type b[nv];
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        b[v] = V::load(packed_b + v * V::length);
+#pragma GCC unroll 32
+      for (size_t i = 0; i < mr; i++) {
+        const typename V::Type a = V::broadcast(packed_a[i]);
+#pragma GCC unroll 8
+        for (size_t v = 0; v < nv; v++)
+          acc[i][v] = V::fma(a, b[v], acc[i][v]);
+      }
+      packed_a += mr;
+      packed_b += nr;
+    }
+
+#pragma GCC unroll 32
+    for (size_t i = 0; i < mr; i++)
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        V::store(tile + i * nr + v * V::length, acc[i][v]);
+  }
+};
+
+/* Epilogues decide how a finished mr x nr tile reaches C. While op(A) *
+ * op(B) is still being accumulated over several kc blocks, partial() keeps
+ * the running sum in C; finish() is called once per tile, on the last kc
+ * block, while the tile is still in L1. `first` tells whether C already
+ * holds a partial sum of this product.
+ */
+
+template<typename T>
+struct ScaleEpilogue {
+  T alpha;
+  T beta;
+
+  inline void
+  partial(size_t, size_t, size_t rows, size_t cols, const T* tile,
+          size_t ld_tile, T* c, size_t ldc, bool first) const {
+    finish(0ul, 0ul, rows, cols, tile, ld_tile, c, ldc, first);
+  }
+
+  inline void
+  finish(size_t, size_t, size_t rows, size_t cols, const T* tile,
+         size_t ld_tile, T* c, size_t ldc, bool first) const {
+    const T crt_beta = first ? beta : (T)1;
+    for (size_t i = 0; i < rows; i++) {
+      const T* tile_row = tile + i * ld_tile;
+      T* c_row = c + i * ldc;
+      if (crt_beta == (T)0) {
+        for (size_t j = 0; j < cols; j++)
+          c_row[j] = alpha * tile_row[j];
+      } else {
+        for (size_t j = 0; j < cols; j++)
+          c_row[j] = alpha * tile_row[j] + crt_beta * c_row[j];
+      }
+    }
+  }
+};
+
+/* Keeps plain partial sums in C; epilogues that only customize finish()
+ * derive from it */
+
+template<typename T>
+struct PartialSumEpilogue {
+  inline void
+  partial(size_t, size_t, size_t rows, size_t cols, const T* tile,
+          size_t ld_tile, T* c, size_t ldc, bool first) const {
+    for (size_t i = 0; i < rows; i++) {
+      const T* tile_row = tile + i * ld_tile;
+      T* c_row = c + i * ldc;
+      if (first) {
+        for (size_t j = 0; j < cols; j++)
+          c_row[j] = tile_row[j];
+      } else {
+        for (size_t j = 0; j < cols; j++)
+          c_row[j] += tile_row[j];
+      }
+    }
+  }
+};
+
+template<typename T, bool trans_a, bool trans_b, typename TA = T,
+         typename TB = T>
+struct Gemm {
+  using Blocking = GemmBlocking<T>;
+  static constexpr size_t mr = Blocking::mr;
+  static constexpr size_t nr = Blocking::nr;
+  static constexpr size_t kc = Blocking::kc;
+  static constexpr size_t mc = Blocking::mc;
+  static constexpr size_t nc = Blocking::nc;
+
+  /* C holds the partial sums between kc blocks (it may be written even if
+   * the epilogue sends the final values elsewhere) */
+  template<typename Epilogue>
+  static void compute(size_t m, size_t n, size_t k,
+                      const TA* a, size_t lda, const TB* b, size_t ldb,
+                      T* c, size_t ldc, const Epilogue& epilogue) {
+    static thread_local AlignedBuffer<T> a_buffer;
+    static thread_local AlignedBuffer<T> b_buffer;
+    T* packed_a = a_buffer.reserve(mc * kc);
+    T* packed_b = b_buffer.reserve(kc * nc);
+    alignas(cache_line_size) T tile[mr * nr];
+
+    if (k == 0ul) {
+      std::fill(tile, tile + mr * nr, (T)0);
+      for (size_t i = 0; i < m; i += mr)
+        for (size_t j = 0; j < n; j += nr)
+          epilogue.finish(i, j, std::min(mr, m - i), std::min(nr, n - j),
+                          tile, 0ul, c + i * ldc + j, ldc, true);
+      return;
+    }
+
+    for (size_t jc = 0; jc < n; jc += nc) {
+      const size_t nb = std::min(nc, n - jc);
+      for (size_t pc = 0; pc < k; pc += kc) {
+        const size_t kb = std::min(kc, k - pc);
+        const bool first = (pc == 0ul);
+        const bool last = (pc + kb == k);
+        pack_b(kb, nb, b + (trans_b ? jc * ldb + pc : pc * ldb + jc), ldb,
+               packed_b);
+        for (size_t ic = 0; ic < m; ic += mc) {
+          const size_t mb = std::min(mc, m - ic);
+          pack_a(mb, kb, a + (trans_a ? pc * lda + ic : ic * lda + pc), lda,
+                 packed_a);
+          for (size_t jr = 0; jr < nb; jr += nr) {
+            const size_t cols = std::min(nr, nb - jr);
+            for (size_t ir = 0; ir < mb; ir += mr) {
+              const size_t rows = std::min(mr, mb - ir);
+              const size_t i = ic + ir;
+              const size_t j = jc + jr;
+              MicroKernel<T>::compute(kb, packed_a + ir * kb,
+                                      packed_b + jr * kb, tile);
+              if (last)
+                epilogue.finish(i, j, rows, cols, tile, nr,
+                                c + i * ldc + j, ldc, first);
+              else
+                epilogue.partial(i, j, rows, cols, tile, nr,
+                                 c + i * ldc + j, ldc, first);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  static void compute(size_t m, size_t n, size_t k,
+                      T alpha, const TA* a, size_t lda,
+                      const TB* b, size_t ldb,
+                      T beta, T* c, size_t ldc) {
+    const ScaleEpilogue<T> epilogue = {alpha, beta};
+    compute(m, n, k, a, lda, b, ldb, c, ldc, epilogue);
+  }
+
+ private:
+
+  /* Panels of mr rows of op(A), k-major, zero padded to a multiple of mr */
+  inline static void
+  pack_a(size_t mb, size_t kb, const TA* a, size_t lda, T* packed) {
+    for (size_t ir = 0; ir < mb; ir += mr) {
+      const size_t rows = std::min(mr, mb - ir);
+      for (size_t p = 0; p < kb; p++) {
+        for (size_t i = 0; i < rows; i++)
+          packed[i] = (T)(trans_a ? a[p * lda + ir + i]
+                                  : a[(ir + i) * lda + p]);
+        for (size_t i = rows; i < mr; i++)
+          packed[i] = (T)0;
+        packed += mr;
+      }
+    }
+  }
+
+  /* Panels of nr columns of op(B), k-major, zero padded to a multiple of nr */
+  inline static void
+  pack_b(size_t kb, size_t nb, const TB* b, size_t ldb, T* packed) {
+    if (!std::is_same<T, TB>::value) {
+      pack_b_converted(kb, nb, b, ldb, packed);
+      return;
+    }
+    for (size_t jr = 0; jr < nb; jr += nr) {
+      const size_t cols = std::min(nr, nb - jr);
+      for (size_t p = 0; p < kb; p++) {
+        for (size_t j = 0; j < cols; j++)
+          packed[j] = (T)(trans_b ? b[(jr + j) * ldb + p]
+                                  : b[p * ldb + jr + j]);
+        for (size_t j = cols; j < nr; j++)
+          packed[j] = (T)0;
+        packed += nr;
+      }
+    }
+  }
+
+  /* Same panels from B stored in another type (B holds the weights in the
+   * layers that store them narrower). Values are converted a contiguous
+   * run at a time, so that convert() can use vector instructions; op(B) =
+   * B^T is converted into a buffer in L1 first and transposed from there. */
+  inline static void
+  pack_b_converted(size_t kb, size_t nb, const TB* b, size_t ldb,
+                   T* packed) {
+    alignas(cache_line_size) T rows[trans_b ? nr * kc : 1ul];
+    for (size_t jr = 0; jr < nb; jr += nr) {
+      const size_t cols = std::min(nr, nb - jr);
+      if (trans_b) {
+        for (size_t j = 0; j < cols; j++)
+          convert(b + (jr + j) * ldb, rows + j * kb, kb);
+        for (size_t p = 0; p < kb; p++) {
+          for (size_t j = 0; j < cols; j++)
+            packed[j] = rows[j * kb + p];
+          for (size_t j = cols; j < nr; j++)
+            packed[j] = (T)0;
+          packed += nr;
+        }
+      } else {
+        for (size_t p = 0; p < kb; p++) {
+          convert(b + p * ldb + jr, packed, cols);
+          for (size_t j = cols; j < nr; j++)
+            packed[j] = (T)0;
+          packed += nr;
+        }
+      }
+    }
+  }
+};
+
+/* std::min takes its arguments by reference: the blocking constants need a
+ * definition when they are not inlined (e.g. at -O0) */
+template<typename T, bool trans_a, bool trans_b, typename TA, typename TB>
+constexpr size_t Gemm<T, trans_a, trans_b, TA, TB>::mr;
+template<typename T, bool trans_a, bool trans_b, typename TA, typename TB>
+constexpr size_t Gemm<T, trans_a, trans_b, TA, TB>::nr;
+template<typename T, bool trans_a, bool trans_b, typename TA, typename TB>
+constexpr size_t Gemm<T, trans_a, trans_b, TA, TB>::kc;
+template<typename T, bool trans_a, bool trans_b, typename TA, typename TB>
+constexpr size_t Gemm<T, trans_a, trans_b, TA, TB>::mc;
+template<typename T, bool trans_a, bool trans_b, typename TA, typename TB>
+constexpr size_t Gemm<T, trans_a, trans_b, TA, TB>::nc;
+
+/* C = alpha * op(A) * op(B) + beta * C, with op given by trans_a / trans_b */
+
+template<bool trans_a, bool trans_b, typename T, typename TA, typename TB>
+inline void gemm(size_t m, size_t n, size_t k,
+                 T alpha, const TA* a, size_t lda, const TB* b, size_t ldb,
+                 T beta, T* c, size_t ldc) {
+  Gemm<T, trans_a, trans_b, TA, TB>::compute(m, n, k, alpha, a, lda, b, ldb,
+                                             beta, c, ldc);
+}
+
+/* C = op(A) * op(B), finished by a custom epilogue */
+
+template<bool trans_a, bool trans_b, typename T, typename TA, typename TB,
+         typename Epilogue>
+inline void gemm(size_t m, size_t n, size_t k,
+                 const TA* a, size_t lda, const TB* b, size_t ldb,
+                 T* c, size_t ldc, const Epilogue& epilogue) {
+  Gemm<T, trans_a, trans_b, TA, TB>::compute(m, n, k, a, lda, b, ldb, c, ldc,
+                                             epilogue);
+}
+
+#endif
@@ -0,0 +1,265 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef INT8_GEMM_H
+#define INT8_GEMM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX512BW__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "cerebrum/aligned_buffer.h"
+
+/* 8-bit matrix multiplication with 32-bit accumulators, for quantized
+ * inference:
+ *
+ *     C (m x n, int32) = A (m x k, uint8) * B^T (B: n x k, int8)
+ *
+ * B holds weights, so it is packed once, ahead of time, by pack_int8():
+ * panels of nr rows of B with k in groups of four consecutive values, so
+ * that one vector load gives four values of each of nr columns of C. The
+ * micro-kernel broadcasts four values of a row of A and multiplies them
+ * with such a load (VPDPBUSD with AVX-512 VNNI; two VPMADDWD on even and
+ * odd bytes otherwise, which gives exactly the same sums), for an mr x nr
+ * tile of C held in registers. Finished tiles go to an epilogue, which
+ * turns them into the layer's outputs.
+ */
+
+#if defined(__AVX512BW__)
+
+struct U8S8Vector {
+  using Type = __m512i;
+  static constexpr size_t length = 16ul;          /* int32 lanes */
+
+  inline static Type zero() { return _mm512_setzero_si512(); }
+  inline static Type broadcast(const uint8_t* a) {
+    int32_t x;
+    std::memcpy(&x, a, sizeof(x));
+    return _mm512_set1_epi32(x);
+  }
+  inline static Type load(const int8_t* b) { return _mm512_load_si512(b); }
+  inline static void store(int32_t* c, Type x) { _mm512_store_si512(c, x); }
+
+  /* acc + the sums of four products of unsigned a and signed b bytes */
+  inline static Type dot(Type acc, Type a, Type b) {
+#if defined(__AVX512VNNI__)
+    return _mm512_dpbusd_epi32(acc, a, b);
+#else
+    const Type even = _mm512_madd_epi16(
+      _mm512_and_si512(a, _mm512_set1_epi16(0x00FF)),
+      _mm512_srai_epi16(_mm512_slli_epi16(b, 8), 8));
+    const Type odd = _mm512_madd_epi16(_mm512_srli_epi16(a, 8),
+                                       _mm512_srai_epi16(b, 8));
+    return _mm512_add_epi32(acc, _mm512_add_epi32(even, odd));
+#endif
+  }
+};
+
+#elif defined(__AVX2__)
+
+struct U8S8Vector {
+  using Type = __m256i;
+  static constexpr size_t length = 8ul;
+
+  inline static Type zero() { return _mm256_setzero_si256(); }
+  inline static Type broadcast(const uint8_t* a) {
+    int32_t x;
+    std::memcpy(&x, a, sizeof(x));
+    return _mm256_set1_epi32(x);
+  }
+  inline static Type load(const int8_t* b) {
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(b));
+  }
+  inline static void store(int32_t* c, Type x) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(c), x);
+  }
+  inline static Type dot(Type acc, Type a, Type b) {
+    const Type even = _mm256_madd_epi16(
+      _mm256_and_si256(a, _mm256_set1_epi16(0x00FF)),
+      _mm256_srai_epi16(_mm256_slli_epi16(b, 8), 8));
+    const Type odd = _mm256_madd_epi16(_mm256_srli_epi16(a, 8),
+                                       _mm256_srai_epi16(b, 8));
+    return _mm256_add_epi32(acc, _mm256_add_epi32(even, odd));
+  }
+};
+
+#elif defined(__SSE2__)
+
+struct U8S8Vector {
+  using Type = __m128i;
+  static constexpr size_t length = 4ul;
+
+  inline static Type zero() { return _mm_setzero_si128(); }
+  inline static Type broadcast(const uint8_t* a) {
+    int32_t x;
+    std::memcpy(&x, a, sizeof(x));
+    return _mm_set1_epi32(x);
+  }
+  inline static Type load(const int8_t* b) {
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(b));
+  }
+  inline static void store(int32_t* c, Type x) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(c), x);
+  }
+  inline static Type dot(Type acc, Type a, Type b) {
+    const Type even = _mm_madd_epi16(
+      _mm_and_si128(a, _mm_set1_epi16(0x00FF)),
+      _mm_srai_epi16(_mm_slli_epi16(b, 8), 8));
+    const Type odd = _mm_madd_epi16(_mm_srli_epi16(a, 8),
+                                    _mm_srai_epi16(b, 8));
+    return _mm_add_epi32(acc, _mm_add_epi32(even, odd));
+  }
+};
+
+#else
+
+/* One lane: Type holds either an accumulator or four packed bytes */
+
+struct U8S8Vector {
+  using Type = int32_t;
+  static constexpr size_t length = 1ul;
+
+  inline static Type zero() { return 0; }
+  inline static Type broadcast(const uint8_t* a) {
+    int32_t x;
+    std::memcpy(&x, a, sizeof(x));
+    return x;
+  }
+  inline static Type load(const int8_t* b) { return broadcast(
+      reinterpret_cast<const uint8_t*>(b)); }
+  inline static void store(int32_t* c, Type x) { *c = x; }
+  inline static Type dot(Type acc, Type a, Type b) {
+    uint8_t a_bytes[4];
+    int8_t b_bytes[4];
+    std::memcpy(a_bytes, &a, 4ul);
+    std::memcpy(b_bytes, &b, 4ul);
+    for (size_t s = 0; s < 4ul; s++)
+      acc += (int32_t)a_bytes[s] * (int32_t)b_bytes[s];
+    return acc;
+  }
+};
+
+#endif
+
+struct Int8Blocking {
+#if defined(__AVX512BW__)
+  static constexpr size_t mr = 8ul;
+  static constexpr size_t nv = 2ul;
+#elif defined(__AVX2__) || defined(__SSE2__)
+  static constexpr size_t mr = 4ul;
+  static constexpr size_t nv = 2ul;
+#else
+  static constexpr size_t mr = 4ul;
+  static constexpr size_t nv = 4ul;
+#endif
+  static constexpr size_t nr = nv * U8S8Vector::length;
+
+  /* Bytes of packed B for the columns of C computed in one block (L2) */
+  static constexpr size_t block_bytes = 192ul * 1024ul;
+};
+
+/* k rounded up to whole groups of four */
+inline size_t int8_depth(size_t k) { return (k + 3ul) / 4ul * 4ul; }
+
+/* Bytes pack_int8 writes for an n x k matrix */
+inline size_t int8_packed_size(size_t n, size_t k) {
+  const size_t nr = Int8Blocking::nr;
+  return (n + nr - 1ul) / nr * nr * int8_depth(k);
+}
+
+/* Packs B (n x k, row-major) into panels of nr rows, zero padded: panel
+ * p holds, for every group g of four values of k, the four values of each
+ * of its nr rows. `packed` must be aligned to a cache line. */
+inline void pack_int8(size_t n, size_t k, const int8_t* b, size_t ldb,
+                      int8_t* packed) {
+  const size_t nr = Int8Blocking::nr;
+  const size_t depth = int8_depth(k);
+  for (size_t jr = 0; jr < n; jr += nr) {
+    for (size_t p = 0; p < depth; p += 4ul) {
+      for (size_t j = 0; j < nr; j++) {
+        for (size_t s = 0; s < 4ul; s++)
+          packed[j * 4ul + s] = (jr + j < n && p + s < k) ?
+            b[(jr + j) * ldb + p + s] : (int8_t)0;
+      }
+      packed += nr * 4ul;
+    }
+  }
+}
+
+struct Int8MicroKernel {
+  using V = U8S8Vector;
+  static constexpr size_t mr = Int8Blocking::mr;
+  static constexpr size_t nv = Int8Blocking::nv;
+  static constexpr size_t nr = Int8Blocking::nr;
+
+  /* tile (mr x nr, row-major) = a (mr rows of depth values) * panel */
+  inline static void
+  compute(size_t depth, const uint8_t* a, size_t lda, const int8_t* panel,
+          int32_t* tile) {
+    typename V::Type acc[mr][nv];
+#pragma GCC unroll 16
+    for (size_t i = 0; i < mr; i++)
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        acc[i][v] = V::zero();
+
+    for (size_t p = 0; p < depth; p += 4ul) {
+      typename V::Type b[nv];
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        b[v] = V::load(panel + v * V::length * 4ul);
+#pragma GCC unroll 16
+      for (size_t i = 0; i < mr; i++) {
+        const typename V::Type a_i = V::broadcast(a + i * lda + p);
+#pragma GCC unroll 8
+        for (size_t v = 0; v < nv; v++)
+          acc[i][v] = V::dot(acc[i][v], a_i, b[v]);
+      }
+      panel += nr * 4ul;
+    }
+
+#pragma GCC unroll 16
+    for (size_t i = 0; i < mr; i++)
+#pragma GCC unroll 8
+      for (size_t v = 0; v < nv; v++)
+        V::store(tile + i * nr + v * V::length, acc[i][v]);
+  }
+};
+
+/* C = A * B^T with B packed by pack_int8. A has int8_depth(k) readable
+ * values per row (lda >= that) and m rounded up to a multiple of mr
+ * readable rows. The epilogue gets every tile once:
+ *
+ *     epilogue.finish(i0, j0, rows, cols, tile, ld_tile)
+ */
+
+template<typename Epilogue>
+inline void int8_gemm(size_t m, size_t n, size_t k,
+                      const uint8_t* a, size_t lda, const int8_t* packed_b,
+                      const Epilogue& epilogue) {
+  const size_t mr = Int8Blocking::mr;
+  const size_t nr = Int8Blocking::nr;
+  const size_t depth = int8_depth(k);
+  const size_t panel_size = nr * depth;
+  const size_t nc =
+    nr * std::max<size_t>(1ul, Int8Blocking::block_bytes / (panel_size + 1));
+  alignas(cache_line_size) int32_t tile[mr * nr];
+
+  for (size_t jc = 0; jc < n; jc += nc) {
+    const size_t j_end = std::min(n, jc + nc);
+    for (size_t i = 0; i < m; i += mr) {
+      for (size_t j = jc; j < j_end; j += nr) {
+        Int8MicroKernel::compute(depth, a + i * lda, lda,
+                                 packed_b + j / nr * panel_size, tile);
+        epilogue.finish(i, j, std::min(mr, m - i), std::min(nr, n - j),
+                        tile, nr);
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A whole file mapped read-only. Pages are read by the kernel when they are
+ * first touched, so opening a large file costs nothing until it is used.
+ */
+
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path)
+      : address_(MAP_FAILED), size_(0ul) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      _fail("cannot open ", path);
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      _fail("cannot stat ", path);
+    }
+    size_ = (size_t)info.st_size;
+    if (size_ > 0ul)
+      address_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (size_ > 0ul && address_ == MAP_FAILED)
+      _fail("cannot map ", path);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) : address_(other.address_),
+                                   size_(other.size_) {
+    other.address_ = MAP_FAILED;
+    other.size_ = 0ul;
+  }
+
+  ~MappedFile() {
+    if (address_ != MAP_FAILED)
+      munmap(address_, size_);
+  }
+
+  /* Null for an empty file */
+  const char* data() const {
+    return address_ == MAP_FAILED ?
+      nullptr : static_cast<const char*>(address_);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  static void _fail(const char* what, const std::string& path) {
+    throw std::runtime_error(what + path + ": " + std::strerror(errno));
+  }
+
+  void* address_;
+  size_t size_;
+};
+
+#endif
@@ -8,9 +8,16 @@
 template<typename T, size_t height, size_t width, T... values>
 struct MetaMatrix { };
 
-template<typename T, size_t height, size_t width>
-struct MetaMatrix<T, height, width> {
+template<typename T, size_t _height, size_t _width>
+struct MetaMatrix<T, _height, _width> {
+  using Type = T;
+  static constexpr size_t height = _height;
+  static constexpr size_t width = _width;
   static constexpr size_t left = 0ul;
+  static constexpr size_t nonzero = 0ul;
+
+  static constexpr T at(size_t) { return T(); }
+  static constexpr T get(size_t, size_t) { return T(); }
 };
 
 template<typename T, size_t _height, size_t _width, T head, T... tail>
@@ -21,6 +28,17 @@ struct MetaMatrix<T, _height, _width, head, tail...> {
   static constexpr size_t height = _height;
   static constexpr size_t width = _width;
   static constexpr size_t left = 1ul + Rest::left;
+  static constexpr size_t nonzero = (head != T() ? 1ul : 0ul) + Rest::nonzero;
+
+  /* Element at position index of the remaining values (row-major) */
+  static constexpr T at(size_t index) {
+    return index == 0ul ? head : Rest::at(index - 1ul);
+  }
+
+  /* Element (row, col); only meaningful on a complete matrix */
+  static constexpr T get(size_t row, size_t col) {
+    return at(row * width + col);
+  }
 };
 
 #endif
@@ -10,6 +10,7 @@
 #include "cerebrum/neural_networks/layers/fully_connected.h"
 #include "cerebrum/neural_networks/layers/dropout.h"
 #include "cerebrum/neural_networks/layers/max_pooling.h"
+#include "cerebrum/neural_networks/layers/convolution.h"
 
 #include "cerebrum/neural_networks/transfer_functions/logistic.h"
 #include "cerebrum/neural_networks/transfer_functions/tanh.h"
@@ -20,5 +21,14 @@
 #include "cerebrum/neural_networks/error_functions/sum_of_squares.h"
 #include "cerebrum/neural_networks/error_functions/softmax.h"
 
+#include "cerebrum/neural_networks/optimizers/sgd.h"
+#include "cerebrum/neural_networks/optimizers/momentum.h"
+#include "cerebrum/neural_networks/optimizers/rmsprop.h"
+#include "cerebrum/neural_networks/optimizers/adam.h"
+
+#include "cerebrum/data/idx_file.h"
+#include "cerebrum/data/raw_file.h"
+#include "cerebrum/data/one_hot.h"
+
 #endif
 
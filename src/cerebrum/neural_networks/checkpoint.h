@@ -0,0 +1,236 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/mapped_file.h"
+#include "cerebrum/neural_networks/parameters.h"
+
+/* Binary checkpoints of _Parameters.
+ *
+ * A checkpoint is the parameter arena exactly as it lives in memory, so
+ * that it can be used without being parsed. The file holds (native byte
+ * order):
+ *
+ *   _CheckpointHeader        64 bytes, see below
+ *   layer table              layers_no pairs of uint64_t (offset, size), in
+ *                            values from the start of the arena
+ *   zero padding             up to data_offset, a multiple of 4096
+ *   arena                    data_size values of type T, gaps included
+ *
+ * The signature is a hash of the mangled name of the _Parameters type. It
+ * spells out T, the input size and every layer with all its template
+ * arguments, so a checkpoint is only accepted by the network it was saved
+ * from (and by a compiler with the same ABI). The checksum covers the
+ * arena.
+ *
+ * save_checkpoint() writes to a temporary file and renames it over `path`,
+ * so a process that has the old checkpoint mapped keeps a consistent copy.
+ * load_checkpoint() copies a checkpoint into Parameters that can be
+ * trained. _MappedParameters maps the file read-only and builds the views
+ * of the layers right over the mapping: nothing is read besides the header
+ * and the layer table until inference touches the weights (or, unless it
+ * is turned off, the checksum is verified).
+ */
+
+struct _CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t value_size;
+  uint64_t signature;
+  uint64_t layers_no;
+  uint64_t data_offset;                                      /* in bytes */
+  uint64_t data_size;                                       /* in values */
+  uint64_t checksum;
+};
+
+static_assert(sizeof(_CheckpointHeader) == 64ul,
+              "the checkpoint header must have no padding");
+
+constexpr char checkpoint_magic[8] = {'C', 'E', 'R', 'E', 'B', 'R', 'U', 'M'};
+constexpr uint32_t checkpoint_version = 1u;
+constexpr uint32_t checkpoint_byte_order = 0x01020304u;
+constexpr size_t checkpoint_alignment = 4096ul;
+
+/* -------------------- Hashes -------------------- */
+
+/* FNV-1a */
+inline uint64_t _checkpoint_hash(const char* bytes, size_t length,
+                                 uint64_t h = 0xCBF29CE484222325ul) {
+  for (size_t i = 0; i < length; i++)
+    h = (h ^ (uint8_t)bytes[i]) * 0x100000001B3ul;
+  return h;
+}
+
+/* Four independent FNV-like lanes over 64-bit words, so that the multiplies
+ * overlap; every step is a bijection of the lane, so any single changed
+ * word is detected */
+inline uint64_t _checkpoint_checksum(const char* bytes, size_t length) {
+  uint64_t h[4] = {0xCBF29CE484222325ul, 0x84222325CBF29CE4ul,
+                   0x9E3779B97F4A7C15ul, 0xBB67AE8584CAA73Bul};
+  size_t i = 0;
+  for (; i + 32ul <= length; i += 32ul) {
+    uint64_t w[4];
+    std::memcpy(w, bytes + i, sizeof(w));
+    for (size_t l = 0; l < 4ul; l++)
+      h[l] = (h[l] ^ w[l]) * 0x100000001B3ul;
+  }
+  uint64_t all = _checkpoint_hash(bytes + i, length - i);
+  for (size_t l = 0; l < 4ul; l++)
+    all = _checkpoint_hash(reinterpret_cast<const char*>(&h[l]),
+                           sizeof(uint64_t), all);
+  return all;
+}
+
+template<typename Parameters>
+inline uint64_t _checkpoint_signature() {
+  const char* name = typeid(Parameters).name();
+  return _checkpoint_hash(name, std::strlen(name));
+}
+
+/* -------------------- Saving -------------------- */
+
+template<typename Parameters>
+void save_checkpoint(const Parameters& parameters, const std::string& path) {
+  using T = typename Parameters::DataType;
+  const size_t layers_no = Parameters::layers_no;
+  const size_t table_size = 2ul * layers_no * sizeof(uint64_t);
+  const size_t data_offset =
+    (sizeof(_CheckpointHeader) + table_size + checkpoint_alignment - 1ul) /
+    checkpoint_alignment * checkpoint_alignment;
+  const size_t data_bytes = Parameters::size() * sizeof(T);
+  const char* data = reinterpret_cast<const char*>(parameters.data());
+
+  _CheckpointHeader header;
+  std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.version = checkpoint_version;
+  header.byte_order = checkpoint_byte_order;
+  header.value_size = sizeof(T);
+  header.signature = _checkpoint_signature<Parameters>();
+  header.layers_no = layers_no;
+  header.data_offset = data_offset;
+  header.data_size = Parameters::size();
+  header.checksum = _checkpoint_checksum(data, data_bytes);
+
+  std::vector<uint64_t> table(2ul * layers_no);
+  for (size_t l = 0; l < layers_no; l++) {
+    table[2ul * l] = parameters.layer_data(l) - parameters.data();
+    table[2ul * l + 1ul] = parameters.layer_size(l);
+  }
+  const std::vector<char> padding(
+    data_offset - sizeof(_CheckpointHeader) - table_size, 0);
+
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.data()), table_size);
+    file.write(padding.data(), padding.size());
+    file.write(data, data_bytes);
+    file.flush();
+    if (!file)
+      throw std::runtime_error("cannot write checkpoint " + tmp_path);
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("cannot rename " + tmp_path + " to " + path +
+                             ": " + std::strerror(errno));
+}
+
+/* -------------------- Loading -------------------- */
+
+/* Checks a mapped checkpoint against Parameters and returns its arena */
+template<typename Parameters>
+const typename Parameters::DataType*
+_checkpoint_data(const MappedFile& file, const std::string& path,
+                 bool verify) {
+  using T = typename Parameters::DataType;
+  using Layout = typename Parameters::Layout;
+  const auto fail = [&path](const char* what) {
+    throw std::runtime_error("checkpoint " + path + ": " + what);
+  };
+
+  if (file.size() < sizeof(_CheckpointHeader))
+    fail("file too short");
+  _CheckpointHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)))
+    fail("not a checkpoint");
+  if (header.version != checkpoint_version)
+    fail("unsupported version");
+  if (header.byte_order != checkpoint_byte_order)
+    fail("saved with a different byte order");
+  if (header.value_size != sizeof(T))
+    fail("saved with a different value type");
+  if (header.signature != _checkpoint_signature<Parameters>() ||
+      header.layers_no != Parameters::layers_no ||
+      header.data_size != Parameters::size())
+    fail("saved from a different network");
+
+  const size_t table_size = 2ul * header.layers_no * sizeof(uint64_t);
+  const size_t data_bytes = header.data_size * sizeof(T);
+  if (header.data_offset % cache_line_size != 0ul ||
+      header.data_offset < sizeof(_CheckpointHeader) + table_size ||
+      header.data_offset > file.size() ||
+      data_bytes > file.size() - header.data_offset)
+    fail("truncated or corrupted");
+
+  std::vector<uint64_t> table(2ul * header.layers_no);
+  std::memcpy(table.data(), file.data() + sizeof(header), table_size);
+  for (size_t l = 0; l < header.layers_no; l++)
+    if (table[2ul * l] != Layout::layer_offset(l) ||
+        table[2ul * l + 1ul] != Layout::layer_size(l))
+      fail("saved with a different parameter layout");
+
+  const char* data = file.data() + header.data_offset;
+  if (verify && _checkpoint_checksum(data, data_bytes) != header.checksum)
+    fail("checksum mismatch");
+  return reinterpret_cast<const T*>(data);
+}
+
+/* Copies a checkpoint into parameters */
+template<typename Parameters>
+void load_checkpoint(Parameters& parameters, const std::string& path) {
+  using T = typename Parameters::DataType;
+  const MappedFile file(path);
+  const T* data = _checkpoint_data<Parameters>(file, path, true);
+  std::memcpy(parameters.data(), data, Parameters::size() * sizeof(T));
+}
+
+/* Read-only Parameters that live in a mapped checkpoint. The mapping is
+ * released with the object, so parameters() must not outlive it. */
+template<typename Parameters>
+class _MappedParameters {
+ public:
+  using T = typename Parameters::DataType;
+
+  explicit _MappedParameters(const std::string& path, bool verify = true)
+      : file_(path),
+        parameters_(const_cast<T*>(
+                      _checkpoint_data<Parameters>(file_, path, verify)),
+                    _ParametersView()) { }
+
+  _MappedParameters(const _MappedParameters&) = delete;
+  _MappedParameters& operator=(const _MappedParameters&) = delete;
+
+  /* The pages are mapped read-only: they may only be read */
+  const Parameters& parameters() const { return parameters_; }
+
+ private:
+  MappedFile file_;
+  Parameters parameters_;
+};
+
+#endif
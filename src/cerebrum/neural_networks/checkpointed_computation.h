@@ -0,0 +1,442 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef CHECKPOINTED_COMPUTATION_H
+#define CHECKPOINTED_COMPUTATION_H
+
+#include <cstddef>
+#include <array>
+#include <type_traits>
+
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/profiler.h"
+
+/* Gradients with checkpointed activations.
+ *
+ * _GradientComputation keeps the Hidden, Outputs and errors of every layer
+ * for the whole step, so its memory grows with the depth of the network
+ * times batch_size. Here the layers are split into segments of
+ * segment_length consecutive layers (ceil(sqrt(depth)) when it is 0), and
+ * only the outputs at the end of each segment (the checkpoints) are kept:
+ *
+ *   - the forward pass runs once over all the layers; the Hidden and the
+ *     outputs inside a segment go to a workspace that every segment reuses,
+ *     as large as the largest segment;
+ *   - backpropagation goes through the segments from the last one; before a
+ *     segment is backpropagated, its forward pass runs again from the
+ *     checkpoint before it to refill the workspace (the last segment is
+ *     still there);
+ *   - the errors of consecutive layers use two buffers in turns.
+ *
+ * The activation memory is then that of about depth / segment_length
+ * checkpoints plus segment_length layers, O(sqrt(depth)), for at most one
+ * more forward pass. Layers that are not recomputable (Dropout, whose
+ * masks are random) always end a segment and keep their Hidden; the last
+ * layer also does, and holds the outputs of the network. Layers whose
+ * Hidden is only scratch space (Convolution) all use one scratch buffer,
+ * as large as the largest of them.
+ *
+ * The savings grow with the depth: a shallow network whose largest
+ * activations are in its first segment saves little, and the two error
+ * buffers may even make it use more memory than _GradientComputation.
+ *
+ * The gradient and the error are the same as _GradientComputation's.
+ */
+
+template<typename T, size_t batch_size, size_t segment_length,
+         typename ErrorFunction, bool computes, size_t layer, size_t offset,
+         typename InputSize, typename... OtherLayers>
+struct _CheckpointPlan;
+
+/* The workspace of the current segment, the scratch space shared by the
+ * layers and the two buffers for errors */
+struct _CheckpointBuffers {
+  unsigned char* workspace;
+  unsigned char* scratch;
+  unsigned char* errors[2];
+};
+
+struct _NotStored { };
+
+constexpr size_t _cache_lines(size_t bytes) {
+  return (bytes + cache_line_size - 1ul) / cache_line_size * cache_line_size;
+}
+
+template<typename T, size_t batch_size, size_t segment_length,
+         typename ErrorFunction, size_t layer, size_t offset,
+         typename InputSize>
+struct _CheckpointPlan<T, batch_size, segment_length, ErrorFunction, true,
+                       layer, offset, InputSize> {
+
+  using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  NetOutputs y;
+
+  static constexpr size_t workspace_size() { return 0ul; }
+  static constexpr size_t scratch_size() { return 0ul; }
+  static constexpr size_t errors_size() { return 0ul; }
+  static constexpr bool _last_segment() { return true; }
+
+  template<typename W, typename Profiler>
+  void _forward(const NetOutputs&, const _Parameters<W, InputSize>&,
+                const _CheckpointBuffers&, Profiler&) { }
+
+  template<typename W, typename Profiler>
+  T _backpropagate(const NetOutputs& outputs,
+                   const _Parameters<W, InputSize>&,
+                   const NetOutputs& labels, NetOutputs& prev_errors,
+                   _Parameters<T, InputSize>&, const _CheckpointBuffers&,
+                   Profiler&) {
+    return ErrorFunction::template
+      f_dError<InputSize, batch_size>(outputs, labels, y, prev_errors);
+  }
+};
+
+template<typename T, size_t batch_size, size_t segment_length,
+         typename ErrorFunction, size_t layer, size_t offset,
+         typename InputSize>
+struct _CheckpointPlan<T, batch_size, segment_length, ErrorFunction, false,
+                       layer, offset, InputSize> {
+
+  using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
+
+  static constexpr size_t workspace_size() { return 0ul; }
+  static constexpr size_t scratch_size() { return 0ul; }
+  static constexpr size_t errors_size() { return 0ul; }
+  static constexpr bool _last_segment() { return true; }
+
+  template<typename W, typename Profiler>
+  void _forward(const NetOutputs&, const _Parameters<W, InputSize>&,
+                const _CheckpointBuffers&, Profiler&) { }
+
+  template<typename W, typename Profiler>
+  T _backpropagate(const NetOutputs& outputs,
+                   const _Parameters<W, InputSize>&,
+                   const NetOutputs& labels, NetOutputs& prev_errors,
+                   _Parameters<T, InputSize>&, const _CheckpointBuffers&,
+                   Profiler&) {
+    ErrorFunction::template
+      dError<InputSize, batch_size>(outputs, labels, prev_errors);
+    return ErrorFunction::template
+      error<InputSize, batch_size>(outputs, labels);
+  }
+};
+
+template<typename T, size_t batch_size, size_t segment_length,
+         typename ErrorFunction, bool computes, size_t layer, size_t offset,
+         typename InputSize, typename CrtLayer, typename... Others>
+struct _CheckpointPlan<T, batch_size, segment_length, ErrorFunction,
+                       computes, layer, offset, InputSize, CrtLayer,
+                       Others...> {
+
+  using Inputs = typename CrtLayer::template Inputs<T, InputSize, batch_size>;
+  using Hidden = typename CrtLayer::template Hidden<T, InputSize, batch_size>;
+  using Outputs =
+    typename CrtLayer::template Outputs<T, InputSize, batch_size>;
+
+  using OutputSize = typename CrtLayer::template OutputSize<InputSize>;
+
+  /* Hidden is in the shared scratch space when it is only scratch, or in
+   * the workspace when the layer can be run again; the outputs are kept
+   * when the layer ends a segment */
+  static constexpr bool scratch = CrtLayer::hidden_is_scratch;
+  static constexpr bool recomputed = CrtLayer::recomputable;
+  static constexpr bool checkpoint =
+    sizeof...(Others) == 0ul || !recomputed ||
+    (layer + 1ul) % segment_length == 0ul;
+
+  static constexpr size_t hidden_bytes =
+    recomputed && !scratch ? _cache_lines(sizeof(Hidden)) : 0ul;
+  static constexpr size_t outputs_bytes =
+    checkpoint ? 0ul : _cache_lines(sizeof(Outputs));
+
+  using NextPlan =
+    _CheckpointPlan<T, batch_size, segment_length, ErrorFunction, computes,
+                    layer + 1ul,
+                    checkpoint ? 0ul : offset + hidden_bytes + outputs_bytes,
+                    OutputSize, Others...>;
+
+  using NetOutputs = typename NextPlan::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, CrtLayer, Others...>;
+  template<typename W>
+  using StoredParameters = _Parameters<W, InputSize, CrtLayer, Others...>;
+
+  static constexpr size_t workspace_size() {
+    return offset + hidden_bytes + outputs_bytes > NextPlan::workspace_size()
+      ? offset + hidden_bytes + outputs_bytes : NextPlan::workspace_size();
+  }
+
+  static constexpr size_t scratch_size() {
+    return scratch && sizeof(Hidden) > NextPlan::scratch_size() ?
+      sizeof(Hidden) : NextPlan::scratch_size();
+  }
+
+  static constexpr size_t errors_size() {
+    return _cache_lines(sizeof(Outputs)) > NextPlan::errors_size() ?
+      _cache_lines(sizeof(Outputs)) : NextPlan::errors_size();
+  }
+
+  typename std::conditional<recomputed || scratch, _NotStored, Hidden>::type
+    stored_hidden;
+  typename std::conditional<checkpoint, Outputs, _NotStored>::type
+    stored_outputs;
+  NextPlan next;
+
+  /* The first pass, over all the layers */
+  template<typename W, typename Profiler>
+  void _forward(const Inputs& inputs, const StoredParameters<W>& parameters,
+                const _CheckpointBuffers& buffers, Profiler& profiler) {
+    _layer_forward(inputs, parameters, buffers, profiler);
+    next._forward(_outputs(buffers), parameters.next, buffers, profiler);
+  }
+
+  /* Called on the first layer of a segment: backpropagates the segments
+   * after it, then this one */
+  template<typename W, typename Profiler>
+  T _backpropagate(const Inputs& inputs,
+                   const StoredParameters<W>& parameters,
+                   const NetOutputs& labels, Inputs& prev_errors,
+                   Parameters& gradient, const _CheckpointBuffers& buffers,
+                   Profiler& profiler) {
+    const T err = _after_segment(parameters, labels, gradient, buffers,
+                                 profiler, _Checkpoint());
+    if (!_last_segment())
+      _recompute(inputs, parameters, buffers, profiler);
+    _backward(inputs, parameters, prev_errors, gradient, buffers, profiler);
+    return err;
+  }
+
+  /* The forward pass of this layer and of the rest of its segment again */
+  template<typename W, typename Profiler>
+  void _recompute(const Inputs& inputs, const StoredParameters<W>& parameters,
+                  const _CheckpointBuffers& buffers, Profiler& profiler) {
+    if (recomputed)
+      _layer_forward(inputs, parameters, buffers, profiler);
+    _recompute_next(parameters, buffers, profiler, _Checkpoint());
+  }
+
+  /* Backpropagation from the end of the segment to this layer */
+  template<typename W, typename Profiler>
+  void _backward(const Inputs& inputs, const StoredParameters<W>& parameters,
+                 Inputs& prev_errors, Parameters& gradient,
+                 const _CheckpointBuffers& buffers, Profiler& profiler) {
+    _backward_next(parameters, gradient, buffers, profiler, _Checkpoint());
+    profiler.template begin<T, CrtLayer, InputSize>(
+      layer, LayerPhase::backpropagate, batch_size);
+    CrtLayer::template
+      backpropagate<T, InputSize, batch_size>(inputs, parameters.values,
+                                              _hidden(buffers),
+                                              _outputs(buffers),
+                                              _errors(buffers),
+                                              gradient.values, prev_errors);
+    profiler.end(layer, LayerPhase::backpropagate);
+  }
+
+  /* Whether the segment of this layer is the last one */
+  static constexpr bool _last_segment() {
+    return checkpoint ? sizeof...(Others) == 0ul : NextPlan::_last_segment();
+  }
+
+ private:
+  using _Checkpoint = std::integral_constant<bool, checkpoint>;
+
+  template<typename W, typename Profiler>
+  void _layer_forward(const Inputs& inputs,
+                      const StoredParameters<W>& parameters,
+                      const _CheckpointBuffers& buffers, Profiler& profiler) {
+    profiler.template begin<T, CrtLayer, InputSize>(
+      layer, LayerPhase::forward, batch_size);
+    CrtLayer::template
+      forward<T, InputSize, batch_size, true>(inputs, parameters.values,
+                                              _hidden(buffers),
+                                              _outputs(buffers));
+    profiler.end(layer, LayerPhase::forward);
+  }
+
+  /* The next segment starts after this layer */
+  template<typename W, typename Profiler>
+  T _after_segment(const StoredParameters<W>& parameters,
+                   const NetOutputs& labels, Parameters& gradient,
+                   const _CheckpointBuffers& buffers, Profiler& profiler,
+                   std::true_type) {
+    return next._backpropagate(_outputs(buffers), parameters.next, labels,
+                               _errors(buffers), gradient.next, buffers,
+                               profiler);
+  }
+
+  template<typename W, typename Profiler>
+  T _after_segment(const StoredParameters<W>& parameters,
+                   const NetOutputs& labels, Parameters& gradient,
+                   const _CheckpointBuffers& buffers, Profiler& profiler,
+                   std::false_type) {
+    return next._after_segment(parameters.next, labels, gradient.next,
+                               buffers, profiler,
+                               typename NextPlan::_Checkpoint());
+  }
+
+  template<typename W, typename Profiler>
+  void _recompute_next(const StoredParameters<W>&, const _CheckpointBuffers&,
+                       Profiler&, std::true_type) { }
+
+  template<typename W, typename Profiler>
+  void _recompute_next(const StoredParameters<W>& parameters,
+                       const _CheckpointBuffers& buffers, Profiler& profiler,
+                       std::false_type) {
+    next._recompute(_outputs(buffers), parameters.next, buffers, profiler);
+  }
+
+  template<typename W, typename Profiler>
+  void _backward_next(const StoredParameters<W>&, Parameters&,
+                      const _CheckpointBuffers&, Profiler&, std::true_type) {
+  }
+
+  template<typename W, typename Profiler>
+  void _backward_next(const StoredParameters<W>& parameters,
+                      Parameters& gradient, const _CheckpointBuffers& buffers,
+                      Profiler& profiler, std::false_type) {
+    next._backward(_outputs(buffers), parameters.next, _errors(buffers),
+                   gradient.next, buffers, profiler);
+  }
+
+  /* Where Hidden is: 0 in the scratch space, 1 in the workspace, 2 in
+   * stored_hidden */
+  using _HiddenPlace =
+    std::integral_constant<int, scratch ? 0 : recomputed ? 1 : 2>;
+
+  Hidden& _hidden(const _CheckpointBuffers& buffers) {
+    return _hidden(buffers, _HiddenPlace());
+  }
+
+  Hidden& _hidden(const _CheckpointBuffers& buffers,
+                  std::integral_constant<int, 0>) {
+    return *reinterpret_cast<Hidden*>(buffers.scratch);
+  }
+
+  Hidden& _hidden(const _CheckpointBuffers& buffers,
+                  std::integral_constant<int, 1>) {
+    return *reinterpret_cast<Hidden*>(buffers.workspace + offset);
+  }
+
+  Hidden& _hidden(const _CheckpointBuffers&,
+                  std::integral_constant<int, 2>) {
+    return stored_hidden;
+  }
+
+  Outputs& _outputs(const _CheckpointBuffers& buffers) {
+    return _outputs(buffers, _Checkpoint());
+  }
+
+  Outputs& _outputs(const _CheckpointBuffers&, std::true_type) {
+    return stored_outputs;
+  }
+
+  Outputs& _outputs(const _CheckpointBuffers& buffers, std::false_type) {
+    return *reinterpret_cast<Outputs*>(buffers.workspace + offset +
+                                       hidden_bytes);
+  }
+
+  /* The errors of this layer's outputs */
+  Outputs& _errors(const _CheckpointBuffers& buffers) {
+    return *reinterpret_cast<Outputs*>(buffers.errors[layer % 2ul]);
+  }
+
+  template<typename, size_t, size_t, typename, bool, size_t, size_t,
+           typename, typename...>
+  friend struct _CheckpointPlan;
+};
+
+constexpr size_t _ceil_sqrt(size_t n, size_t root = 1ul) {
+  return root * root >= n ? root : _ceil_sqrt(n, root + 1ul);
+}
+
+template<typename T, size_t batch_size, size_t segment_length,
+         typename ErrorFunction, bool computes, typename InputSize,
+         typename... Layers>
+struct _CheckpointedGradientComputation {
+
+  static constexpr size_t layers_no = sizeof...(Layers);
+  static constexpr size_t segment =
+    segment_length ? segment_length : _ceil_sqrt(layers_no);
+
+  using Plan = _CheckpointPlan<T, batch_size, segment, ErrorFunction,
+                               computes, 0ul, 0ul, InputSize, Layers...>;
+
+  using Inputs = typename Plan::Inputs;
+  using NetOutputs = typename Plan::NetOutputs;
+  using Parameters = typename Plan::Parameters;
+  template<typename W>
+  using StoredParameters = typename Plan::template StoredParameters<W>;
+
+  _CheckpointedGradientComputation() {
+    buffers.workspace =
+      workspace.reserve(_at_least_one(Plan::workspace_size()));
+    buffers.scratch = scratch.reserve(_at_least_one(Plan::scratch_size()));
+    for (size_t b = 0; b < 2ul; b++)
+      buffers.errors[b] =
+        errors[b].reserve(_at_least_one(Plan::errors_size()));
+  }
+
+  _CheckpointedGradientComputation(const _CheckpointedGradientComputation&)
+    = delete;
+  _CheckpointedGradientComputation&
+  operator=(const _CheckpointedGradientComputation&) = delete;
+
+  /* The same calls as _GradientComputation's */
+
+  template<typename W>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient) {
+    NoProfiler profiler;
+    return computeGradient(inputs, parameters, labels, prev_errors,
+                           gradient, profiler);
+  }
+
+  template<typename W>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Parameters& gradient) {
+    Inputs crt_errors;
+    return computeGradient(inputs, parameters, labels, crt_errors, gradient);
+  }
+
+  template<typename W, typename Profiler>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient, Profiler& profiler) {
+    plan._forward(inputs, parameters, buffers, profiler);
+    return plan._backpropagate(inputs, parameters, labels, prev_errors,
+                               gradient, buffers, profiler);
+  }
+
+  template<typename W, typename Profiler>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Parameters& gradient,
+                    Profiler& profiler) {
+    Inputs crt_errors;
+    return computeGradient(inputs, parameters, labels, crt_errors, gradient,
+                           profiler);
+  }
+
+  /* Activation memory, in bytes: the checkpoints and the kept Hidden, the
+   * workspace, the scratch space and the two error buffers */
+  static constexpr size_t footprint() {
+    return sizeof(Plan) + Plan::workspace_size() + Plan::scratch_size() +
+      2ul * Plan::errors_size();
+  }
+
+ private:
+  static constexpr size_t _at_least_one(size_t size) {
+    return size > 0ul ? size : cache_line_size;
+  }
+
+  Plan plan;
+  AlignedBuffer<unsigned char> workspace;
+  AlignedBuffer<unsigned char> scratch;
+  AlignedBuffer<unsigned char> errors[2];
+  _CheckpointBuffers buffers;
+};
+
+#endif
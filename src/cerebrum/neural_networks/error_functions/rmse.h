@@ -21,23 +21,23 @@ struct RMSE {
   template<typename LayerSize, size_t batch_size>
   inline static T
   error(const Outputs<LayerSize, batch_size>& y,
-        const Outputs<LayerSize, batch_size>& t) {
+        const Outputs<LayerSize, batch_size>& t, size_t rows = batch_size) {
     Output<LayerSize> avg_label;
     for (T& avg_i : avg_label)
       avg_i = 0;
-    for (size_t n = 0; n < batch_size; n++) {
+    for (size_t n = 0; n < rows; n++) {
       const Output<LayerSize>* const t_row =
         reinterpret_cast<const Output<LayerSize>*>(t[n].data());
       for (size_t i = 0; i < LayerSize::length; i++)
         avg_label[i] += (*t_row)[i];
     }
     for (T& avg_i : avg_label)
-      avg_i /= (T)batch_size;
+      avg_i /= (T)rows;
 
     T err = (T)0;
     T norm = (T)0;
 
-    for (size_t n = 0; n < batch_size; n++) {
+    for (size_t n = 0; n < rows; n++) {
       const Output<LayerSize>* const t_row =
         reinterpret_cast<const Output<LayerSize>*>(t[n].data());
       const Output<LayerSize>* const y_row =
@@ -4,10 +4,31 @@
 #define SOFTMAX_H
 
 #include <cmath>
+#include <cstddef>
+#include <algorithm>
 #include <array>
+#include <limits>
+
+#include "cerebrum/simd.h"
+#include "cerebrum/vector_math.h"
 
 using namespace std;
 
+/* SoftMax output with the cross-entropy (log-likelihood) error
+ *
+ *     y_i = exp(a_i) / sum_j exp(a_j)        error = sum_i t_i log(y_i)
+ *
+ * f and error take the number of rows of the batch that hold examples
+ * (all of them by default); the others are not read.
+ *
+ * The largest logit of a row is subtracted before exponentiating, so large
+ * logits do not overflow. f_dError, which has the logits, computes log(y_i)
+ * as a_i - max - log(sum_j exp(a_j - max)), so it stays finite when y_i
+ * underflows. error only has the probabilities: a y_i below the smallest
+ * normal number (or flushed to zero, e.g. under -Ofast) counts as that
+ * number, so the error stays finite, but is less exact than f_dError's.
+ */
+
 template<typename T>
 struct SoftMax {
   static constexpr bool transforms_last_layer = true;
@@ -22,33 +43,25 @@ struct SoftMax {
   template<typename LayerSize, size_t batch_size>
   inline static void
   f(const Outputs<LayerSize, batch_size>& a,
-    Outputs<LayerSize, batch_size>& y) {
-    for (size_t n = 0; n < batch_size; n++) {
-      T sum = 0;
-      Output<LayerSize>* const y_row =
-        reinterpret_cast<Output<LayerSize>*>(y[n].data());
-      for (size_t i = 0; i < LayerSize::length; i++) {
-        (*y_row)[i] = exp(a[n][i]);
-        sum += (*y_row)[i];
-      }
-      for (size_t i = 0; i < LayerSize::length; i++) {
-        (*y_row)[i] = (*y_row)[i] / sum;
-      }
-    }
+    Outputs<LayerSize, batch_size>& y, size_t rows = batch_size) {
+    for (size_t n = 0; n < rows; n++)
+      _row<false>(a[n].data(), nullptr, y[n].data(), nullptr,
+                  LayerSize::length);
   }
 
   template<typename LayerSize, size_t batch_size>
   inline static T
   error(const Outputs<LayerSize, batch_size>& y,
-        const Outputs<LayerSize, batch_size>& t) {
+        const Outputs<LayerSize, batch_size>& t, size_t rows = batch_size) {
     T err = 0;
-    for (size_t n = 0; n < batch_size; n++) {
+    for (size_t n = 0; n < rows; n++) {
       const Output<LayerSize>* const y_row =
         reinterpret_cast<const Output<LayerSize>*>(y[n].data());
       const Output<LayerSize>* const t_row =
         reinterpret_cast<const Output<LayerSize>*>(t[n].data());
       for (size_t i = 0; i < LayerSize::length; i++)
-        err += (*t_row)[i] * log((*y_row)[i]);
+        err += (*t_row)[i] *
+          log(std::max((*y_row)[i], numeric_limits<T>::min()));
     }
     return err;
   }
@@ -69,6 +82,87 @@ struct SoftMax {
         (*e_row)[i] = (*y_row)[i] - (*t_row)[i];
     }
   }
+
+  /* f, dError and error in one sweep over the batch: each row of logits is
+   * turned into probabilities, errors and its share of the error while it
+   * is still in L1. Rows are independent; batch-parallel computations run
+   * this on their own slices of the batch. */
+  template<typename LayerSize, size_t batch_size>
+  inline static T
+  f_dError(const Outputs<LayerSize, batch_size>& a,
+           const Outputs<LayerSize, batch_size>& t,
+           Outputs<LayerSize, batch_size>& y,
+           Outputs<LayerSize, batch_size>& e) {
+    T err = 0;
+    for (size_t n = 0; n < batch_size; n++)
+      err += _row<true>(a[n].data(), t[n].data(), y[n].data(), e[n].data(),
+                        LayerSize::length);
+    return err;
+  }
+
+ private:
+  /* y = softmax(a); with labels, also e = y - t and the returned
+   * sum_i t_i log(y_i) */
+  template<bool with_labels>
+  static T _row(const T* a, const T* t, T* y, T* e, size_t length) {
+    using V = Vector<T>;
+    using S = ScalarVector<T>;
+    using Math = VectorMath<T>;
+    constexpr size_t L = V::length;
+    const size_t body = length - length % L;
+
+    typename V::Type v_max = V::broadcast(numeric_limits<T>::lowest());
+    for (size_t i = 0; i < body; i += L)
+      v_max = V::max(v_max, V::loadu(a + i));
+    T max = V::reduce_max(v_max);
+    for (size_t i = body; i < length; i++)
+      max = S::max(max, a[i]);
+
+    /* y = exp(a - max), with sum_i y_i, sum_i t_i (a_i - max), sum_i t_i */
+    const typename V::Type v_shift = V::broadcast(max);
+    typename V::Type v_sum = V::zero();
+    typename V::Type v_dot = V::zero();
+    typename V::Type v_labels = V::zero();
+    for (size_t i = 0; i < body; i += L) {
+      const typename V::Type x = V::sub(V::loadu(a + i), v_shift);
+      const typename V::Type exp_x = Math::template exp<V>(x);
+      V::storeu(y + i, exp_x);
+      v_sum = V::add(v_sum, exp_x);
+      if (with_labels) {
+        const typename V::Type t_i = V::loadu(t + i);
+        v_dot = V::fma(t_i, x, v_dot);
+        v_labels = V::add(v_labels, t_i);
+      }
+    }
+    T sum = V::reduce_add(v_sum);
+    T dot = V::reduce_add(v_dot);
+    T labels = V::reduce_add(v_labels);
+    for (size_t i = body; i < length; i++) {
+      const T x = a[i] - max;
+      y[i] = Math::template exp<S>(x);
+      sum += y[i];
+      if (with_labels) {
+        dot += t[i] * x;
+        labels += t[i];
+      }
+    }
+
+    const T inv_sum = (T)1 / sum;
+    const typename V::Type v_inv_sum = V::broadcast(inv_sum);
+    for (size_t i = 0; i < body; i += L) {
+      const typename V::Type y_i = V::mul(V::loadu(y + i), v_inv_sum);
+      V::storeu(y + i, y_i);
+      if (with_labels)
+        V::storeu(e + i, V::sub(y_i, V::loadu(t + i)));
+    }
+    for (size_t i = body; i < length; i++) {
+      y[i] *= inv_sum;
+      if (with_labels)
+        e[i] = y[i] - t[i];
+    }
+
+    return with_labels ? dot - labels * log(sum) : (T)0;
+  }
 };
 
 #endif
@@ -20,9 +20,9 @@ struct SumOfSquares {
   template<typename LayerSize, size_t batch_size>
   inline static T
   error(const Outputs<LayerSize, batch_size>& y,
-        const Outputs<LayerSize, batch_size>& t) {
+        const Outputs<LayerSize, batch_size>& t, size_t rows = batch_size) {
     T err = 0;
-    for (size_t n = 0; n < batch_size; n++)
+    for (size_t n = 0; n < rows; n++)
       for (size_t i = 0; i < LayerSize::length; i++)
         err += (t[n][i] - y[n][i]) * (t[n][i] - y[n][i]);
     return err / (T)2;
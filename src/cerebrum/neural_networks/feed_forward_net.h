@@ -4,8 +4,17 @@
 #define FEED_FORWARD_NET_H
 
 #include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/checkpoint.h"
+#include "cerebrum/data/data_loader.h"
 #include "cerebrum/neural_networks/forward_computation.h"
+#include "cerebrum/neural_networks/inference_computation.h"
+#include "cerebrum/neural_networks/quantized_computation.h"
 #include "cerebrum/neural_networks/gradient_computation.h"
+#include "cerebrum/neural_networks/checkpointed_computation.h"
+#include "cerebrum/neural_networks/parallel_computation.h"
+#include "cerebrum/neural_networks/pipeline_computation.h"
+#include "cerebrum/neural_networks/hogwild.h"
+#include "cerebrum/neural_networks/optimizers/optimizer.h"
 
 template<typename... info>
 struct NetOutput;
@@ -18,18 +27,111 @@ struct FeedForwardNet {
   using InputSize = _InputSize;
   using OutputSize = typename NetOutput<InputSize, LayersInfo...>::OutputSize;
 
+  /* Read-only Parameters over a checkpoint mapped with mmap (see
+   * checkpoint.h) */
+  using MappedParameters = _MappedParameters<Parameters>;
+
+  /* The parameters stored as Half or BFloat16 (see half.h). The forward
+   * and gradient computations take them in place of Parameters; the
+   * arithmetic and the gradient stay in T. */
+  template <typename Storage>
+  using HalfParameters = _Parameters<Storage, InputSize, LayersInfo...>;
+
   template <size_t batch_size, template<typename> class ErrorFunction>
   using ForwardComputation =
     _ForwardComputation<T, batch_size, ErrorFunction<T>,
                         ErrorFunction<T>::transforms_last_layer,
                         InputSize, LayersInfo...>;
 
+  /* Forward only, with two ping-pong activation buffers instead of the
+   * Hidden and Outputs of every layer (see inference_computation.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction>
+  using InferenceComputation =
+    _InferenceComputation<T, batch_size, ErrorFunction<T>,
+                          ErrorFunction<T>::transforms_last_layer,
+                          InputSize, LayersInfo...>;
+
+  /* Int8 inference: weights quantized per output neuron, activations per
+   * layer, with ranges recorded by running the float network over sample
+   * batches (see quantized_computation.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction>
+  using QuantizedInferenceComputation =
+    _QuantizedInferenceComputation<T, batch_size, ErrorFunction<T>,
+                                   ErrorFunction<T>::transforms_last_layer,
+                                   InputSize, LayersInfo...>;
+
   template <size_t batch_size, template<typename> class ErrorFunction>
   using GradientComputation =
     _GradientComputation<T, batch_size, ErrorFunction<T>,
                          ErrorFunction<T>::transforms_last_layer,
                          InputSize, LayersInfo...>;
 
+  /* Gradients that keep only the activations at the end of every segment
+   * of segment_length layers (ceil(sqrt(depth)) for 0) and compute the
+   * others again during backpropagation (see checkpointed_computation.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction,
+            size_t segment_length = 0ul>
+  using CheckpointedGradientComputation =
+    _CheckpointedGradientComputation<T, batch_size, segment_length,
+                                     ErrorFunction<T>,
+                                     ErrorFunction<T>::transforms_last_layer,
+                                     InputSize, LayersInfo...>;
+
+  /* Batch-parallel variants: the batch is split into slices_no slices that
+   * run on a ThreadPool (see parallel_computation.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction,
+            size_t slices_no>
+  using ParallelForwardComputation =
+    _ParallelForwardComputation<T, batch_size, slices_no, ErrorFunction<T>,
+                                ErrorFunction<T>::transforms_last_layer,
+                                InputSize, LayersInfo...>;
+
+  template <size_t batch_size, template<typename> class ErrorFunction,
+            size_t slices_no>
+  using ParallelGradientComputation =
+    _ParallelGradientComputation<T, batch_size, slices_no, ErrorFunction<T>,
+                                 ErrorFunction<T>::transforms_last_layer,
+                                 InputSize, LayersInfo...>;
+
+  /* Pipeline-parallel gradients: the layers are split into stages_no stages
+   * that run on their own threads, and the batch into micro_batches_no
+   * micro-batches that flow through them (see pipeline_computation.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction,
+            size_t micro_batches_no, size_t stages_no>
+  using PipelineGradientComputation =
+    _PipelineGradientComputation<T, batch_size, micro_batches_no, stages_no,
+                                 ErrorFunction<T>,
+                                 ErrorFunction<T>::transforms_last_layer,
+                                 InputSize, LayersInfo...>;
+
+  /* Updates Parameters from a gradient with one of the rules in
+   * optimizers/ (SGD, Momentum, NesterovMomentum, RMSProp, Adam) */
+
+  template <template<typename> class Rule>
+  using Optimizer = _Optimizer<T, Rule<T>, Parameters>;
+
+  /* Lock-free asynchronous training: several threads update the same
+   * Parameters with a Rule, without waiting for each other (see
+   * hogwild.h) */
+
+  template <size_t batch_size, template<typename> class ErrorFunction,
+            template<typename> class Rule>
+  using Hogwild = _Hogwild<T, Rule<T>, batch_size, ErrorFunction<T>,
+                           ErrorFunction<T>::transforms_last_layer,
+                           InputSize, LayersInfo...>;
+
+  /* Batches for the computations above, gathered in the background from
+   * the sources in data/ (IdxFile, RawFile, OneHot) */
+
+  template <size_t batch_size, typename InputSource, typename TargetSource>
+  using DataLoader = _DataLoader<T, batch_size, InputSize, OutputSize,
+                                 InputSource, TargetSource>;
+
 };
 
 /* Tudor:
@@ -5,9 +5,21 @@
 
 #include <cstddef>
 #include <array>
+#include <stdexcept>
 #include <type_traits>
 
 #include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/profiler.h"
+
+/* forward() computes the first `rows` examples of the batch, all of them
+ * by default: batch_size is the largest batch the buffers hold, and a
+ * smaller one costs only its own rows. error() uses the rows of the last
+ * forward(). rows must be between 1 and batch_size (std::invalid_argument
+ * otherwise), as in the inference computations.
+ *
+ * forward(inputs, parameters, profiler, rows) also reports every layer to
+ * a profiler (see profiler.h).
+ */
 
 template<typename T, size_t batch_size,
          typename ErrorFunction, bool computes,
@@ -20,15 +32,20 @@ struct _ForwardComputation<T, batch_size, ErrorFunction, false, LastSize> {
 
   using NetOutputs = std::array<std::array<T, LastSize::length>, batch_size>;
   const NetOutputs* y;
+  size_t rows;
 
+  template<typename W, typename Profiler>
   const NetOutputs&
-  forward(const NetOutputs& outputs, bool parameters) {
+  _forward(const NetOutputs& outputs, const _Parameters<W, LastSize>&,
+           Profiler&, size_t rows, size_t) {
     y = &outputs;
+    this->rows = rows;
     return outputs;
   }
 
   T error(const NetOutputs& labels) {
-    return ErrorFunction::template error<LastSize, batch_size>(*y, labels);
+    return ErrorFunction::template error<LastSize, batch_size>(*y, labels,
+                                                               rows);
   }
 };
 
@@ -38,15 +55,20 @@ struct _ForwardComputation<T, batch_size, ErrorFunction, true, LastSize> {
 
   using NetOutputs = std::array<std::array<T, LastSize::length>, batch_size>;
   NetOutputs y;
+  size_t rows;
 
+  template<typename W, typename Profiler>
   const NetOutputs&
-  forward(const NetOutputs& outputs, bool parameters) {
-    ErrorFunction::f(outputs, y);
+  _forward(const NetOutputs& outputs, const _Parameters<W, LastSize>&,
+           Profiler&, size_t rows, size_t) {
+    ErrorFunction::template f<LastSize, batch_size>(outputs, y, rows);
+    this->rows = rows;
     return y;
   }
 
   T error(const NetOutputs& labels) {
-    return ErrorFunction::template error<LastSize, batch_size>(y, labels);
+    return ErrorFunction::template error<LastSize, batch_size>(y, labels,
+                                                               rows);
   }
 };
 
@@ -74,17 +96,50 @@ struct _ForwardComputation<T, batch_size, ErrorFunction, computes,
   Outputs outputs;
   NextComputation next;
 
+  /* The parameters may also be stored in another type W (see half.h) */
+  template<typename W>
   const NetOutputs&
-  forward(const Inputs& inputs, const Parameters& parameters) {
+  forward(const Inputs& inputs,
+          const _Parameters<W, InputSize, CrtLayer, Others...>& parameters,
+          size_t rows = batch_size) {
+    _check_rows(rows);
+    NoProfiler profiler;
+    return _forward(inputs, parameters, profiler, rows, 0ul);
+  }
+
+  template<typename W, typename Profiler>
+  const NetOutputs&
+  forward(const Inputs& inputs,
+          const _Parameters<W, InputSize, CrtLayer, Others...>& parameters,
+          Profiler& profiler, size_t rows = batch_size) {
+    _check_rows(rows);
+    return _forward(inputs, parameters, profiler, rows, 0ul);
+  }
+
+  template<typename W, typename Profiler>
+  const NetOutputs&
+  _forward(const Inputs& inputs,
+           const _Parameters<W, InputSize, CrtLayer, Others...>& parameters,
+           Profiler& profiler, size_t rows, size_t layer) {
+    profiler.template begin<T, CrtLayer, InputSize>(layer,
+                                                    LayerPhase::forward,
+                                                    rows);
     CrtLayer::template
       forward<T, InputSize, batch_size, false>(inputs, parameters.values,
-                                               hidden, outputs);
-    return next.forward(outputs, parameters.next);
+                                               hidden, outputs, rows);
+    profiler.end(layer, LayerPhase::forward);
+    return next._forward(outputs, parameters.next, profiler, rows,
+                         layer + 1ul);
   }
 
   T error(const NetOutputs& labels) {
     return next.error(labels);
   }
+
+  static void _check_rows(size_t rows) {
+    if (rows == 0ul || rows > batch_size)
+      throw std::invalid_argument("rows must be between 1 and batch_size");
+  }
 };
 
 #endif
@@ -5,26 +5,59 @@
 
 #include <array>
 #include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/profiler.h"
 
 template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
          typename InputSize, typename... OtherLayers>
 struct _GradientComputation;
 
+/* A training step can also be split in two:
+ *
+ *     const NetOutputs& y = gc->forward(inputs, parameters);
+ *     T loss = gc->error(labels);                  // or look at y
+ *     gc->backpropagate(inputs, parameters, labels, gradient);
+ *
+ * forward() keeps the activations of every layer (with dropout masks and
+ * argmaxes drawn for training), and backpropagate() starts from them
+ * instead of computing the forward pass again: the loss and the outputs of
+ * a batch come with its gradient for the price of the gradient alone.
+ * backpropagate() must get the inputs and parameters of the last
+ * forward(), and returns the same error as computeGradient(), which is
+ * forward() and backpropagate() without transforming the outputs.
+ */
+
 template<typename T, size_t batch_size, typename ErrorFunction,
          typename InputSize>
 struct _GradientComputation<T, batch_size, ErrorFunction, true, InputSize> {
 
   using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
   NetOutputs y;
+  const NetOutputs* a;                                       /* the logits */
 
-  T computeGradient(const NetOutputs& outputs, bool parameters,
-                    const NetOutputs& labels,
-                    NetOutputs& prev_errors, bool gradient) {
-    ErrorFunction::template f<InputSize, batch_size>(outputs, y);
-    ErrorFunction::template
-      dError<InputSize, batch_size>(y, labels, prev_errors);
+  template<typename W, typename Profiler>
+  void _forward(const NetOutputs& outputs, const _Parameters<W, InputSize>&,
+                Profiler&, size_t) {
+    a = &outputs;
+  }
+
+  const NetOutputs& _outputs() {
+    ErrorFunction::template f<InputSize, batch_size>(*a, y);
+    return y;
+  }
+
+  T error(const NetOutputs& labels) {
     return ErrorFunction::template error<InputSize, batch_size>(y, labels);
   }
+
+  /* The error function transforms the logits, computes the error and its
+   * gradient with respect to the logits in a single fused kernel */
+  template<typename W, typename Profiler>
+  T _backpropagate(const NetOutputs&, const _Parameters<W, InputSize>&,
+                   const NetOutputs& labels, NetOutputs& prev_errors,
+                   _Parameters<T, InputSize>&, Profiler&, size_t) {
+    return ErrorFunction::template
+      f_dError<InputSize, batch_size>(*a, labels, y, prev_errors);
+  }
 };
 
 template<typename T, size_t batch_size, typename ErrorFunction,
@@ -32,12 +65,29 @@ template<typename T, size_t batch_size, typename ErrorFunction,
 struct _GradientComputation<T, batch_size, ErrorFunction, false, InputSize> {
 
   using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  const NetOutputs* y;
+
+  template<typename W, typename Profiler>
+  void _forward(const NetOutputs& outputs, const _Parameters<W, InputSize>&,
+                Profiler&, size_t) {
+    y = &outputs;
+  }
+
+  const NetOutputs& _outputs() { return *y; }
 
-  T computeGradient(const NetOutputs& outputs, bool parameters,
-                    const NetOutputs& labels,
-                    NetOutputs& prev_errors, bool gradient) {
-    ErrorFunction::dError(outputs, labels, prev_errors);
-    return ErrorFunction::error(outputs, labels);
+  T error(const NetOutputs& labels) {
+    return ErrorFunction::template error<InputSize, batch_size>(*y, labels);
+  }
+
+  template<typename W, typename Profiler>
+  T _backpropagate(const NetOutputs& outputs,
+                   const _Parameters<W, InputSize>&,
+                   const NetOutputs& labels, NetOutputs& prev_errors,
+                   _Parameters<T, InputSize>&, Profiler&, size_t) {
+    ErrorFunction::template
+      dError<InputSize, batch_size>(outputs, labels, prev_errors);
+    return ErrorFunction::template
+      error<InputSize, batch_size>(outputs, labels);
   }
 };
 
@@ -58,33 +108,150 @@ struct _GradientComputation<T, batch_size, ErrorFunction, computes,
 
   using NetOutputs = typename NextComputation::NetOutputs;
   using Parameters = _Parameters<T, InputSize, CrtLayer, Others...>;
+  template<typename W>
+  using StoredParameters = _Parameters<W, InputSize, CrtLayer, Others...>;
 
   Hidden hidden;
   Outputs outputs;
   Outputs errors;
   NextComputation next;
 
-  T computeGradient(const Inputs& inputs, const Parameters& parameters,
-                       const NetOutputs& labels, Inputs& prev_errors,
-                       Parameters& gradient) {
+  /* The parameters may be stored in another type W (e.g. Half weights
+   * next to float master weights, see half.h); the gradient is always in
+   * T */
+  template<typename W>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient) {
+    NoProfiler profiler;
+    return computeGradient(inputs, parameters, labels, prev_errors,
+                           gradient, profiler);
+  }
+
+  template<typename W>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Parameters& gradient) {
+    Inputs crt_errors;
+    return computeGradient(inputs, parameters, labels, crt_errors, gradient);
+  }
+
+  /* The same, reporting the forward and backpropagate calls of every layer
+   * to a profiler (see profiler.h) */
+
+  template<typename W, typename Profiler>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient, Profiler& profiler) {
+    _forward(inputs, parameters, profiler, 0ul);
+    return _backpropagate(inputs, parameters, labels, prev_errors, gradient,
+                          profiler, 0ul);
+  }
+
+  template<typename W, typename Profiler>
+  T computeGradient(const Inputs& inputs,
+                    const StoredParameters<W>& parameters,
+                    const NetOutputs& labels, Parameters& gradient,
+                    Profiler& profiler) {
+    Inputs crt_errors;
+    return computeGradient(inputs, parameters, labels, crt_errors, gradient,
+                           profiler);
+  }
+
+  /* -------------------- Training step -------------------- */
+
+  template<typename W>
+  const NetOutputs& forward(const Inputs& inputs,
+                            const StoredParameters<W>& parameters) {
+    NoProfiler profiler;
+    return forward(inputs, parameters, profiler);
+  }
+
+  template<typename W, typename Profiler>
+  const NetOutputs& forward(const Inputs& inputs,
+                            const StoredParameters<W>& parameters,
+                            Profiler& profiler) {
+    _forward(inputs, parameters, profiler, 0ul);
+    return _outputs();
+  }
+
+  /* The error of the outputs of the last forward() */
+  T error(const NetOutputs& labels) {
+    return next.error(labels);
+  }
+
+  template<typename W>
+  T backpropagate(const Inputs& inputs,
+                  const StoredParameters<W>& parameters,
+                  const NetOutputs& labels, Inputs& prev_errors,
+                  Parameters& gradient) {
+    NoProfiler profiler;
+    return _backpropagate(inputs, parameters, labels, prev_errors, gradient,
+                          profiler, 0ul);
+  }
+
+  template<typename W>
+  T backpropagate(const Inputs& inputs,
+                  const StoredParameters<W>& parameters,
+                  const NetOutputs& labels, Parameters& gradient) {
+    Inputs crt_errors;
+    return backpropagate(inputs, parameters, labels, crt_errors, gradient);
+  }
+
+  template<typename W, typename Profiler>
+  T backpropagate(const Inputs& inputs,
+                  const StoredParameters<W>& parameters,
+                  const NetOutputs& labels, Inputs& prev_errors,
+                  Parameters& gradient, Profiler& profiler) {
+    return _backpropagate(inputs, parameters, labels, prev_errors, gradient,
+                          profiler, 0ul);
+  }
+
+  template<typename W, typename Profiler>
+  T backpropagate(const Inputs& inputs,
+                  const StoredParameters<W>& parameters,
+                  const NetOutputs& labels, Parameters& gradient,
+                  Profiler& profiler) {
+    Inputs crt_errors;
+    return _backpropagate(inputs, parameters, labels, crt_errors, gradient,
+                          profiler, 0ul);
+  }
+
+  /* -------------------- Layer by layer -------------------- */
+
+  template<typename W, typename Profiler>
+  void _forward(const Inputs& inputs, const StoredParameters<W>& parameters,
+                Profiler& profiler, size_t layer) {
+    profiler.template begin<T, CrtLayer, InputSize>(
+      layer, LayerPhase::forward, batch_size);
     CrtLayer::template
       forward<T, InputSize, batch_size, true>(inputs, parameters.values,
                                               hidden, outputs);
-    T err = next.computeGradient(outputs, parameters.next, labels,
-                                 errors, gradient.next);
+    profiler.end(layer, LayerPhase::forward);
+    next._forward(outputs, parameters.next, profiler, layer + 1ul);
+  }
+
+  const NetOutputs& _outputs() { return next._outputs(); }
+
+  template<typename W, typename Profiler>
+  T _backpropagate(const Inputs& inputs,
+                   const StoredParameters<W>& parameters,
+                   const NetOutputs& labels, Inputs& prev_errors,
+                   Parameters& gradient, Profiler& profiler, size_t layer) {
+    T err = next._backpropagate(outputs, parameters.next, labels, errors,
+                                gradient.next, profiler, layer + 1ul);
+    profiler.template begin<T, CrtLayer, InputSize>(
+      layer, LayerPhase::backpropagate, batch_size);
     CrtLayer::template
       backpropagate<T, InputSize, batch_size>(inputs, parameters.values,
                                               hidden, outputs, errors,
                                               gradient.values, prev_errors);
+    profiler.end(layer, LayerPhase::backpropagate);
     return err;
   }
 
-  T computeGradient(const Inputs& inputs, const Parameters& parameters,
-                    const NetOutputs& labels, Parameters& gradient) {
-    Inputs crt_errors;
-    return computeGradient(inputs, parameters, labels, crt_errors, gradient);
-  }
-
 };
 
 #endif
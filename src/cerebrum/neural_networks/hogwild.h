@@ -0,0 +1,143 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef HOGWILD_H
+#define HOGWILD_H
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "cerebrum/parallel/thread_pool.h"
+#include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/gradient_computation.h"
+#include "cerebrum/neural_networks/optimizers/optimizer.h"
+
+/* Asynchronous training without locks (Niu et al., "Hogwild!", NIPS 2011).
+ *
+ * threads_no threads share one Parameters object. Each of them has its own
+ * GradientComputation, gradient and batch buffers, and repeats: get a
+ * batch, compute the gradient with the parameters as they are at that
+ * moment, apply the update rule to the shared parameters. Nothing is
+ * locked: updates from different threads may interleave and overwrite each
+ * other, which Hogwild! shows to cost little when updates are sparse or
+ * small. This is deliberate; the parameters are only read and written with
+ * plain (vectorized) loads and stores.
+ *
+ * With `striped` set, the arena is cut into stripes that never straddle two
+ * layers, and thread t starts its update at stripe t * stripes_no /
+ * threads_no, wrapping around: threads then write to different cache lines
+ * at any moment instead of chasing each other from the first layer on.
+ *
+ * The rule is one of optimizers/ (SGD is the one Hogwild! analyses). Every
+ * thread has its own copy, for next_step(); the states of stateful rules
+ * are shared and updated as racily as the parameters.
+ *
+ * train(steps_no, source) runs steps_no steps in all, handed out to the
+ * threads as they become free, and calls source(step, inputs, labels) to
+ * fill a thread's batch buffers for the given step. It returns the mean
+ * error over the steps.
+ */
+
+template<typename T, typename Rule, size_t batch_size, typename ErrorFunction,
+         bool computes, typename InputSize, typename... Layers>
+class _Hogwild {
+ public:
+  using Computation = _GradientComputation<T, batch_size, ErrorFunction,
+                                           computes, InputSize, Layers...>;
+  using Inputs = typename Computation::Inputs;
+  using NetOutputs = typename Computation::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, Layers...>;
+
+  static constexpr size_t states_no = Rule::states_no;
+
+  /* Stripes have at most this many values (whole cache lines) */
+  static constexpr size_t stripe_size = 4096ul;
+
+  _Hogwild(Parameters& parameters, size_t threads_no,
+           const Rule& rule = Rule(), bool striped = true)
+      : parameters_(parameters), threads_no_(std::max<size_t>(1ul,
+                                                              threads_no)),
+        pool_(threads_no_), states_(states_no), workers_(threads_no_),
+        striped_(striped) {
+    for (size_t s = 0; s < states_no; s++)
+      states_[s].reset(new Parameters((T)0));
+    pool_.run(threads_no_, [this, &rule](size_t t) {
+        workers_[t].reset(new Worker(rule));
+      });
+    for (size_t l = 0; l < Parameters::layers_no; l++) {
+      const size_t begin = parameters.layer_data(l) - parameters.data();
+      const size_t end = begin + parameters.layer_size(l);
+      for (size_t b = begin; b < end; b += stripe_size)
+        stripes_.push_back(std::make_pair(b, std::min(end, b + stripe_size)));
+    }
+  }
+
+  _Hogwild(const _Hogwild&) = delete;
+  _Hogwild& operator=(const _Hogwild&) = delete;
+
+  template<typename Source>
+  T train(size_t steps_no, const Source& source) {
+    std::atomic<size_t> next(0ul);
+    pool_.run(threads_no_, [&](size_t t) {
+        Worker& worker = *workers_[t];
+        worker.error = (T)0;
+        for (size_t step = next++; step < steps_no; step = next++) {
+          source(step, worker.inputs, worker.labels);
+          worker.error += worker.computation.computeGradient(
+            worker.inputs, parameters_, worker.labels, worker.gradient);
+          _update(t, worker);
+        }
+      });
+    T error = (T)0;
+    for (size_t t = 0; t < threads_no_; t++)
+      error += workers_[t]->error;
+    return steps_no > 0ul ? error / (T)steps_no : error;
+  }
+
+  size_t threads_no() const { return threads_no_; }
+
+  /* Velocities or moments, shared by all threads */
+  Parameters& state(size_t s) { return *states_[s]; }
+
+ private:
+  struct Worker {
+    explicit Worker(const Rule& rule) : rule(rule), gradient((T)0) { }
+
+    Rule rule;
+    Computation computation;
+    Parameters gradient;
+    Inputs inputs;
+    NetOutputs labels;
+    T error;
+  };
+
+  void _update(size_t t, Worker& worker) {
+    worker.rule.next_step();
+    const size_t stripes_no = stripes_.size();
+    const size_t first = striped_ ? t * stripes_no / threads_no_ : 0ul;
+    for (size_t k = 0; k < stripes_no; k++) {
+      const std::pair<size_t, size_t>& stripe =
+        stripes_[(first + k) % stripes_no];
+      std::array<T*, states_no> s;
+      for (size_t i = 0; i < states_no; i++)
+        s[i] = states_[i]->data() + stripe.first;
+      _apply_rule(worker.rule, parameters_.data() + stripe.first,
+                  worker.gradient.data() + stripe.first, s.data(),
+                  stripe.second - stripe.first);
+    }
+  }
+
+  Parameters& parameters_;
+  const size_t threads_no_;
+  ThreadPool pool_;
+  std::vector<std::unique_ptr<Parameters>> states_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::pair<size_t, size_t>> stripes_;
+  const bool striped_;
+};
+
+#endif
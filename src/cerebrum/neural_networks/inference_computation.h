@@ -0,0 +1,207 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef INFERENCE_COMPUTATION_H
+#define INFERENCE_COMPUTATION_H
+
+#include <cstddef>
+#include <array>
+#include <stdexcept>
+
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/size.h"
+#include "cerebrum/neural_networks/parameters.h"
+
+/* Forward-only execution with planned activation memory.
+ *
+ * _ForwardComputation keeps the Hidden and Outputs of every layer, so its
+ * footprint is the sum of all activations. Inference only ever needs the
+ * inputs and the outputs of the current layer, so the plan below is made
+ * at compile time from each layer's infers_in_place flag:
+ *
+ *   - the outputs of a layer go to the buffer that does not hold its inputs
+ *     (the two buffers are used in turns);
+ *   - a layer that infers in place writes over its inputs, unless these are
+ *     the caller's;
+ *   - a SoftMax-like error function writes its outputs to the other buffer.
+ *
+ * Each buffer is as large as the largest activation planned into it. Hidden
+ * is dropped: layers that still need scratch space in inference (given by
+ * inference_hidden_size) share a single scratch buffer.
+ *
+ * Buffer 0 stands for the caller's inputs, buffers 1 and 2 are owned by the
+ * computation.
+ *
+ * The buffers are planned for batch_size examples, but forward() may be
+ * asked for fewer: every layer then computes only the first `rows`, so a
+ * server can keep one computation for the largest batch it accepts.
+ */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         size_t input_buffer, typename InputSize, typename... OtherLayers>
+struct _InferencePlan;
+
+template<typename T, size_t batch_size, typename ErrorFunction,
+         size_t input_buffer, typename LastSize>
+struct _InferencePlan<T, batch_size, ErrorFunction, false, input_buffer,
+                      LastSize> {
+
+  using NetOutputSize = LastSize;
+  using NetOutputs = std::array<std::array<T, LastSize::length>, batch_size>;
+
+  static constexpr size_t buffer_size(size_t) { return 0ul; }
+  static constexpr size_t scratch_size() { return 0ul; }
+
+  template<typename W>
+  inline static const NetOutputs&
+  forward(const NetOutputs& outputs, const _Parameters<W, LastSize>&,
+          T* const*, T*, size_t) {
+    return outputs;
+  }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction,
+         size_t input_buffer, typename LastSize>
+struct _InferencePlan<T, batch_size, ErrorFunction, true, input_buffer,
+                      LastSize> {
+
+  using NetOutputSize = LastSize;
+  using NetOutputs = std::array<std::array<T, LastSize::length>, batch_size>;
+
+  static constexpr size_t output_buffer = input_buffer == 1ul ? 2ul : 1ul;
+
+  static constexpr size_t buffer_size(size_t buffer) {
+    return buffer == output_buffer ? LastSize::length * batch_size : 0ul;
+  }
+  static constexpr size_t scratch_size() { return 0ul; }
+
+  template<typename W>
+  inline static const NetOutputs&
+  forward(const NetOutputs& outputs, const _Parameters<W, LastSize>&,
+          T* const* buffers, T*, size_t rows) {
+    NetOutputs& y = *reinterpret_cast<NetOutputs*>(buffers[output_buffer]);
+    ErrorFunction::template f<LastSize, batch_size>(outputs, y, rows);
+    return y;
+  }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         size_t input_buffer, typename InputSize, typename CrtLayer,
+         typename... Others>
+struct _InferencePlan<T, batch_size, ErrorFunction, computes, input_buffer,
+                      InputSize, CrtLayer, Others...> {
+
+  using Inputs =
+    typename CrtLayer::template Inputs<T, InputSize, batch_size>;
+  using Hidden =
+    typename CrtLayer::template Hidden<T, InputSize, batch_size>;
+  using Outputs =
+    typename CrtLayer::template Outputs<T, InputSize, batch_size>;
+
+  using OutputSize = typename CrtLayer::template OutputSize<InputSize>;
+
+  static constexpr size_t output_buffer =
+    CrtLayer::infers_in_place && input_buffer != 0ul ?
+    input_buffer : (input_buffer == 1ul ? 2ul : 1ul);
+
+  using NextPlan =
+    _InferencePlan<T, batch_size, ErrorFunction, computes, output_buffer,
+                   OutputSize, Others...>;
+
+  using NetOutputSize = typename NextPlan::NetOutputSize;
+  using NetOutputs = typename NextPlan::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, CrtLayer, Others...>;
+
+  static constexpr size_t outputs_size = OutputSize::length * batch_size;
+  static constexpr size_t hidden_size =
+    CrtLayer::template inference_hidden_size<T, InputSize, batch_size>();
+
+  static constexpr size_t buffer_size(size_t buffer) {
+    return buffer == output_buffer &&
+      outputs_size > NextPlan::buffer_size(buffer) ?
+      outputs_size : NextPlan::buffer_size(buffer);
+  }
+
+  static constexpr size_t scratch_size() {
+    return hidden_size > NextPlan::scratch_size() ?
+      hidden_size : NextPlan::scratch_size();
+  }
+
+  template<typename W>
+  inline static const NetOutputs&
+  forward(const Inputs& inputs,
+          const _Parameters<W, InputSize, CrtLayer, Others...>& parameters,
+          T* const* buffers, T* scratch, size_t rows) {
+    Outputs& outputs = *reinterpret_cast<Outputs*>(buffers[output_buffer]);
+    CrtLayer::template
+      forward<T, InputSize, batch_size, false>(
+        inputs, parameters.values, *reinterpret_cast<Hidden*>(scratch),
+        outputs, rows);
+    return NextPlan::forward(outputs, parameters.next, buffers, scratch,
+                             rows);
+  }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+struct _InferenceComputation {
+
+  using Plan = _InferencePlan<T, batch_size, ErrorFunction, computes, 0ul,
+                              InputSize, Layers...>;
+
+  using Inputs = typename Plan::Inputs;
+  using NetOutputs = typename Plan::NetOutputs;
+  using Parameters = typename Plan::Parameters;
+  using OutputSize = typename Plan::NetOutputSize;
+
+  /* Empty buffers still get a cache line, so that layers which never touch
+   * their Hidden are not handed a null reference */
+  _InferenceComputation() : y(nullptr), rows(batch_size) {
+    buffers[0] = nullptr;
+    for (size_t b = 1; b < 3; b++)
+      buffers[b] = storage[b - 1].reserve(_at_least_one(Plan::buffer_size(b)));
+    scratch = scratch_storage.reserve(_at_least_one(Plan::scratch_size()));
+  }
+
+  _InferenceComputation(const _InferenceComputation&) = delete;
+  _InferenceComputation& operator=(const _InferenceComputation&) = delete;
+
+  /* The outputs stay valid until the next call; only their first `rows`
+   * rows are computed. The parameters may be stored in another type W than
+   * T (see half.h). */
+  template<typename W>
+  const NetOutputs&
+  forward(const Inputs& inputs,
+          const _Parameters<W, InputSize, Layers...>& parameters,
+          size_t rows = batch_size) {
+    if (rows == 0ul || rows > batch_size)
+      throw std::invalid_argument("rows must be between 1 and batch_size");
+    this->rows = rows;
+    y = &Plan::forward(inputs, parameters, buffers, scratch, rows);
+    return *y;
+  }
+
+  T error(const NetOutputs& labels) {
+    return ErrorFunction::template error<OutputSize, batch_size>(*y, labels,
+                                                                 rows);
+  }
+
+  /* Activation and scratch memory, in bytes */
+  static constexpr size_t footprint() {
+    return (Plan::buffer_size(1ul) + Plan::buffer_size(2ul) +
+            Plan::scratch_size()) * sizeof(T);
+  }
+
+ private:
+  static constexpr size_t _at_least_one(size_t size) {
+    return size > 0ul ? size : cache_line_size / sizeof(T);
+  }
+
+  AlignedBuffer<T> storage[2];
+  AlignedBuffer<T> scratch_storage;
+  T* buffers[3];
+  T* scratch;
+  const NetOutputs* y;
+  size_t rows;
+};
+
+#endif
@@ -4,59 +4,352 @@
 #define CONVOLUTION_H
 
 #include <cstddef>
+#include <algorithm>
 #include <array>
 #include <random>
+#include <type_traits>
 
 #include "cerebrum/include_cblas.h"
 #include "cerebrum/size.h"
 #include "cerebrum/meta/meta_matrix.h"
+#include "cerebrum/linear_algebra/blas.h"
+#include "cerebrum/neural_networks/layers/convolution/im2col.h"
+#include "cerebrum/neural_networks/layers/convolution/winograd.h"
+#include "cerebrum/neural_networks/layers/convolution/fft.h"
 
-template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
-         typename Mapping, template<typename> class TransferFunction>
-struct _Convolution;
+/* Convolution<maps_no, conv_height, conv_width, stride, Mapping,
+ * TransferFunction> is a valid (unpadded) convolution followed by a
+ * transfer function. Mapping restricts which input maps feed which output
+ * maps; with FullConnection every output map sees all input maps.
+ *
+ * The forward pass runs on an engine chosen at compile time from the
+ * kernel size and the stride: Winograd for 3x3 kernels with stride 1, FFT
+ * for kernels of at least 5x5 with stride 1, and im2col + GEMM for
+ * everything else. An engine can also be given explicitly as the last
+ * template argument. Backpropagation always uses im2col + GEMM.
+ */
+
+using FullConnection = MetaMatrix<bool, 0ul, 0ul>;
+
+template<size_t conv_height, size_t conv_width, size_t stride>
+struct _DefaultConvolutionEngine {
+  using type =
+    typename std::conditional<
+      stride == 1ul && conv_height == 3ul && conv_width == 3ul,
+      WinogradConvolution,
+      typename std::conditional<
+        stride == 1ul && conv_height >= 5ul && conv_width >= 5ul,
+        FFTConvolution<conv_height, conv_width>,
+        Im2colConvolution<conv_height, conv_width, stride>
+        >::type
+      >::type;
+};
 
 template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
-         typename Mapping, template<typename> class TransferFunction>
-struct Convolution;
-
-template<size_t maps_no, size_t conv_length, size_t stride,
-         typename Mapping, template<typename> class TransferFunction>
-struct Convolution<maps_no, conv_length, conv_length, stride, Mapping,
-                   TransferFunction>
-    : public _Convolution<maps_no, conv_length, conv_length, stride, Mapping,
-                          TransferFunction> { };
-
-template<size_t maps_no, size_t conv_length, typename Mapping,
-         template<typename> class TransferFunction>
-struct Convolution<maps_no, conv_length, conv_length, 1ul, Mapping,
-                   TransferFunction>
-    : public _Convolution<maps_no, conv_length, conv_length, 1ul, Mapping,
-                          TransferFunction> { };
-
-template<size_t conv_length, typename Mapping,
-         template<typename> class TransferFunction>
-struct Convolution<0ul, conv_length, conv_length, 1ul, Mapping,
-                   TransferFunction>
-    : public _Convolution<0ul, conv_length, conv_length, 1ul, Mapping,
-                          TransferFunction> { };
+         typename Mapping, template<typename> class TransferFunction,
+         typename Engine>
+struct _Convolution;
 
 template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
-         typename Mapping, template<typename> class TransferFunction>
+         typename Mapping, template<typename> class TransferFunction,
+         typename Engine = typename _DefaultConvolutionEngine<conv_height,
+                                                              conv_width,
+                                                              stride>::type>
 struct Convolution
-   : public _Convolution<maps_no, conv_height, conv_width, stride,
-         Mapping, TransferFunction> { };
+    : public _Convolution<maps_no, conv_height, conv_width, stride,
+                          Mapping, TransferFunction, Engine> { };
 
 template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
-         typename Mapping, template<typename> class TransferFunction>
+         typename Mapping, template<typename> class TransferFunction,
+         typename Engine>
 struct _Convolution {
 
+  static_assert(stride > 0ul, "stride must be positive");
+  static_assert(maps_no > 0ul || Mapping::height > 0ul,
+                "the number of maps is given by maps_no or by the Mapping");
+
   /* -------------------- OutputSize -------------------- */
+
+ public:
+
+  static constexpr size_t out_maps_no =
+    maps_no > 0ul ? maps_no : Mapping::height;
+
   template<typename InputSize>
   using OutputSize =
-    Size<(maps_no > 0 ? maps_no : Mapping::rows_no),
-         (InputSize::height - conv_height + 1ul) / stride,
-         (InputSize::width - conv_width + 1ul) / stride>;
+    Size<out_maps_no,
+         (InputSize::height - conv_height) / stride + 1ul,
+         (InputSize::width - conv_width) / stride + 1ul>;
+
+  /* -------------------- Connections -------------------- */
+
+  /* Mapping is a MetaMatrix<bool, out_maps_no, input maps_no, ...>; an empty
+   * one (e.g. FullConnection) connects every output map to every input
+   * map. */
+
+ public:
+
+  template<typename InputSize>
+  static constexpr bool
+  valid_mapping() {
+    return Mapping::left == 0ul ||
+      (Mapping::height == out_maps_no &&
+       Mapping::width == InputSize::maps_no &&
+       Mapping::left == out_maps_no * InputSize::maps_no);
+  }
+
+  static constexpr bool
+  connected(size_t out_map, size_t in_map) {
+    return Mapping::left == 0ul || Mapping::get(out_map, in_map);
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  connections_no() {
+    return Mapping::left == 0ul ?
+      out_maps_no * InputSize::maps_no : Mapping::nonzero;
+  }
+
+  /* -------------------- Parameters -------------------- */
+
+  /* Biases come first, then one row of weights for each output map. A row
+   * has the same layout as a column built by im2col: input map, kernel
+   * row, kernel column. Weights between unconnected maps are stored (so
+   * that every engine works on dense weights) and never get a gradient.
+   * init_parameters sets them to zero, but other values may be written
+   * there (a constant fill, a checkpoint), so with a sparse Mapping the
+   * forward and backward passes work on a copy of the weights in which
+   * they are zero.
+   */
+
+ private:
+
+  using _Im2col = Im2colConvolution<conv_height, conv_width, stride>;
+
+ public:
+
+  template<typename InputSize>
+  static constexpr size_t
+  parameters_array_size() {
+    return out_maps_no * (1ul + _Im2col::template kernel_size<InputSize>());
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  parameters_no() {
+    return out_maps_no +
+      connections_no<InputSize>() * conv_height * conv_width;
+  }
+
+  template<typename T, typename InputSize>
+  using Parameters = std::array<T, parameters_array_size<InputSize>()>;
+
+  template<typename T, typename InputSize>
+  inline static void
+  init_parameters(Parameters<T, InputSize>& parameters) {
+    std::random_device rd { };
+    std::default_random_engine e {rd()};
+    std::normal_distribution<T> next_parameter(0.0, 0.1);
+
+    for (size_t i = 0; i < parameters_array_size<InputSize>(); i++)
+      parameters[i] = next_parameter(e);
+    _disconnect<T, InputSize>(parameters.data() + out_maps_no);
+  }
+
+ private:
+
+  /* The weights; with a sparse Mapping, a copy of them (in masked) where
+   * the weights between unconnected maps are zero */
+  template<typename T, typename InputSize>
+  inline static const T*
+  _connected_weights(const T* weights, T* masked) {
+    if (Mapping::left == 0ul)
+      return weights;
+    std::copy_n(weights, _masked_size<InputSize>(), masked);
+    _disconnect<T, InputSize>(masked);
+    return masked;
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  _masked_size() {
+    return Mapping::left == 0ul ?
+      0ul : out_maps_no * _Im2col::template kernel_size<InputSize>();
+  }
+
+  template<typename T, typename InputSize>
+  inline static void
+  _disconnect(T* weights) {
+    if (Mapping::left == 0ul)
+      return;
+    constexpr size_t kernel_area = conv_height * conv_width;
+    for (size_t o = 0; o < out_maps_no; o++)
+      for (size_t c = 0; c < InputSize::maps_no; c++)
+        if (!connected(o, c))
+          std::fill_n(weights + (o * InputSize::maps_no + c) * kernel_area,
+                      kernel_area, (T)0);
+  }
+
+  /* -------------------- Inputs, Hidden, and Outputs -------------------- */
+
+ public:
+
+  template<typename T, typename InputSize>
+  using Input = std::array<T, InputSize::length>;
+
+  template<typename T, typename InputSize, size_t batch_size>
+  using Inputs = std::array<Input<T, InputSize>, batch_size>;
+
+  template<typename T, typename InputSize>
+  using Output = std::array<T, OutputSize<InputSize>::length>;
+
+  template<typename T, typename InputSize, size_t batch_size>
+  using Outputs = std::array<Output<T, InputSize>, batch_size>;
+
+  /* Hidden is scratch space: the engine's buffers in the forward pass, the
+   * im2col columns and column errors of one example during
+   * backpropagation, and after them the masked weights of a sparse
+   * Mapping. It lives as long as the computation that owns it, so it is
+   * reused between calls. */
+
+ private:
+
+  template<typename T, typename InputSize, size_t batch_size>
+  static constexpr size_t
+  _scratch_size() {
+    return
+      Engine::template scratch_size<T, InputSize, out_maps_no, batch_size>()
+      > _Im2col::template scratch_size<T, InputSize, out_maps_no>() ?
+      Engine::template scratch_size<T, InputSize, out_maps_no, batch_size>()
+      : _Im2col::template scratch_size<T, InputSize, out_maps_no>();
+  }
+
+ public:
+
+  template<typename T, typename InputSize, size_t batch_size>
+  using Hidden = std::array<T, _scratch_size<T, InputSize, batch_size>() +
+                             _masked_size<InputSize>()>;
+
+  /* -------------------- Inference -------------------- */
+
+  /* Only the engine's forward scratch space and the masked weights are
+   * needed */
+
+ public:
+
+  static constexpr bool infers_in_place = false;
+
+  template<typename T, typename InputSize, size_t batch_size>
+  static constexpr size_t
+  inference_hidden_size() {
+    return
+      Engine::template scratch_size<T, InputSize, out_maps_no, batch_size>()
+      + _masked_size<InputSize>();
+  }
+
+  /* -------------------- Recomputation -------------------- */
+
+  /* Running the training forward pass again gives the same outputs (see
+   * checkpointed_computation.h). Hidden is only scratch space: nothing
+   * the forward pass leaves there is read by backpropagate, so layers may
+   * share it. */
+
+ public:
+
+  static constexpr bool recomputable = true;
+  static constexpr bool hidden_is_scratch = true;
+
+  /* -------------------- Forward phase -------------------- */
+
+ public:
+
+  template<typename T, typename InputSize, size_t batch_size, bool train>
+  inline static void
+  forward(const Inputs<T, InputSize, batch_size>& inputs,
+          const Parameters<T, InputSize>& parameters,
+          Hidden<T, InputSize, batch_size>& hidden,
+          Outputs<T, InputSize, batch_size>& outputs,
+          size_t rows = batch_size) {
+    static_assert(valid_mapping<InputSize>(),
+                  "Mapping must be out_maps_no x input maps_no");
+    constexpr size_t engine_scratch =
+      Engine::template scratch_size<T, InputSize, out_maps_no, batch_size>();
+
+    const T* const weights = _connected_weights<T, InputSize>(
+      parameters.data() + out_maps_no, hidden.data() + engine_scratch);
+    Engine::template
+      forward<T, InputSize, out_maps_no, batch_size, TransferFunction>(
+        reinterpret_cast<const T*>(inputs.data()), weights,
+        parameters.data(), hidden.data(),
+        reinterpret_cast<T*>(outputs.data()), rows);
+  }
+
+  /* -------------------- Backpropagation phase -------------------- */
+
+  /* For every example, with E its errors (out maps x positions) and X its
+   * columns:
+   *
+   *     dW += E * X^T,    db += row sums of E,    dX = W^T * E
+   *
+   * and col2im folds dX back onto the input maps. The columns of an example
+   * are rebuilt from the inputs instead of being kept for the whole batch;
+   * dX overwrites them once dW has been accumulated.
+   */
+
+ public:
+
+  template<typename T, typename InputSize, size_t batch_size>
+  static inline void
+  backpropagate(const Inputs<T, InputSize, batch_size>& inputs,
+                const Parameters<T, InputSize>& parameters,
+                Hidden<T, InputSize, batch_size>& hidden,
+                const Outputs<T, InputSize, batch_size>& outputs,
+                Outputs<T, InputSize, batch_size>& errors,
+                Parameters<T, InputSize>& gradients,
+                Inputs<T, InputSize, batch_size>& prev_errors) {
+    constexpr size_t K = _Im2col::template kernel_size<InputSize>();
+    constexpr size_t P = _Im2col::template positions_no<InputSize>();
+    const T* const weights = _connected_weights<T, InputSize>(
+      parameters.data() + out_maps_no,
+      hidden.data() + _scratch_size<T, InputSize, batch_size>());
+    T* const bias_gradients = gradients.data();
+    T* const weight_gradients = gradients.data() + out_maps_no;
+
+    TransferFunction<T>::template
+      df_batch<OutputSize<InputSize>, batch_size>(outputs, errors);
+
+    std::fill_n(bias_gradients, out_maps_no, (T)0);
+    for (size_t n = 0; n < batch_size; n++) {
+      const T* const e = errors[n].data();
+
+      const T* columns = inputs[n].data();
+      if (_Im2col::lowered) {
+        _Im2col::template im2col<T, InputSize>(inputs[n].data(),
+                                               hidden.data());
+        columns = hidden.data();
+      }
+      blas_gemm<false, true>(out_maps_no, K, P, (T)1, e, P, columns, P,
+                             n == 0ul ? (T)0 : (T)1, weight_gradients, K);
+
+      for (size_t o = 0; o < out_maps_no; o++) {
+        const T* const e_row = e + o * P;
+        T sum = (T)0;
+        for (size_t p = 0; p < P; p++)
+          sum += e_row[p];
+        bias_gradients[o] += sum;
+      }
+
+      T* const column_errors =
+        _Im2col::lowered ? hidden.data() : prev_errors[n].data();
+      blas_gemm<true, false>(K, P, out_maps_no, (T)1, weights, K, e, P,
+                             (T)0, column_errors, P);
+      if (_Im2col::lowered)
+        _Im2col::template col2im<T, InputSize>(column_errors,
+                                               prev_errors[n].data());
+    }
 
+    _disconnect<T, InputSize>(weight_gradients);
+  }
 };
 
 #endif
@@ -0,0 +1,331 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef CONVOLUTION_FFT_H
+#define CONVOLUTION_FFT_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cerebrum/size.h"
+
+/* FFT convolution for large kernels with stride 1. Input maps and kernels
+ * are zero padded to N1 x N2 (powers of two, at least the input size) and
+ * every output map is
+ *
+ *     y_o = IFFT( sum_c FFT(x_c) .* conj(FFT(k_oc)) )
+ *
+ * which is the circular cross-correlation of x_c and k_oc; it equals the
+ * valid convolution on the first (H - kh + 1) x (W - kw + 1) positions
+ * because those never wrap around. A pair of maps costs N1 N2 complex
+ * multiplications instead of kh kw OH OW real ones, plus one FFT per input
+ * map and one inverse FFT per output map. Kernel spectra are computed once
+ * per batch.
+ *
+ * Complex values are kept as separate real and imaginary planes, and every
+ * one-dimensional FFT runs on all the columns of a plane at once, so the
+ * butterflies vectorize. The second dimension is transformed after a
+ * transposition; spectra are therefore stored transposed (N2 x N1), which
+ * does not matter for the element-wise products.
+ */
+
+template<typename T, size_t n>
+struct _FFT {
+  static_assert(n > 0ul && (n & (n - 1ul)) == 0ul,
+                "FFT size must be a power of two");
+
+  /* exp(-2 pi i k / n) for k < n / 2, real parts then imaginary parts */
+  static const T* twiddles() {
+    static const std::vector<T> values = make_twiddles();
+    return values.data();
+  }
+
+  /* In-place transform of every column of an n x lanes matrix */
+  static void
+  transform_columns(T* re, T* im, size_t lanes) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+      size_t bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j) {
+        std::swap_ranges(re + i * lanes, re + (i + 1ul) * lanes,
+                         re + j * lanes);
+        std::swap_ranges(im + i * lanes, im + (i + 1ul) * lanes,
+                         im + j * lanes);
+      }
+    }
+
+    const T* const w_re = twiddles();
+    const T* const w_im = twiddles() + n / 2ul;
+    for (size_t len = 2ul; len <= n; len <<= 1) {
+      const size_t half = len >> 1;
+      const size_t step = n / len;
+      for (size_t i = 0; i < n; i += len) {
+        for (size_t k = 0; k < half; k++) {
+          const T wr = w_re[k * step];
+          const T wi = w_im[k * step];
+          T* const a_re = re + (i + k) * lanes;
+          T* const a_im = im + (i + k) * lanes;
+          T* const b_re = re + (i + k + half) * lanes;
+          T* const b_im = im + (i + k + half) * lanes;
+          for (size_t l = 0; l < lanes; l++) {
+            const T br = b_re[l] * wr - b_im[l] * wi;
+            const T bi = b_re[l] * wi + b_im[l] * wr;
+            b_re[l] = a_re[l] - br;
+            b_im[l] = a_im[l] - bi;
+            a_re[l] += br;
+            a_im[l] += bi;
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  static std::vector<T> make_twiddles() {
+    std::vector<T> values(n > 1ul ? n : 2ul);
+    const double pi = std::acos(-1.0);
+    for (size_t k = 0; k < n / 2ul; k++) {
+      values[k] = (T)std::cos(2.0 * pi * k / n);
+      values[n / 2ul + k] = (T)-std::sin(2.0 * pi * k / n);
+    }
+    return values;
+  }
+};
+
+constexpr size_t _next_power_of_two(size_t x, size_t p = 1ul) {
+  return p >= x ? p : _next_power_of_two(x, p << 1);
+}
+
+template<size_t conv_height, size_t conv_width>
+struct FFTConvolution {
+
+  template<typename InputSize>
+  using OutputSize =
+    Size<1ul, InputSize::height - conv_height + 1ul,
+         InputSize::width - conv_width + 1ul>;
+
+  template<typename InputSize>
+  static constexpr size_t
+  rows() {
+    return _next_power_of_two(InputSize::height);
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  columns() {
+    return _next_power_of_two(InputSize::width);
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  spectrum_size() {
+    return rows<InputSize>() * columns<InputSize>();
+  }
+
+  /* The spectrum of a real map is Hermitian, so only the rows k2 <= N2 / 2
+   * of the (transposed) spectrum are kept */
+  template<typename InputSize>
+  static constexpr size_t
+  half_spectrum_size() {
+    return (columns<InputSize>() / 2ul + 1ul) * rows<InputSize>();
+  }
+
+  /* Kernel spectra [maps_no][input maps], input spectra [input maps], two
+   * output spectra (all of them halves, two planes each) and two full
+   * two-plane buffers */
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size>
+  static constexpr size_t
+  scratch_size() {
+    return 2ul * half_spectrum_size<InputSize>() *
+      ((maps_no + 1ul) * InputSize::maps_no + 2ul) +
+      4ul * spectrum_size<InputSize>();
+  }
+
+ private:
+
+  template<typename T>
+  static void
+  _transpose(const T* in, size_t in_rows, size_t in_columns, T* out) {
+    for (size_t i = 0; i < in_rows; i++)
+      for (size_t j = 0; j < in_columns; j++)
+        out[j * in_rows + i] = in[i * in_columns + j];
+  }
+
+  /* Half spectra of two real height x width maps (b may be null) zero
+   * padded to N1 x N2. They go through a single complex FFT of a + i b and
+   * are separated using the symmetry of real spectra:
+   *
+   *     A[k] = (Z[k] + conj(Z[-k])) / 2,   B[k] = (Z[k] - conj(Z[-k])) / 2i
+   */
+  template<typename T, typename InputSize>
+  static void
+  _transform_maps(const T* a, const T* b, size_t height, size_t width,
+                  T* spectrum_a, T* spectrum_b, T* buffer) {
+    constexpr size_t N1 = rows<InputSize>();
+    constexpr size_t N2 = columns<InputSize>();
+    constexpr size_t N = N1 * N2;
+    constexpr size_t Nh = half_spectrum_size<InputSize>();
+
+    T* const z = buffer + 2ul * N;
+    std::fill_n(buffer, 2ul * N, (T)0);
+    for (size_t i = 0; i < height; i++) {
+      std::copy(a + i * width, a + (i + 1ul) * width, buffer + i * N2);
+      if (b)
+        std::copy(b + i * width, b + (i + 1ul) * width,
+                  buffer + N + i * N2);
+    }
+    _FFT<T, N1>::transform_columns(buffer, buffer + N, N2);
+    _transpose(buffer, N1, N2, z);
+    _transpose(buffer + N, N1, N2, z + N);
+    _FFT<T, N2>::transform_columns(z, z + N, N1);
+
+    for (size_t k2 = 0; k2 <= N2 / 2ul; k2++) {
+      const T* const z_re = z + k2 * N1;
+      const T* const z_im = z + N + k2 * N1;
+      const T* const zm_re = z + ((N2 - k2) % N2) * N1;
+      const T* const zm_im = z + N + ((N2 - k2) % N2) * N1;
+      T* const a_re = spectrum_a + k2 * N1;
+      T* const a_im = spectrum_a + Nh + k2 * N1;
+      T* const b_re = spectrum_b + k2 * N1;
+      T* const b_im = spectrum_b + Nh + k2 * N1;
+      for (size_t k1 = 0; k1 < N1; k1++) {
+        const size_t m1 = (N1 - k1) % N1;
+        a_re[k1] = (T)0.5 * (z_re[k1] + zm_re[m1]);
+        a_im[k1] = (T)0.5 * (z_im[k1] - zm_im[m1]);
+        b_re[k1] = (T)0.5 * (z_im[k1] + zm_im[m1]);
+        b_im[k1] = (T)0.5 * (zm_re[m1] - z_re[k1]);
+      }
+    }
+  }
+
+  /* Inverse of two half spectra at once: z = IFFT(Y1 + i Y2) has y1 as its
+   * real part and y2 as its imaginary part. The missing rows come from
+   * Y[k] = conj(Y[-k]), and the inverse is computed as conj(FFT(conj(Z))).
+   * Returns the planes of N z (rows i, columns j). */
+  template<typename T, typename InputSize>
+  static const T*
+  _inverse_maps(const T* y1, const T* y2, T* buffer) {
+    constexpr size_t N1 = rows<InputSize>();
+    constexpr size_t N2 = columns<InputSize>();
+    constexpr size_t N = N1 * N2;
+    constexpr size_t Nh = half_spectrum_size<InputSize>();
+
+    T* const z = buffer + 2ul * N;
+    T* const z_re = z;
+    T* const z_im = z + N;
+    for (size_t k2 = 0; k2 < N2; k2++) {
+      if (k2 <= N2 / 2ul) {
+        const T* const y1_re = y1 + k2 * N1;
+        const T* const y1_im = y1 + Nh + k2 * N1;
+        const T* const y2_re = y2 + k2 * N1;
+        const T* const y2_im = y2 + Nh + k2 * N1;
+        for (size_t k1 = 0; k1 < N1; k1++) {
+          z_re[k2 * N1 + k1] = y1_re[k1] - y2_im[k1];
+          z_im[k2 * N1 + k1] = -(y1_im[k1] + y2_re[k1]);
+        }
+      } else {
+        const T* const y1_re = y1 + (N2 - k2) * N1;
+        const T* const y1_im = y1 + Nh + (N2 - k2) * N1;
+        const T* const y2_re = y2 + (N2 - k2) * N1;
+        const T* const y2_im = y2 + Nh + (N2 - k2) * N1;
+        for (size_t k1 = 0; k1 < N1; k1++) {
+          const size_t m1 = (N1 - k1) % N1;
+          z_re[k2 * N1 + k1] = y1_re[m1] + y2_im[m1];
+          z_im[k2 * N1 + k1] = y1_im[m1] - y2_re[m1];
+        }
+      }
+    }
+
+    _FFT<T, N2>::transform_columns(z_re, z_im, N1);
+    _transpose(z_re, N2, N1, buffer);
+    _transpose(z_im, N2, N1, buffer + N);
+    _FFT<T, N1>::transform_columns(buffer, buffer + N, N2);
+    return buffer;
+  }
+
+ public:
+
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size,
+           template<typename> class TransferFunction>
+  static void
+  forward(const T* inputs, const T* weights, const T* biases, T* scratch,
+          T* outputs, size_t examples) {
+    constexpr size_t C = InputSize::maps_no;
+    constexpr size_t in_map_size = InputSize::height * InputSize::width;
+    constexpr size_t kernel_area = conv_height * conv_width;
+    constexpr size_t OH = OutputSize<InputSize>::height;
+    constexpr size_t OW = OutputSize<InputSize>::width;
+    constexpr size_t N1 = rows<InputSize>();
+    constexpr size_t N2 = columns<InputSize>();
+    constexpr size_t Nh = half_spectrum_size<InputSize>();
+
+    T* const kernels = scratch;
+    T* const spectra = kernels + 2ul * Nh * maps_no * C;
+    T* const acc = spectra + 2ul * Nh * C;
+    T* const buffer = acc + 4ul * Nh;
+
+    /* Conjugated kernel spectra, so that products give
+     * cross-correlations */
+    for (size_t oc = 0; oc < maps_no * C; oc += 2ul) {
+      const bool pair = oc + 1ul < maps_no * C;
+      _transform_maps<T, InputSize>(
+        weights + oc * kernel_area,
+        pair ? weights + (oc + 1ul) * kernel_area : nullptr,
+        conv_height, conv_width, kernels + 2ul * Nh * oc,
+        pair ? kernels + 2ul * Nh * (oc + 1ul) : acc, buffer);
+    }
+    for (size_t oc = 0; oc < maps_no * C; oc++)
+      for (size_t f = 0; f < Nh; f++)
+        kernels[2ul * Nh * oc + Nh + f] = -kernels[2ul * Nh * oc + Nh + f];
+
+    const T scale = (T)1 / (T)(N1 * N2);
+    for (size_t n = 0; n < examples; n++) {
+      const T* const input = inputs + n * C * in_map_size;
+      for (size_t c = 0; c < C; c += 2ul) {
+        const bool pair = c + 1ul < C;
+        _transform_maps<T, InputSize>(
+          input + c * in_map_size,
+          pair ? input + (c + 1ul) * in_map_size : nullptr,
+          InputSize::height, InputSize::width, spectra + 2ul * Nh * c,
+          pair ? spectra + 2ul * Nh * (c + 1ul) : acc, buffer);
+      }
+
+      for (size_t o0 = 0; o0 < maps_no; o0 += 2ul) {
+        std::fill_n(acc, 4ul * Nh, (T)0);
+        for (size_t o = o0; o < o0 + 2ul && o < maps_no; o++) {
+          T* const acc_re = acc + 2ul * Nh * (o - o0);
+          T* const acc_im = acc_re + Nh;
+          for (size_t c = 0; c < C; c++) {
+            const T* const x_re = spectra + 2ul * Nh * c;
+            const T* const x_im = x_re + Nh;
+            const T* const k_re = kernels + 2ul * Nh * (o * C + c);
+            const T* const k_im = k_re + Nh;
+            for (size_t f = 0; f < Nh; f++) {
+              acc_re[f] += x_re[f] * k_re[f] - x_im[f] * k_im[f];
+              acc_im[f] += x_re[f] * k_im[f] + x_im[f] * k_re[f];
+            }
+          }
+        }
+
+        const T* const z =
+          _inverse_maps<T, InputSize>(acc, acc + 2ul * Nh, buffer);
+        for (size_t o = o0; o < o0 + 2ul && o < maps_no; o++) {
+          /* z = conj(N y1 + i N y2) */
+          const T* const plane = o == o0 ? z : z + N1 * N2;
+          const T sign = o == o0 ? (T)1 : (T)-1;
+          T* const out_map = outputs + (n * maps_no + o) * OH * OW;
+          for (size_t i = 0; i < OH; i++)
+            for (size_t j = 0; j < OW; j++)
+              out_map[i * OW + j] =
+                sign * plane[i * N2 + j] * scale + biases[o];
+          TransferFunction<T>::f_array(out_map, out_map, OH * OW);
+        }
+      }
+    }
+  }
+};
+
+#endif
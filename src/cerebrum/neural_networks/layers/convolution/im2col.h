@@ -0,0 +1,175 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef CONVOLUTION_IM2COL_H
+#define CONVOLUTION_IM2COL_H
+
+#include <cstddef>
+#include <algorithm>
+
+#include "cerebrum/size.h"
+#include "cerebrum/linear_algebra/gemm.h"
+#include "cerebrum/linear_algebra/blas.h"
+
+/* Convolution engines compute the forward pass of a batch:
+ *
+ *   scratch_size<T, InputSize, maps_no, batch_size>()
+ *       scratch space needed, in T
+ *   forward<T, InputSize, maps_no, batch_size, TransferFunction>(
+ *       inputs, weights, biases, scratch, outputs, rows)
+ *       outputs = f(conv(inputs, weights) + biases), for the first rows
+ *       (<= batch_size) examples
+ *
+ * Weights are laid out as in _Convolution: one row per output map, each row
+ * ordered by input map, kernel row, kernel column.
+ *
+ * Im2colConvolution lowers the example to a (kernel size x output
+ * positions) matrix and does a single GEMM with the weights. It works for
+ * any kernel and stride, and its im2col / col2im are also used by the
+ * backward pass of every engine.
+ */
+
+template<size_t conv_height, size_t conv_width, size_t stride>
+struct Im2colConvolution {
+
+  template<typename InputSize>
+  using OutputSize =
+    Size<1ul,
+         (InputSize::height - conv_height) / stride + 1ul,
+         (InputSize::width - conv_width) / stride + 1ul>;
+
+  template<typename InputSize>
+  static constexpr size_t
+  kernel_size() {
+    return InputSize::maps_no * conv_height * conv_width;
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  positions_no() {
+    return OutputSize<InputSize>::length;
+  }
+
+  /* A 1x1 kernel with stride 1 needs no lowering: the input already is the
+   * column matrix */
+  static constexpr bool lowered =
+    !(conv_height == 1ul && conv_width == 1ul && stride == 1ul);
+
+  template<typename T, typename InputSize, size_t maps_no,
+           size_t batch_size = 1ul>
+  static constexpr size_t
+  scratch_size() {
+    return lowered ? kernel_size<InputSize>() * positions_no<InputSize>()
+                   : 0ul;
+  }
+
+  /* columns[(c, ky, kx)][(oy, ox)] =
+   *     input[c][oy * stride + ky][ox * stride + kx] */
+  template<typename T, typename InputSize>
+  static void
+  im2col(const T* input, T* columns) {
+    using OutSize = OutputSize<InputSize>;
+    for (size_t c = 0; c < InputSize::maps_no; c++) {
+      const T* const map = input + c * InputSize::height * InputSize::width;
+      for (size_t ky = 0; ky < conv_height; ky++) {
+        for (size_t kx = 0; kx < conv_width; kx++) {
+          for (size_t oy = 0; oy < OutSize::height; oy++) {
+            const T* src = map + (oy * stride + ky) * InputSize::width + kx;
+            if (stride == 1ul) {
+              std::copy(src, src + OutSize::width, columns);
+            } else {
+              for (size_t ox = 0; ox < OutSize::width; ox++)
+                columns[ox] = src[ox * stride];
+            }
+            columns += OutSize::width;
+          }
+        }
+      }
+    }
+  }
+
+  /* The adjoint of im2col: adds every column entry back to the input
+   * position it was copied from */
+  template<typename T, typename InputSize>
+  static void
+  col2im(const T* columns, T* input) {
+    using OutSize = OutputSize<InputSize>;
+    std::fill_n(input, InputSize::length, (T)0);
+    for (size_t c = 0; c < InputSize::maps_no; c++) {
+      T* const map = input + c * InputSize::height * InputSize::width;
+      for (size_t ky = 0; ky < conv_height; ky++) {
+        for (size_t kx = 0; kx < conv_width; kx++) {
+          for (size_t oy = 0; oy < OutSize::height; oy++) {
+            T* dst = map + (oy * stride + ky) * InputSize::width + kx;
+            for (size_t ox = 0; ox < OutSize::width; ox++)
+              dst[ox * stride] += columns[ox];
+            columns += OutSize::width;
+          }
+        }
+      }
+    }
+  }
+
+  /* Bias and transfer function are applied in the GEMM epilogue, one bias
+   * per row (output map) */
+  template<typename T, template<typename> class TransferFunction>
+  struct _ForwardEpilogue : public PartialSumEpilogue<T> {
+    const T* biases;
+
+    explicit _ForwardEpilogue(const T* biases) : biases(biases) { }
+
+    inline void
+    finish(size_t i0, size_t, size_t rows, size_t cols, const T* tile,
+           size_t ld_tile, T* c, size_t ldc, bool first) const {
+      for (size_t i = 0; i < rows; i++) {
+        const T* tile_row = tile + i * ld_tile;
+        T* c_row = c + i * ldc;
+        const T bias = biases[i0 + i];
+        for (size_t j = 0; j < cols; j++)
+          c_row[j] = first ? (tile_row[j] + bias)
+                           : (tile_row[j] + c_row[j] + bias);
+        TransferFunction<T>::f_array(c_row, c_row, cols);
+      }
+    }
+  };
+
+  /* output (maps x positions) = weights (maps x kernel size) * columns,
+   * one example at a time */
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size,
+           template<typename> class TransferFunction>
+  static void
+  forward(const T* inputs, const T* weights, const T* biases, T* scratch,
+          T* outputs, size_t rows) {
+    constexpr size_t K = kernel_size<InputSize>();
+    constexpr size_t P = positions_no<InputSize>();
+    const _ForwardEpilogue<T, TransferFunction> epilogue(biases);
+
+    for (size_t n = 0; n < rows; n++) {
+      const T* const input = inputs + n * InputSize::length;
+      T* const output = outputs + n * maps_no * P;
+
+      const T* columns = input;
+      if (lowered) {
+        im2col<T, InputSize>(input, scratch);
+        columns = scratch;
+      }
+
+      /* BLAS has no epilogue: bias and transfer function take a second
+       * pass */
+      if (_Blas<false, false, T>::external) {
+        blas_gemm<false, false>(maps_no, P, K, (T)1, weights, K, columns, P,
+                                (T)0, output, P);
+        for (size_t o = 0; o < maps_no; o++) {
+          T* const map = output + o * P;
+          for (size_t p = 0; p < P; p++)
+            map[p] += biases[o];
+          TransferFunction<T>::f_array(map, map, P);
+        }
+      } else {
+        gemm<false, false>(maps_no, P, K, weights, K, columns, P, output, P,
+                           epilogue);
+      }
+    }
+  }
+};
+
+#endif
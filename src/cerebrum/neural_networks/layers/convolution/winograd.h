@@ -0,0 +1,351 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef CONVOLUTION_WINOGRAD_H
+#define CONVOLUTION_WINOGRAD_H
+
+#include <cstddef>
+#include <algorithm>
+
+#include "cerebrum/size.h"
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/linear_algebra/blas.h"
+
+/* Winograd minimal filtering F(m x m, 3 x 3) for 3x3 kernels with stride 1
+ * (Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks").
+ *
+ * Every output tile of m x m values is computed from an (m + 2) x (m + 2)
+ * input tile:
+ *
+ *     Y = A^T [ (G g G^T) .* (B^T d B) ] A
+ *
+ * Summed over input maps, the element-wise products become (m + 2)^2
+ * independent GEMMs (output maps x input maps) * (input maps x tiles), so a
+ * tile costs (m + 2)^2 multiplications per pair of maps instead of 9 m^2:
+ * 2.25x fewer for F(2x2, 3x3) and 4x fewer for F(4x4, 3x3). Tiles of
+ * several examples go through the same GEMMs to keep them large.
+ *
+ * F(4x4, 3x3) is used when both output dimensions are at least 8, since
+ * smaller maps would waste most of the larger tiles on padding. Its
+ * transforms have larger constants and lose a few more bits than
+ * F(2x2, 3x3); this is harmless for double and within training noise for
+ * float.
+ */
+
+/* One-dimensional transforms of `lanes` independent vectors at once: the
+ * k-th element of vector l is x[k * xs + l * xl] and the k-th result goes
+ * to y[k * ys + l]. Two-dimensional transforms apply them to the columns
+ * and then to the rows of the tiles, and the loop over lanes vectorizes. */
+
+template<size_t m>
+struct _WinogradTransforms;
+
+template<>
+struct _WinogradTransforms<2ul> {
+  static constexpr size_t alpha = 4ul;
+
+  /* y = B^T x */
+  template<typename T>
+  inline static void
+  input(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl],
+        x3 = x[3 * xs + l * xl];
+      y[l] = x0 - x2;
+      y[ys + l] = x1 + x2;
+      y[2 * ys + l] = x2 - x1;
+      y[3 * ys + l] = x1 - x3;
+    }
+  }
+
+  /* y = G x */
+  template<typename T>
+  inline static void
+  kernel(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl];
+      y[l] = x0;
+      y[ys + l] = (T)0.5 * (x0 + x1 + x2);
+      y[2 * ys + l] = (T)0.5 * (x0 - x1 + x2);
+      y[3 * ys + l] = x2;
+    }
+  }
+
+  /* y = A^T x */
+  template<typename T>
+  inline static void
+  output(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl],
+        x3 = x[3 * xs + l * xl];
+      y[l] = x0 + x1 + x2;
+      y[ys + l] = x1 - x2 - x3;
+    }
+  }
+};
+
+template<>
+struct _WinogradTransforms<4ul> {
+  static constexpr size_t alpha = 6ul;
+
+  template<typename T>
+  inline static void
+  input(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl],
+        x3 = x[3 * xs + l * xl], x4 = x[4 * xs + l * xl],
+        x5 = x[5 * xs + l * xl];
+      y[l] = (T)4 * x0 - (T)5 * x2 + x4;
+      y[ys + l] = x3 + x4 - (T)4 * (x1 + x2);
+      y[2 * ys + l] = x4 - x3 + (T)4 * (x1 - x2);
+      y[3 * ys + l] = x4 - x2 + (T)2 * (x3 - x1);
+      y[4 * ys + l] = x4 - x2 + (T)2 * (x1 - x3);
+      y[5 * ys + l] = (T)4 * x1 - (T)5 * x3 + x5;
+    }
+  }
+
+  template<typename T>
+  inline static void
+  kernel(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl];
+      y[l] = x0 / (T)4;
+      y[ys + l] = -(x0 + x1 + x2) / (T)6;
+      y[2 * ys + l] = -(x0 - x1 + x2) / (T)6;
+      y[3 * ys + l] = x0 / (T)24 + x1 / (T)12 + x2 / (T)6;
+      y[4 * ys + l] = x0 / (T)24 - x1 / (T)12 + x2 / (T)6;
+      y[5 * ys + l] = x2;
+    }
+  }
+
+  template<typename T>
+  inline static void
+  output(const T* x, size_t xs, size_t xl, T* y, size_t ys, size_t lanes) {
+    for (size_t l = 0; l < lanes; l++) {
+      const T x0 = x[l * xl], x1 = x[xs + l * xl], x2 = x[2 * xs + l * xl],
+        x3 = x[3 * xs + l * xl], x4 = x[4 * xs + l * xl],
+        x5 = x[5 * xs + l * xl];
+      const T s12 = x1 + x2, d12 = x1 - x2, s34 = x3 + x4, d34 = x3 - x4;
+      y[l] = x0 + s12 + s34;
+      y[ys + l] = d12 + (T)2 * d34;
+      y[2 * ys + l] = s12 + (T)4 * s34;
+      y[3 * ys + l] = d12 + (T)8 * d34 + x5;
+    }
+  }
+};
+
+template<size_t m>
+struct _WinogradConvolution {
+  using Transforms = _WinogradTransforms<m>;
+  static constexpr size_t alpha = Transforms::alpha;
+  static constexpr size_t alpha2 = alpha * alpha;
+
+  template<typename InputSize>
+  using OutputSize =
+    Size<1ul, InputSize::height - 2ul, InputSize::width - 2ul>;
+
+  template<typename InputSize>
+  static constexpr size_t
+  tiles_height() {
+    return (OutputSize<InputSize>::height + m - 1ul) / m;
+  }
+
+  template<typename InputSize>
+  static constexpr size_t
+  tiles_width() {
+    return (OutputSize<InputSize>::width + m - 1ul) / m;
+  }
+
+  /* Examples transformed together: enough tiles for efficient GEMMs */
+  template<typename InputSize, size_t batch_size>
+  static constexpr size_t
+  chunk_size() {
+    return 256ul / (tiles_height<InputSize>() * tiles_width<InputSize>()) >=
+      batch_size ? batch_size :
+      (256ul / (tiles_height<InputSize>() * tiles_width<InputSize>()) > 0ul ?
+       256ul / (tiles_height<InputSize>() * tiles_width<InputSize>()) : 1ul);
+  }
+
+  template<typename InputSize, size_t batch_size>
+  static constexpr size_t
+  chunk_tiles() {
+    return chunk_size<InputSize, batch_size>() *
+      tiles_height<InputSize>() * tiles_width<InputSize>();
+  }
+
+  /* Transformed filters U [alpha^2][maps_no][input maps], transformed
+   * inputs V [alpha^2][input maps][tiles] and products M
+   * [alpha^2][maps_no][tiles]. The alpha^2 planes of V and M are read and
+   * written together, so they are skewed by a cache line: with a stride
+   * that is a multiple of 4 KiB they would all compete for the same L1
+   * sets. */
+  template<typename T, typename InputSize, size_t count, size_t batch_size>
+  static constexpr size_t
+  plane_size() {
+    return count * chunk_tiles<InputSize, batch_size>() +
+      cache_line_size / sizeof(T);
+  }
+
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size>
+  static constexpr size_t
+  scratch_size() {
+    return alpha2 * (maps_no * InputSize::maps_no +
+                     plane_size<T, InputSize, InputSize::maps_no,
+                                batch_size>() +
+                     plane_size<T, InputSize, maps_no, batch_size>());
+  }
+
+  template<typename T, typename InputSize, size_t maps_no>
+  static void
+  _transform_kernels(const T* weights, T* u) {
+    constexpr size_t C = InputSize::maps_no;
+    for (size_t o = 0; o < maps_no; o++) {
+      for (size_t c = 0; c < C; c++) {
+        T gg[alpha][3];
+        T ggg[alpha][alpha];
+        /* G g, then (G g) G^T */
+        Transforms::kernel(weights + (o * C + c) * 9ul, 3ul, 1ul,
+                           &gg[0][0], 3ul, 3ul);
+        for (size_t i = 0; i < alpha; i++)
+          Transforms::kernel(gg[i], 1ul, 0ul, ggg[i], 1ul, 1ul);
+        for (size_t i = 0; i < alpha; i++)
+          for (size_t j = 0; j < alpha; j++)
+            u[((i * alpha + j) * maps_no + o) * C + c] = ggg[i][j];
+      }
+    }
+  }
+
+  /* V = B^T d B for one row of tiles of one input map */
+  template<typename T, typename InputSize>
+  static void
+  _transform_inputs(const T* map, size_t y0, T* v, size_t ld_v) {
+    constexpr size_t H = InputSize::height;
+    constexpr size_t W = InputSize::width;
+    constexpr size_t tiles_w = tiles_width<InputSize>();
+    constexpr size_t padded_width = tiles_w * m + 2ul;
+
+    T rows[alpha][padded_width];
+    for (size_t i = 0; i < alpha; i++) {
+      if (y0 + i < H) {
+        std::copy(map + (y0 + i) * W, map + (y0 + i + 1ul) * W, rows[i]);
+        std::fill(rows[i] + W, rows[i] + padded_width, (T)0);
+      } else {
+        std::fill(rows[i], rows[i] + padded_width, (T)0);
+      }
+    }
+
+    T columns[alpha][padded_width];
+    Transforms::input(&rows[0][0], padded_width, 1ul,
+                      &columns[0][0], padded_width, padded_width);
+    for (size_t i = 0; i < alpha; i++)
+      Transforms::input(columns[i], 1ul, m, v + i * alpha * ld_v, ld_v,
+                        tiles_w);
+  }
+
+  /* Y = A^T M A for one row of tiles of one output map, plus bias and
+   * transfer function on the valid part */
+  template<typename T, typename InputSize, size_t maps_no,
+           template<typename> class TransferFunction>
+  static void
+  _transform_outputs(const T* products, size_t ld_products, T bias,
+                     size_t y0, T* map) {
+    constexpr size_t OH = OutputSize<InputSize>::height;
+    constexpr size_t OW = OutputSize<InputSize>::width;
+    constexpr size_t tiles_w = tiles_width<InputSize>();
+
+    T columns[m][alpha][tiles_w];
+    for (size_t j = 0; j < alpha; j++)
+      Transforms::output(products + j * ld_products, alpha * ld_products,
+                         1ul, &columns[0][j][0], alpha * tiles_w, tiles_w);
+    T y[m][m][tiles_w];
+    for (size_t i = 0; i < m; i++)
+      Transforms::output(&columns[i][0][0], tiles_w, 1ul, &y[i][0][0],
+                         tiles_w, tiles_w);
+
+    for (size_t i = 0; i < m && y0 + i < OH; i++) {
+      T* const row = map + (y0 + i) * OW;
+      for (size_t tx = 0; tx < tiles_w; tx++)
+        for (size_t j = 0; j < m && tx * m + j < OW; j++)
+          row[tx * m + j] = y[i][j][tx] + bias;
+      TransferFunction<T>::f_array(row, row, OW);
+    }
+  }
+
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size,
+           template<typename> class TransferFunction>
+  static void
+  forward(const T* inputs, const T* weights, const T* biases, T* scratch,
+          T* outputs, size_t rows) {
+    constexpr size_t C = InputSize::maps_no;
+    constexpr size_t in_map_size = InputSize::height * InputSize::width;
+    constexpr size_t out_map_size = OutputSize<InputSize>::length;
+    constexpr size_t tiles_h = tiles_height<InputSize>();
+    constexpr size_t tiles_w = tiles_width<InputSize>();
+    constexpr size_t chunk = chunk_size<InputSize, batch_size>();
+    constexpr size_t tiles = chunk_tiles<InputSize, batch_size>();
+
+    constexpr size_t v_plane = plane_size<T, InputSize, C, batch_size>();
+    constexpr size_t m_plane =
+      plane_size<T, InputSize, maps_no, batch_size>();
+
+    T* const u = scratch;
+    T* const v = scratch + alpha2 * maps_no * C;
+    T* const products = v + alpha2 * v_plane;
+
+    _transform_kernels<T, InputSize, maps_no>(weights, u);
+
+    for (size_t n0 = 0; n0 < rows; n0 += chunk) {
+      const size_t examples = std::min(chunk, rows - n0);
+      const size_t used_tiles = examples * tiles_h * tiles_w;
+
+      for (size_t n = 0; n < examples; n++)
+        for (size_t c = 0; c < C; c++)
+          for (size_t ty = 0; ty < tiles_h; ty++)
+            _transform_inputs<T, InputSize>(
+              inputs + ((n0 + n) * C + c) * in_map_size, ty * m,
+              v + c * tiles + (n * tiles_h + ty) * tiles_w, v_plane);
+
+      for (size_t xi = 0; xi < alpha2; xi++)
+        blas_gemm<false, false>(maps_no, used_tiles, C,
+                                (T)1, u + xi * maps_no * C, C,
+                                v + xi * v_plane, tiles,
+                                (T)0, products + xi * m_plane, tiles);
+
+      for (size_t n = 0; n < examples; n++)
+        for (size_t o = 0; o < maps_no; o++)
+          for (size_t ty = 0; ty < tiles_h; ty++)
+            _transform_outputs<T, InputSize, maps_no, TransferFunction>(
+              products + o * tiles + (n * tiles_h + ty) * tiles_w,
+              m_plane, biases[o], ty * m,
+              outputs + ((n0 + n) * maps_no + o) * out_map_size);
+    }
+  }
+};
+
+/* Engine for 3x3 kernels with stride 1: picks the tile size from the
+ * output size */
+
+struct WinogradConvolution {
+  template<typename InputSize>
+  using _Engine =
+    _WinogradConvolution<(InputSize::height >= 10ul &&
+                          InputSize::width >= 10ul) ? 4ul : 2ul>;
+
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size>
+  static constexpr size_t
+  scratch_size() {
+    return _Engine<InputSize>::template
+      scratch_size<T, InputSize, maps_no, batch_size>();
+  }
+
+  template<typename T, typename InputSize, size_t maps_no, size_t batch_size,
+           template<typename> class TransferFunction>
+  inline static void
+  forward(const T* inputs, const T* weights, const T* biases, T* scratch,
+          T* outputs, size_t rows) {
+    _Engine<InputSize>::template
+      forward<T, InputSize, maps_no, batch_size, TransferFunction>(
+        inputs, weights, biases, scratch, outputs, rows);
+  }
+};
+
+#endif
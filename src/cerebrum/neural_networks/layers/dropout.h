@@ -4,12 +4,26 @@
 #define DROPOUT_H
 
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <algorithm>
 #include <array>
-#include <random>
 
 #include "cerebrum/include_cblas.h"
 #include "cerebrum/size.h"
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/random/philox.h"
+
+/* Dropout<active_no> keeps, in training, each unit of each example with
+ * probability p = active_no / length and scales the kept units by 1 / p
+ * (inverted dropout), so inference is the identity.
+ *
+ * Units are kept when a 16-bit random number is below round(p * 2^16);
+ * the scale uses that rounded probability. The random numbers come from a
+ * Philox generator that each computation seeds once; every training step
+ * uses a new stream. Masks are kept as bits, one row per example, and
+ * expanded again during backpropagation.
+ */
 
 template<size_t active_no>
 struct Dropout { 
@@ -59,8 +73,22 @@ struct Dropout {
   template<typename T, typename InputSize, size_t batch_size>
   using Outputs = Inputs<T, InputSize, batch_size>;
 
+  template<typename InputSize>
+  static constexpr size_t
+  mask_words_no() {
+    return (InputSize::length + 63ul) / 64ul;
+  }
+
+  template<typename InputSize, size_t batch_size>
+  struct _Masks {
+    std::array<std::array<uint64_t, mask_words_no<InputSize>()>, batch_size>
+      bits;
+    Philox generator;
+    uint64_t step = 0ul;
+  };
+
   template<typename T, typename InputSize, size_t batch_size>
-  using Hidden = Output<T, InputSize>;
+  using Hidden = _Masks<InputSize, batch_size>;
 
  private:
 
@@ -70,6 +98,31 @@ struct Dropout {
   template<typename T, typename InputSize, size_t batch_size>
   using _LinearOutputs = _LinearInputs<T, InputSize, batch_size>;
 
+  /* -------------------- Inference -------------------- */
+
+  /* In inference Dropout is the identity */
+
+ public:
+
+  static constexpr bool infers_in_place = true;
+
+  template<typename T, typename InputSize, size_t batch_size>
+  static constexpr size_t
+  inference_hidden_size() {
+    return 0ul;
+  }
+
+  /* -------------------- Recomputation -------------------- */
+
+  /* Every training forward pass draws a new mask, so it cannot be run
+   * again; gradient checkpointing keeps the masks and outputs of Dropout
+   * layers instead (see checkpointed_computation.h) */
+
+ public:
+
+  static constexpr bool recomputable = false;
+  static constexpr bool hidden_is_scratch = false;
+
   /* -------------------- Forward phase -------------------- */
 
  private:
@@ -84,9 +137,10 @@ struct Dropout {
   forward(const Inputs<T, InputSize, batch_size>& inputs,
           const Parameters<T, InputSize>& parameters,
           Hidden<T, InputSize, batch_size>& hidden,
-          Outputs<T, InputSize, batch_size>& outputs) {
+          Outputs<T, InputSize, batch_size>& outputs,
+          size_t rows = batch_size) {
     _Forward<T, InputSize, batch_size, train>::
-      forward(inputs, parameters, hidden, outputs);
+      forward(inputs, parameters, hidden, outputs, rows);
   }
 
  private:
@@ -99,34 +153,93 @@ struct Dropout {
  */
 #endif
 
+  template<typename InputSize>
+  static constexpr uint32_t
+  _threshold() {
+    return (uint32_t)((65536ul * active_no + InputSize::length / 2ul) /
+                      InputSize::length);
+  }
+
+  template<typename T, typename InputSize>
+  static constexpr T
+  _scale() {
+    return (T)65536 / (T)_threshold<InputSize>();
+  }
+
+  /* Masks are built and applied 64 units at a time, as one byte per unit;
+   * eight bytes (0 or 1) become eight bits with a single multiplication */
+
+  inline static uint64_t
+  _pack(const uint8_t* keep) {
+    uint64_t word = 0ul;
+    for (size_t k = 0; k < 8ul; k++) {
+      uint64_t bytes;
+      std::memcpy(&bytes, keep + 8ul * k, sizeof(bytes));
+      word |= ((bytes * 0x0102040810204080ul) >> 56) << (8ul * k);
+    }
+    return word;
+  }
+
+  inline static void
+  _unpack(uint64_t word, uint8_t* keep) {
+    for (size_t k = 0; k < 8ul; k++) {
+      const uint64_t spread =
+        (((word >> (8ul * k)) & 0xFFul) * 0x0101010101010101ul) &
+        0x8040201008040201ul;
+      const uint64_t bytes =
+        ((spread + 0x7F7F7F7F7F7F7F7Ful) >> 7) & 0x0101010101010101ul;
+      std::memcpy(keep + 8ul * k, &bytes, sizeof(bytes));
+    }
+  }
+
+  /* out_i = in_i * scale for kept units, 0 for the others */
+  template<typename T>
+  inline static void
+  _apply(const uint8_t* keep, const T* in, T* out, T scale, size_t count) {
+    for (size_t b = 0; b < count; b++)
+      out[b] = in[b] * (scale * (T)keep[b]);
+  }
+
   template<typename T, typename InputSize, size_t batch_size, bool train>
   struct _Forward {
+    static_assert(active_no > 0ul && active_no <= InputSize::length,
+                  "Dropout must keep between 1 and length units");
+
     inline static void
     forward(const Inputs<T, InputSize, batch_size>& inputs,
             const Parameters<T, InputSize>&,
             Hidden<T, InputSize, batch_size>& hidden,
-            Outputs<T, InputSize, batch_size>& outputs) {
+            Outputs<T, InputSize, batch_size>& outputs, size_t rows) {
       if (train) {
-        constexpr double p = (double)active_no / (double)(InputSize::length);
-        std::random_device rd { };
-        std::default_random_engine e {rd()};
-        std::bernoulli_distribution take(p);
-
-        using InputRow = Input<T, InputSize>;
-        using OutputRow = Output<T, InputSize>;
-
-        for (size_t i = 0; i < InputSize::length; i++)
-          hidden[i] = (T)take(e);
-        for (size_t n = 0; n < batch_size; n++) {
-          const InputRow& input_row =
-            *reinterpret_cast<const InputRow*>(inputs[n].data());
-          OutputRow& output_row =
-            *reinterpret_cast<OutputRow*>(outputs[n].data());
-          for (size_t i = 0; i < InputSize::length; i++)
-            output_row[i] = hidden[i] * input_row[i];
+        /* 64 units of 16 bits per mask word, 8 units per Philox block */
+        constexpr size_t words_no = mask_words_no<InputSize>();
+        constexpr size_t blocks_no = 8ul * words_no;
+        constexpr uint32_t threshold = _threshold<InputSize>();
+        static thread_local AlignedBuffer<uint32_t> random_buffer;
+        uint32_t* const random = random_buffer.reserve(4ul * blocks_no);
+        const uint64_t stream = hidden.step++;
+
+        for (size_t n = 0; n < rows; n++) {
+          hidden.generator.generate(stream, n * blocks_no, blocks_no, random);
+          for (size_t w = 0; w < words_no; w++) {
+            const size_t i = 64ul * w;
+            const size_t count =
+              InputSize::length - i < 64ul ? InputSize::length - i : 64ul;
+            uint8_t keep[64];
+            for (size_t b = 0; b < 32ul; b++) {
+              const uint32_t r = random[32ul * w + b];
+              keep[2ul * b] = (r & 0xFFFFu) < threshold;
+              keep[2ul * b + 1ul] = (r >> 16) < threshold;
+            }
+            std::fill(keep + count, keep + 64, (uint8_t)0);
+            hidden.bits[n][w] = _pack(keep);
+            _apply<T>(keep, inputs[n].data() + i, outputs[n].data() + i,
+                      _scale<T, InputSize>(), count);
+          }
         }
-      } else {
-        std::memcpy(outputs.data(), inputs.data(), sizeof(outputs));
+      } else if (outputs.data() != inputs.data()) {
+        std::memcpy(outputs.data(), inputs.data(),
+                    rows * sizeof(Output<T, InputSize>));
       }
     }
   };
@@ -172,15 +285,17 @@ struct Dropout {
                   Outputs<T, InputSize, batch_size>& errors,
                   Parameters<T, InputSize>&,
                   Inputs<T, InputSize, batch_size>& prev_errors) {
-      using InputRow = Input<T, InputSize>;
-      using OutputRow = Output<T, InputSize>;
+      constexpr size_t words_no = mask_words_no<InputSize>();
       for (size_t n = 0; n < batch_size; n++) {
-        const OutputRow& error_row =
-          *reinterpret_cast<const OutputRow*>(errors[n].data());
-        InputRow& prev_error_row =
-          *reinterpret_cast<InputRow*>(prev_errors[n].data());
-        for (size_t i = 0; i < InputSize::length; i++)
-          prev_error_row[i] = hidden[i] * error_row[i];
+        for (size_t w = 0; w < words_no; w++) {
+          const size_t i = 64ul * w;
+          const size_t count =
+            InputSize::length - i < 64ul ? InputSize::length - i : 64ul;
+          uint8_t keep[64];
+          _unpack(hidden.bits[n][w], keep);
+          _apply<T>(keep, errors[n].data() + i, prev_errors[n].data() + i,
+                    _scale<T, InputSize>(), count);
+        }
       }
     }
   };
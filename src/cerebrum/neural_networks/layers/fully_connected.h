@@ -4,11 +4,13 @@
 #define FULLY_CONNECTED_H
 
 #include <cstddef>
+#include <algorithm>
 #include <array>
 #include <random>
 
 #include "cerebrum/include_cblas.h"
 #include "cerebrum/size.h"
+#include "cerebrum/linear_algebra/gemm.h"
 
 template<size_t length, template <typename> class TransferFunction>
 struct FullyConnected {
@@ -92,129 +94,187 @@ struct FullyConnected {
   template<typename T, typename InputSize, size_t batch_size>
   using Hidden = Outputs<T, OutputSize<InputSize>, batch_size>;
 
+  /* -------------------- Inference -------------------- */
+
+  /* The GEMM reads every input row for each output row, so the outputs
+   * need their own buffer; Hidden is not touched */
+
+  static constexpr bool infers_in_place = false;
+
+  template<typename T, typename InputSize, size_t batch_size>
+  static constexpr size_t
+  inference_hidden_size() {
+    return 0ul;
+  }
+
+  /* -------------------- Recomputation -------------------- */
+
+  /* The training forward pass depends only on the inputs and the
+   * parameters, so gradient checkpointing may run it again (see
+   * checkpointed_computation.h). Hidden keeps the sums for backpropagate. */
+
+  static constexpr bool recomputable = true;
+  static constexpr bool hidden_is_scratch = false;
+
   /* -------------------- Forward phase -------------------- */
 
-  template<typename T, typename InputSize, size_t batch_size, bool train>
+  /* The parameters may be stored as W instead of T (Half or BFloat16 for
+   * float, see half.h): the GEMM converts the weights while packing them
+   * and the epilogue converts the biases, so all the arithmetic is in T.
+   *
+   * Only the first `rows` examples of the batch are computed (the M
+   * dimension of the GEMM); the other rows of the outputs are left as they
+   * are. */
+
+  template<typename T, typename W, typename InputSize, size_t batch_size,
+           bool train>
   struct _Forward;
 
-  template<typename T, typename InputSize, size_t batch_size, bool train>
+  template<typename T, typename InputSize, size_t batch_size, bool train,
+           typename W>
   inline static void
   forward(const Inputs<T, InputSize, batch_size>& inputs,
-          const Parameters<T, InputSize>& parameters,
+          const Parameters<W, InputSize>& parameters,
           Hidden<T, InputSize, batch_size>& hidden,
-          Outputs<T, InputSize, batch_size>& outputs) {
-    _Forward<T, InputSize, batch_size, train>::
-      forward(inputs, parameters, hidden, outputs);
+          Outputs<T, InputSize, batch_size>& outputs,
+          size_t rows = batch_size) {
+    _Forward<T, W, InputSize, batch_size, train>::
+      forward(inputs, parameters, hidden, outputs, rows);
   }
 
 
 #ifdef USE_CBLAS
 
+  /* BLAS gives no access to its epilogue: the GEMM writes the plain product
+   * (beta = 0, so there is no bias copy pass before it) and a single pass
+   * afterwards adds the biases and applies the transfer function. In
+   * inference the product goes straight into `outputs` and is transformed
+   * in place, so `hidden` is never touched.
+   */
+
+  template<typename T>
+  inline static void
+  _bias_transfer(const T* biases, T* z, T* a, size_t rows) {
+    for (size_t n = 0; n < rows; n++) {
+      T* z_row = z + n * length;
+      T* a_row = a + n * length;
+      for (size_t j = 0; j < length; j++)
+        z_row[j] += biases[j];
+      TransferFunction<T>::f_array(z_row, a_row, length);
+    }
+  }
+
   template<typename InputSize, size_t batch_size, bool train>
-  struct _Forward<float, InputSize, batch_size, train> {
+  struct _Forward<float, float, InputSize, batch_size, train> {
     static void forward(const Inputs<float, InputSize, batch_size>& inputs,
                         const Parameters<float, InputSize>& parameters,
                         Hidden<float, InputSize, batch_size>& hidden,
-                        Outputs<float, InputSize, batch_size>& outputs) {
-      for (size_t n = 0; n < batch_size; n++) {
-        cblas_scopy(length,
-                    reinterpret_cast<const float*>(parameters.data()), 1,
-                    reinterpret_cast<float*>(hidden[n].data()), 1);
-      }
+                        Outputs<float, InputSize, batch_size>& outputs,
+                        size_t rows) {
+      float* const a = reinterpret_cast<float*>(outputs.data());
+      float* const z = train ? reinterpret_cast<float*>(hidden.data()) : a;
       cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                  batch_size, length, InputSize::length,
+                  rows, length, InputSize::length,
                   1.0, reinterpret_cast<const float*>(inputs.data()),
                   InputSize::length,
                   reinterpret_cast<const float*>(&(parameters[length])),
                   InputSize::length,
-                  1.0, reinterpret_cast<float*>(hidden.data()), length);
-
-      TransferFunction<float>::template
-        f_batch<OutputSize<InputSize>, batch_size>(hidden, outputs);
+                  0.0, z, length);
+      _bias_transfer<float>(parameters.data(), z, a, rows);
     }
   };
 
   template<typename InputSize, size_t batch_size, bool train>
-  struct _Forward<double, InputSize, batch_size, train> {
+  struct _Forward<double, double, InputSize, batch_size, train> {
     inline static void
     forward(const Inputs<double, InputSize, batch_size>& inputs,
             const Parameters<double, InputSize>& parameters,
             Hidden<double, InputSize, batch_size>& hidden,
-            Outputs<double, InputSize, batch_size>& outputs){
-      for (size_t n = 0; n < batch_size; n++) {
-        cblas_dcopy(length,
-                    reinterpret_cast<const double*>(parameters.data()), 1,
-                    reinterpret_cast<double*>(hidden[n].data()), 1);
-      }
+            Outputs<double, InputSize, batch_size>& outputs,
+            size_t rows) {
+      double* const a = reinterpret_cast<double*>(outputs.data());
+      double* const z = train ? reinterpret_cast<double*>(hidden.data()) : a;
       cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                  batch_size, length, InputSize::length,
+                  rows, length, InputSize::length,
                   1.0, reinterpret_cast<const double*>(inputs.data()),
                   InputSize::length,
                   reinterpret_cast<const double*>(&(parameters[length])),
                   InputSize::length,
-                  1.0, reinterpret_cast<double*>(hidden.data()), length);
-
-      TransferFunction<double>::template
-        f_batch<OutputSize<InputSize>, batch_size>(hidden, outputs);
+                  0.0, z, length);
+      _bias_transfer<double>(parameters.data(), z, a, rows);
     }
   };
 #endif
 
-  template<typename T, typename InputSize, size_t batch_size, bool train>
+  /* Bias and transfer function are applied in the GEMM epilogue, while
+   * each tile of pre-activations is still in L1. Pre-activations are kept in
+   * `hidden` only for training; in inference the partial sums live in
+   * `outputs` and `hidden` is never touched.
+   */
+
+  template<typename T, typename W, bool train>
+  struct _ForwardEpilogue : public PartialSumEpilogue<T> {
+    const W* biases;
+    T* outputs;
+
+    _ForwardEpilogue(const W* biases, T* outputs)
+        : biases(biases), outputs(outputs) { }
+
+    inline void
+    finish(size_t i0, size_t j0, size_t rows, size_t cols, const T* tile,
+           size_t ld_tile, T* c, size_t ldc, bool first) const {
+      const W* bias = biases + j0;
+      for (size_t i = 0; i < rows; i++) {
+        const T* tile_row = tile + i * ld_tile;
+        T* c_row = c + i * ldc;
+        T* output_row = outputs + (i0 + i) * length + j0;
+        T* z_row = train ? c_row : output_row;
+        for (size_t j = 0; j < cols; j++)
+          z_row[j] = first ? (tile_row[j] + (T)bias[j])
+                           : (tile_row[j] + c_row[j] + (T)bias[j]);
+        TransferFunction<T>::f_array(z_row, output_row, cols);
+      }
+    }
+  };
+
+  template<typename T, typename W, typename InputSize, size_t batch_size,
+           bool train>
   struct _Forward {
     inline static void
     forward(const Inputs<T, InputSize, batch_size>& inputs,
-            const Parameters<T, InputSize>& parameters,
+            const Parameters<W, InputSize>& parameters,
             Hidden<T, InputSize, batch_size>& hidden,
-            Outputs<T, InputSize, batch_size>& outputs) {
-
-      using Biases = _Biases<T, InputSize>;
-      using Weights = _Weights<T, InputSize>;
-      using WeightsRow = _WeightsRow<T, InputSize>;
-      using InputRow = Input<T, InputSize>;
-      using OutputRow = Output<T, InputSize>;
-
-      const Biases& biases =
-        *reinterpret_cast<const Biases*>(parameters.data());
-      const Weights& weights =
-        *reinterpret_cast<const Weights*>(&(parameters[length]));
-
-      for (size_t n = 0; n < batch_size; n++) {
-        const InputRow& input_row =
-          *reinterpret_cast<const InputRow*>(inputs[n].data());
-        OutputRow& hidden_row =
-          *reinterpret_cast<OutputRow*>(hidden[n].data());
-        OutputRow& output_row =
-          *reinterpret_cast<OutputRow*>(outputs[n].data());
-
-        for (size_t j = 0; j < length; j++) {
-          const WeightsRow& weights_row =
-            *reinterpret_cast<const WeightsRow*>(weights[j].data());
-          hidden_row[j] = biases[j];
-          for (size_t i = 0; i < InputSize::length; i++) {
-            hidden_row[j] += input_row[i] * weights_row[i];
-          }
-          output_row[j] = TransferFunction<T>::f(hidden_row[j]);
-        }
-      }
+            Outputs<T, InputSize, batch_size>& outputs, size_t rows) {
+      T* const outputs_data = reinterpret_cast<T*>(outputs.data());
+      T* const partial_sums =
+        train ? reinterpret_cast<T*>(hidden.data()) : outputs_data;
+      const _ForwardEpilogue<T, W, train> epilogue(parameters.data(),
+                                                   outputs_data);
+      gemm<false, true>(rows, length, InputSize::length,
+                        reinterpret_cast<const T*>(inputs.data()),
+                        InputSize::length,
+                        &(parameters[length]), InputSize::length,
+                        partial_sums, length, epilogue);
     }
   };
 
   /* -------------------- Backpropagation phase -------------------- */
 
-  template<typename T, typename InputSize, size_t batch_size>
+  /* With parameters stored as W, the gradient is still computed in T */
+
+  template<typename T, typename W, typename InputSize, size_t batch_size>
   struct _Backpropagate;
 
-  template<typename T, typename InputSize, size_t batch_size>
+  template<typename T, typename InputSize, size_t batch_size, typename W>
   static inline void
   backpropagate(const Inputs<T, InputSize, batch_size>& inputs,
-                const Parameters<T, InputSize>& parameters,
+                const Parameters<W, InputSize>& parameters,
                 const Hidden<T, InputSize, batch_size>& hidden,
                 const Outputs<T, InputSize, batch_size>& outputs,
                 Outputs<T, InputSize, batch_size>& errors,
                 Parameters<T, InputSize>& gradients,
                 Inputs<T, InputSize, batch_size>& prev_errors) {
-    _Backpropagate<T, InputSize, batch_size>::
+    _Backpropagate<T, W, InputSize, batch_size>::
       backpropagate(inputs, parameters, hidden, outputs, errors, gradients,
                     prev_errors);
   }
@@ -222,7 +282,7 @@ struct FullyConnected {
 #ifdef USE_CBLAS
 
   template<typename InputSize, size_t batch_size>
-  struct _Backpropagate<float, InputSize, batch_size> {
+  struct _Backpropagate<float, float, InputSize, batch_size> {
     inline static void
     backpropagate(const Inputs<float, InputSize, batch_size>& inputs,
                   const Parameters<float, InputSize>& parameters,
@@ -264,7 +324,7 @@ struct FullyConnected {
   };
 
   template<typename InputSize, size_t batch_size>
-  struct _Backpropagate<double, InputSize, batch_size> {
+  struct _Backpropagate<double, double, InputSize, batch_size> {
     inline static void
     backpropagate(const Inputs<double, InputSize, batch_size>& inputs,
                   const Parameters<double, InputSize>& parameters,
@@ -307,65 +367,39 @@ struct FullyConnected {
 
 #endif
 
-  template<typename T, typename InputSize, size_t batch_size>
+  template<typename T, typename W, typename InputSize, size_t batch_size>
   struct _Backpropagate {
     inline static void
     backpropagate(const Inputs<T, InputSize, batch_size>& inputs,
-                  const Parameters<T, InputSize>& parameters,
+                  const Parameters<W, InputSize>& parameters,
                   const Hidden<T, InputSize, batch_size>&,
                   const Outputs<T, InputSize, batch_size>& outputs,
                   Outputs<T, InputSize, batch_size>& errors,
                   Parameters<T, InputSize>& gradients,
                   Inputs<T, InputSize, batch_size>& prev_errors) {
+      TransferFunction<T>::template
+        df_batch<OutputSize<InputSize>, batch_size>(outputs, errors);
 
-      using Weights = _Weights<T, InputSize>;
-      using LinearWeights = _LinearWeights<T, InputSize>;
-      using WeightsRow = _WeightsRow<T, InputSize>;
-      using Biases = _Biases<T, InputSize>;
-
-      using InputRow = Input<T, InputSize>;
-      using OutputRow = Output<T, InputSize>;
-
-      const Weights& weights =
-        *reinterpret_cast<const Weights*>(&(parameters[length]));
-
-      Biases& g_biases = *reinterpret_cast<Biases*>(gradients.data());
-      Weights& g_weights = *reinterpret_cast<Weights*>(&(gradients[length]));
-      LinearWeights& g_linear_weights =
-        *reinterpret_cast<LinearWeights*>(&g_weights);
+      const T* const errors_data = reinterpret_cast<const T*>(errors.data());
 
-      std::fill(g_biases.begin(), g_biases.end(), (T)0);
-      std::fill(g_linear_weights.begin(), g_linear_weights.end(), (T)0);
+      gemm<true, false>(length, InputSize::length, batch_size,
+                        (T)1, errors_data, length,
+                        reinterpret_cast<const T*>(inputs.data()),
+                        InputSize::length,
+                        (T)0, &(gradients[length]), InputSize::length);
 
+      std::fill(gradients.begin(), gradients.begin() + length, (T)0);
       for (size_t n = 0; n < batch_size; n++) {
-        std::fill(prev_errors[n].begin(), prev_errors[n].end(), (T)0);
-
-        const OutputRow& output_row =
-          *reinterpret_cast<const OutputRow*>(outputs[n].data());
-        OutputRow& errors_row =
-          *reinterpret_cast<OutputRow*>(errors[n].data());
-        const InputRow& input_row =
-          *reinterpret_cast<const InputRow*>(inputs[n].data());
-        InputRow& prev_err_row =
-          *reinterpret_cast<InputRow*>(prev_errors[n].data());
-
-        for (size_t j = 0; j < length; j++) {
-          const WeightsRow& weights_row =
-            *reinterpret_cast<const WeightsRow*>(weights[j].data());
-          WeightsRow& g_weights_row =
-            *reinterpret_cast<WeightsRow*>(g_weights[j].data());
-
-          errors_row[j] *= TransferFunction<T>::df(output_row[j]);
-
-          const T err_n_j = errors_row[j];
-          g_biases[j] += err_n_j;
-          for (size_t i = 0; i < InputSize::length; i++) {
-            g_weights_row[i] += input_row[i] * err_n_j;
-            prev_err_row[i] += err_n_j * weights_row[i];
-          }
-        }
+        const T* const errors_row = errors_data + n * length;
+        for (size_t j = 0; j < length; j++)
+          gradients[j] += errors_row[j];
       }
 
+      gemm<false, false>(batch_size, InputSize::length, length,
+                         (T)1, errors_data, length,
+                         &(parameters[length]), InputSize::length,
+                         (T)0, reinterpret_cast<T*>(prev_errors.data()),
+                         InputSize::length);
     }
   };
 };
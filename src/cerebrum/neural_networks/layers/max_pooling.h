@@ -4,14 +4,46 @@
 #define MAX_POOLING_H
 
 #include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <array>
+#include <type_traits>
 
+#include "cerebrum/simd.h"
 #include "cerebrum/size.h"
 
-template<size_t pool_height, size_t pool_width>
+/* MaxPooling<pool_height, pool_width, stride_height, stride_width> takes
+ * the maximum of every pool_height x pool_width window of each map; the
+ * windows start every stride_height rows and stride_width columns (by
+ * default one window after the other). Strides smaller than the pool give
+ * overlapping windows.
+ *
+ * In training, Hidden records where each maximum was as its offset in the
+ * window (i * pool_width + j), in a byte for windows of up to 256 units.
+ * The first of equal maxima is taken.
+ *
+ * The forward pass works on a row of outputs at a time, with vectors over
+ * the outputs of the row: each position of the window is compared and
+ * selected without branches. When stride_width is not 1, the inputs at
+ * each position are first gathered into a contiguous row.
+ *
+ * When the windows tile the inputs (strides equal to the pool),
+ * backpropagation goes through the errors of the inputs once, a band of
+ * pool_height rows at a time: the band is cleared and the errors of its
+ * outputs are written at the maxima. Otherwise the errors of each map are
+ * cleared and then accumulated.
+ */
+
+template<size_t pool_height, size_t pool_width,
+         size_t stride_height = pool_height, size_t stride_width = pool_width>
 struct MaxPooling {
 
+  static_assert(pool_height > 0ul && pool_width > 0ul &&
+                stride_height > 0ul && stride_width > 0ul,
+                "MaxPooling needs non-empty pools and strides");
+  static_assert(pool_height * pool_width <= 65536ul,
+                "MaxPooling windows are limited to 65536 units");
+
   /* -------------------- OutputSize -------------------- */
 
  public:
@@ -19,8 +51,8 @@ struct MaxPooling {
   template<typename InputSize>
   using OutputSize =
     Size<InputSize::maps_no,
-         InputSize::height / pool_height,
-         InputSize::width / pool_width>;
+         (InputSize::height - pool_height) / stride_height + 1ul,
+         (InputSize::width - pool_width) / stride_width + 1ul>;
 
   /* -------------------- Parameters -------------------- */
 
@@ -55,47 +87,53 @@ struct MaxPooling {
   template <typename T, typename InputSize, size_t batch_size>
   using Inputs = std::array<Input<T, InputSize>, batch_size>;
 
- private:
-
   template<typename T, typename InputSize>
-  using _InputMap =
-    std::array<std::array<T, InputSize::width>, InputSize::height>;
+  using Output = std::array<T, OutputSize<InputSize>::length>;
 
-  template<typename T, typename InputSize>
-  using _InputMaps =
-    std::array<_InputMap<T, InputSize>, InputSize::maps_no>;
+  template <typename T, typename InputSize, size_t batch_size>
+  using Outputs = std::array<Output<T, InputSize>, batch_size>;
 
-  template<typename T, typename InputSize, size_t batch_size>
-  using _Inputs = std::array<_InputMaps<T, InputSize>, batch_size>;
+ private:
+
+  static constexpr size_t _window = pool_height * pool_width;
+
+  static constexpr bool _tiles =
+    stride_height == pool_height && stride_width == pool_width;
 
  public:
 
-  template<typename T, typename InputSize>
-  using Output = std::array<T, OutputSize<InputSize>::length>;
+  /* The offset of the maximum in its window */
+  using Argmax =
+    typename std::conditional<_window <= 256ul, uint8_t, uint16_t>::type;
 
   template <typename T, typename InputSize, size_t batch_size>
-  using Outputs = std::array<Output<T, InputSize>, batch_size>;
+  using Hidden = Outputs<Argmax, InputSize, batch_size>;
 
- private:
+  /* -------------------- Inference -------------------- */
 
-  template<typename T, typename InputSize>
-  using _OutputMap =
-    std::array<std::array<T, OutputSize<InputSize>::width>,
-               OutputSize<InputSize>::height>;
+  /* A row of outputs is written after all its windows are read, and the
+   * inputs of later rows all lie after it, so the outputs may overwrite
+   * the inputs. Positions of the maxima are only recorded for training. */
 
-  template<typename T, typename InputSize>
-  using _OutputMaps =
-    std::array<_OutputMap<T, InputSize>, OutputSize<InputSize>::maps_no>;
+ public:
+
+  static constexpr bool infers_in_place = true;
 
   template<typename T, typename InputSize, size_t batch_size>
-  using _Outputs = std::array<_OutputMaps<T, InputSize>, batch_size>;
+  static constexpr size_t
+  inference_hidden_size() {
+    return 0ul;
+  }
+
+  /* -------------------- Recomputation -------------------- */
 
-  using HiddenValue = std::pair<size_t, size_t>;
+  /* Running the training forward pass again finds the same maxima (see
+   * checkpointed_computation.h) */
 
  public:
 
-  template <typename T, typename InputSize, size_t batch_size>
-  using Hidden = Outputs<HiddenValue, InputSize, batch_size>;
+  static constexpr bool recomputable = true;
+  static constexpr bool hidden_is_scratch = false;
 
   /* -------------------- Forward phase -------------------- */
 
@@ -111,9 +149,10 @@ struct MaxPooling {
   forward(const Inputs<T, InputSize, batch_size>& inputs,
           const Parameters<T, InputSize>& parameters,
           Hidden<T, InputSize, batch_size>& hidden,
-          Outputs<T, InputSize, batch_size>& outputs) {
+          Outputs<T, InputSize, batch_size>& outputs,
+          size_t rows = batch_size) {
     _Forward<T, InputSize, batch_size, train>::
-      forward(inputs, parameters, hidden, outputs);
+      forward(inputs, parameters, hidden, outputs, rows);
   }
 
  private:
@@ -124,41 +163,70 @@ struct MaxPooling {
     forward(const Inputs<T, InputSize, batch_size>& inputs,
             const Parameters<T, InputSize>&,
             Hidden<T, InputSize, batch_size>& hidden,
-            Outputs<T, InputSize, batch_size>& outputs) {
-      using __Inputs = _Inputs<T, InputSize, batch_size>;
-      using __Outputs = _Outputs<T, InputSize, batch_size>;
-      using __Hidden = _Outputs<HiddenValue, InputSize, batch_size>;
-
-      using __InputMap = _InputMap<T, InputSize>;
-      using __OutputMap = _OutputMap<T, InputSize>;
-      using __HiddenMap = _OutputMap<HiddenValue, InputSize>;
-
-      const __Inputs& _inputs = *reinterpret_cast<const __Inputs*>(&inputs);
-      __Outputs& _outputs = *reinterpret_cast<__Outputs*>(&outputs);
-      __Hidden& _hidden = *reinterpret_cast<__Hidden*>(&hidden);
-
-      for (size_t n = 0; n < batch_size; n++) {
-        for (size_t m = 0; m < OutputSize<InputSize>::maps_no; m++) {
-          const __InputMap& input_map =
-            *reinterpret_cast<const __InputMap*>(_inputs[n][m].data());
-          __OutputMap& output_map =
-            *reinterpret_cast<__OutputMap*>(_outputs[n][m].data());
-          __HiddenMap& hidden_map =
-            *reinterpret_cast<__HiddenMap*>(_hidden[n][m].data());
-
-          for (int r = 0; r < OutputSize<InputSize>::height; r++) {
-            for (int c = 0; c < OutputSize<InputSize>::width; c++) {
-              T max = std::numeric_limits<T>::lowest();
-              for (size_t i = r * pool_height; i < (r+1) * pool_height; i++) {
-                for (size_t j = c * pool_width; j < (c+1) * pool_width; j++) {
-                  if (input_map[i][j] > max) {
-                    max = input_map[i][j];
-                    hidden_map[r][c].first = i;
-                    hidden_map[r][c].second = j;
-                  }
+            Outputs<T, InputSize, batch_size>& outputs, size_t rows) {
+      using OutSize = OutputSize<InputSize>;
+      using V = Vector<T>;
+      using S = ScalarVector<T>;
+      constexpr size_t L = V::length;
+      constexpr size_t width = OutSize::width;
+      constexpr size_t body = width - width % L;
+      constexpr size_t out_map = OutSize::height * width;
+
+      std::array<T, width> gathered;
+      std::array<T, width> max;
+      std::array<T, width> argmax;
+
+      for (size_t n = 0; n < rows; n++) {
+        for (size_t m = 0; m < OutSize::maps_no; m++) {
+          const T* const input_map =
+            inputs[n].data() + m * InputSize::height * InputSize::width;
+          T* const output_map = outputs[n].data() + m * out_map;
+          Argmax* const hidden_map = hidden[n].data() + m * out_map;
+
+          for (size_t r = 0; r < OutSize::height; r++) {
+            max.fill(std::numeric_limits<T>::lowest());
+            if (train)
+              argmax.fill((T)0);
+
+            for (size_t i = 0; i < pool_height; i++) {
+              const T* const row =
+                input_map + (r * stride_height + i) * InputSize::width;
+              for (size_t j = 0; j < pool_width; j++) {
+                const T* x = row + j;
+                if (stride_width != 1ul) {
+                  for (size_t c = 0; c < width; c++)
+                    gathered[c] = row[c * stride_width + j];
+                  x = gathered.data();
+                }
+                const T offset = (T)(i * pool_width + j);
+
+                const typename V::Type v_offset = V::broadcast(offset);
+                for (size_t c = 0; c < body; c += L) {
+                  const typename V::Type v_x = V::loadu(x + c);
+                  const typename V::Type v_max = V::loadu(max.data() + c);
+                  const typename V::Mask greater = V::less(v_max, v_x);
+                  V::storeu(max.data() + c, V::select(greater, v_x, v_max));
+                  if (train)
+                    V::storeu(argmax.data() + c,
+                              V::select(greater, v_offset,
+                                        V::loadu(argmax.data() + c)));
+                }
+                for (size_t c = body; c < width; c++) {
+                  const bool greater = S::less(max[c], x[c]);
+                  max[c] = S::select(greater, x[c], max[c]);
+                  if (train)
+                    argmax[c] = S::select(greater, offset, argmax[c]);
                 }
               }
-              output_map[r][c] = max;
+            }
+
+            T* const output_row = output_map + r * width;
+            for (size_t c = 0; c < width; c++)
+              output_row[c] = max[c];
+            if (train) {
+              Argmax* const hidden_row = hidden_map + r * width;
+              for (size_t c = 0; c < width; c++)
+                hidden_row[c] = (Argmax)argmax[c];
             }
           }
         }
@@ -200,35 +268,62 @@ struct MaxPooling {
                               Outputs<T, InputSize, batch_size>& errors,
                               Parameters<T, InputSize>&,
                               Inputs<T, InputSize, batch_size>& prev_errors) {
-      using __Inputs = _Inputs<T, InputSize, batch_size>;
-      using __Outputs = _Outputs<T, InputSize, batch_size>;
-      using __Hidden = _Outputs<HiddenValue, InputSize, batch_size>;
+      using OutSize = OutputSize<InputSize>;
+      constexpr size_t height = InputSize::height;
+      constexpr size_t width = InputSize::width;
+      constexpr size_t out_map = OutSize::height * OutSize::width;
 
-      using __InputMap = _InputMap<T, InputSize>;
-      using __OutputMap = _OutputMap<T, InputSize>;
-      using __HiddenMap = _OutputMap<HiddenValue, InputSize>;
+      for (size_t n = 0; n < batch_size; n++) {
+        for (size_t m = 0; m < OutSize::maps_no; m++) {
+          T* const prev_map = prev_errors[n].data() + m * height * width;
+          const T* const errors_map = errors[n].data() + m * out_map;
+          const Argmax* const hidden_map = hidden[n].data() + m * out_map;
+          if (_tiles)
+            _scatter(errors_map, hidden_map, prev_map);
+          else
+            _accumulate(errors_map, hidden_map, prev_map);
+        }
+      }
+    }
 
-      __Inputs& _prev_errors = *reinterpret_cast<__Inputs*>(&prev_errors);
-      const __Outputs& _errors = *reinterpret_cast<const __Outputs*>(&errors);
-      const __Hidden& _hidden = *reinterpret_cast<const __Hidden*>(&hidden);
+    /* The rows of a band of windows are cleared while they are in the
+     * cache, right before the errors are written at the maxima */
+    static void _scatter(const T* errors_map, const Argmax* hidden_map,
+                         T* prev_map) {
+      using OutSize = OutputSize<InputSize>;
+      constexpr size_t width = InputSize::width;
+      constexpr size_t band = pool_height * width;
+
+      for (size_t r = 0; r < OutSize::height; r++) {
+        T* const prev_band = prev_map + r * band;
+        for (size_t x = 0; x < band; x++)
+          prev_band[x] = (T)0;
+        const T* const errors_row = errors_map + r * OutSize::width;
+        const Argmax* const hidden_row = hidden_map + r * OutSize::width;
+        for (size_t c = 0; c < OutSize::width; c++) {
+          const size_t k = hidden_row[c];
+          prev_band[(k / pool_width) * width + c * pool_width +
+                    k % pool_width] = errors_row[c];
+        }
+      }
+      for (size_t x = OutSize::height * band; x < InputSize::height * width;
+           x++)
+        prev_map[x] = (T)0;
+    }
 
-      for (size_t n = 0; n < batch_size; n++) {
-        std::fill(prev_errors[n].begin(), prev_errors[n].end(), (T)0);
-
-        for (size_t m = 0; m < OutputSize<InputSize>::maps_no; m++) {
-          __InputMap& prev_errors_map =
-            *reinterpret_cast<__InputMap*>(_prev_errors[n][m].data());
-          const __OutputMap& errors_map =
-            *reinterpret_cast<const __OutputMap*>(_errors[n][m].data());
-          const __HiddenMap& hidden_map =
-            *reinterpret_cast<const __HiddenMap*>(_hidden[n][m].data());
-
-          for (size_t r = 0; r < OutputSize<InputSize>::height; r++) {
-            for (size_t c = 0; c < OutputSize<InputSize>::width; c++) {
-              prev_errors_map[hidden_map[r][c].first][hidden_map[r][c].second]=
-                errors_map[r][c];
-            }
-          }
+    static void _accumulate(const T* errors_map, const Argmax* hidden_map,
+                            T* prev_map) {
+      using OutSize = OutputSize<InputSize>;
+      constexpr size_t width = InputSize::width;
+
+      for (size_t x = 0; x < InputSize::height * width; x++)
+        prev_map[x] = (T)0;
+      for (size_t r = 0; r < OutSize::height; r++) {
+        for (size_t c = 0; c < OutSize::width; c++) {
+          const size_t k = hidden_map[r * OutSize::width + c];
+          const size_t i = r * stride_height + k / pool_width;
+          const size_t j = c * stride_width + k % pool_width;
+          prev_map[i * width + j] += errors_map[r * OutSize::width + c];
         }
       }
     }
@@ -0,0 +1,77 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef ADAM_H
+#define ADAM_H
+
+#include <cstddef>
+#include <cmath>
+
+/* Adam (Kingma and Ba, 2015), with first and second moments m and v:
+ *
+ *     m = beta1 * m + (1 - beta1) * g
+ *     v = beta2 * v + (1 - beta2) * g^2
+ *     w -= learning_rate * m' / (sqrt(v') + epsilon)
+ *
+ * where m' = m / (1 - beta1^t) and v' = v / (1 - beta2^t). Both bias
+ * corrections are folded into two scalars per step,
+ *
+ *     w -= alpha_t * m / (sqrt(v) + epsilon_t)
+ *     alpha_t = learning_rate * sqrt(1 - beta2^t) / (1 - beta1^t)
+ *     epsilon_t = epsilon * sqrt(1 - beta2^t)
+ *
+ * which is the same update with no per-parameter correction.
+ */
+
+template<typename T>
+struct Adam {
+  static constexpr size_t states_no = 2ul;
+
+  explicit Adam(T learning_rate = (T)0.001, T beta1 = (T)0.9,
+                T beta2 = (T)0.999, T epsilon = (T)1e-8)
+      : learning_rate(learning_rate), beta1(beta1), beta2(beta2),
+        epsilon(epsilon), t(0ul), beta1_t(1), beta2_t(1), alpha_t(0),
+        epsilon_t(0) { }
+
+  void next_step() {
+    t++;
+    beta1_t *= beta1;
+    beta2_t *= beta2;
+    const T correction = std::sqrt((T)1 - beta2_t);
+    alpha_t = learning_rate * correction / ((T)1 - beta1_t);
+    epsilon_t = epsilon * correction;
+  }
+
+  template<typename V>
+  inline void step(T* w, const T* g, T* const* s, size_t i) const {
+    const typename V::Type g_i = V::loadu(g + i);
+    const typename V::Type m =
+      V::fma(V::broadcast(beta1), V::loadu(s[0] + i),
+             V::mul(V::broadcast((T)1 - beta1), g_i));
+    const typename V::Type v =
+      V::fma(V::broadcast(beta2), V::loadu(s[1] + i),
+             V::mul(V::broadcast((T)1 - beta2), V::mul(g_i, g_i)));
+    V::storeu(s[0] + i, m);
+    V::storeu(s[1] + i, v);
+    const typename V::Type denominator =
+      V::add(V::sqrt(v), V::broadcast(epsilon_t));
+    V::storeu(w + i, V::sub(V::loadu(w + i),
+                            V::div(V::mul(V::broadcast(alpha_t), m),
+                                   denominator)));
+  }
+
+  T learning_rate;
+  T beta1;
+  T beta2;
+  T epsilon;
+
+  /* Number of updates so far, beta1^t, beta2^t */
+  size_t t;
+  T beta1_t;
+  T beta2_t;
+
+ private:
+  T alpha_t;
+  T epsilon_t;
+};
+
+#endif
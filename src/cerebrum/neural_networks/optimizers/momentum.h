@@ -0,0 +1,49 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef MOMENTUM_H
+#define MOMENTUM_H
+
+#include <cstddef>
+
+/* Classical and Nesterov momentum, with a velocity v per parameter:
+ *
+ *     v = momentum * v - learning_rate * g
+ *     w += v                                         (Momentum)
+ *     w += momentum * v - learning_rate * g          (NesterovMomentum)
+ *
+ * The Nesterov update is the form of Bengio et al. ("Advances in optimizing
+ * recurrent networks", 2013), which needs only the gradient at w.
+ */
+
+template<typename T, bool nesterov>
+struct _Momentum {
+  static constexpr size_t states_no = 1ul;
+
+  explicit _Momentum(T learning_rate = (T)0.01, T momentum = (T)0.9)
+      : learning_rate(learning_rate), momentum(momentum) { }
+
+  void next_step() { }
+
+  template<typename V>
+  inline void step(T* w, const T* g, T* const* s, size_t i) const {
+    const typename V::Type lr_g =
+      V::mul(V::broadcast(learning_rate), V::loadu(g + i));
+    const typename V::Type mu = V::broadcast(momentum);
+    const typename V::Type v = V::sub(V::mul(mu, V::loadu(s[0] + i)), lr_g);
+    V::storeu(s[0] + i, v);
+    V::storeu(w + i, nesterov ?
+              V::add(V::loadu(w + i), V::sub(V::mul(mu, v), lr_g)) :
+              V::add(V::loadu(w + i), v));
+  }
+
+  T learning_rate;
+  T momentum;
+};
+
+template<typename T>
+using Momentum = _Momentum<T, false>;
+
+template<typename T>
+using NesterovMomentum = _Momentum<T, true>;
+
+#endif
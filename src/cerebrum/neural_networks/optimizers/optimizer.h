@@ -0,0 +1,92 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "cerebrum/simd.h"
+#include "cerebrum/parallel/thread_pool.h"
+
+/* _Optimizer<T, Rule, Parameters> applies an update rule (SGD, Momentum,
+ * NesterovMomentum, Adam, RMSProp) to all the parameters of a network.
+ *
+ * The state of the rule (velocities, moments) is kept in states_no more
+ * Parameters objects, so every state value sits at the same offset as the
+ * parameter it belongs to. An update is one pass over the flat arenas of
+ * parameters, gradients and states, cut into chunks that run on a
+ * ThreadPool; inside a chunk the rule works on whole Vector<T> registers
+ * and on ScalarVector<T> for the tail.
+ *
+ * A rule provides:
+ *
+ *   states_no                     number of state values per parameter
+ *   next_step()                   called once before every update (e.g.
+ *                                 for bias corrections)
+ *   step<V>(w, g, s, i)           updates w[i .. i + V::length) from the
+ *                                 gradients g and the states s[0 ..
+ *                                 states_no)
+ *
+ * Gradients are those of GradientComputation: sums over the batch of the
+ * derivatives of the error to be minimized.
+ */
+
+/* w[0 .. n) and the states s[k][0 .. n) after one step of rule */
+template<typename T, typename Rule>
+inline void _apply_rule(const Rule& rule, T* w, const T* g, T* const* s,
+                        size_t n) {
+  using V = Vector<T>;
+  using S = ScalarVector<T>;
+  size_t i = 0ul;
+  for (; i + V::length <= n; i += V::length)
+    rule.template step<V>(w, g, s, i);
+  for (; i < n; i++)
+    rule.template step<S>(w, g, s, i);
+}
+
+template<typename T, typename Rule, typename Parameters>
+struct _Optimizer {
+  static constexpr size_t states_no = Rule::states_no;
+
+  explicit
+  _Optimizer(const Rule& rule = Rule(),
+             ThreadPool& pool = default_thread_pool())
+      : rule(rule), pool(pool), states(states_no) {
+    for (size_t s = 0; s < states_no; s++)
+      states[s].reset(new Parameters((T)0));
+  }
+
+  /* About four chunks per thread, never split below a few cache lines */
+  void update(Parameters& parameters, const Parameters& gradient) {
+    const size_t chunk = std::max<size_t>(
+      1024ul, Parameters::size() / (4ul * pool.size()) + 1ul);
+    const size_t chunks_no = (Parameters::size() + chunk - 1ul) / chunk;
+    rule.next_step();
+    pool.run(chunks_no, [&](size_t c) {
+        const size_t begin = c * chunk;
+        const size_t end = std::min(Parameters::size(), begin + chunk);
+        std::array<T*, states_no> s;
+        for (size_t k = 0; k < states_no; k++)
+          s[k] = states[k]->data() + begin;
+        _apply_rule(rule, parameters.data() + begin, gradient.data() + begin,
+                    s.data(), end - begin);
+      });
+  }
+
+  /* Velocities or moments, with the layout of the parameters */
+  Parameters& state(size_t s) { return *states[s]; }
+  const Parameters& state(size_t s) const { return *states[s]; }
+
+  /* Hyperparameters may be changed between updates */
+  Rule rule;
+
+ private:
+  ThreadPool& pool;
+  std::vector<std::unique_ptr<Parameters>> states;
+};
+
+#endif
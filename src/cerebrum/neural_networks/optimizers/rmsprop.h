@@ -0,0 +1,44 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef RMSPROP_H
+#define RMSPROP_H
+
+#include <cstddef>
+
+/* RMSProp (Tieleman and Hinton, 2012), with a running mean r of the
+ * squared gradients:
+ *
+ *     r = decay * r + (1 - decay) * g^2
+ *     w -= learning_rate * g / (sqrt(r) + epsilon)
+ */
+
+template<typename T>
+struct RMSProp {
+  static constexpr size_t states_no = 1ul;
+
+  explicit RMSProp(T learning_rate = (T)0.001, T decay = (T)0.9,
+                   T epsilon = (T)1e-8)
+      : learning_rate(learning_rate), decay(decay), epsilon(epsilon) { }
+
+  void next_step() { }
+
+  template<typename V>
+  inline void step(T* w, const T* g, T* const* s, size_t i) const {
+    const typename V::Type g_i = V::loadu(g + i);
+    const typename V::Type r =
+      V::fma(V::broadcast(decay), V::loadu(s[0] + i),
+             V::mul(V::broadcast((T)1 - decay), V::mul(g_i, g_i)));
+    V::storeu(s[0] + i, r);
+    const typename V::Type denominator =
+      V::add(V::sqrt(r), V::broadcast(epsilon));
+    V::storeu(w + i, V::sub(V::loadu(w + i),
+                            V::div(V::mul(V::broadcast(learning_rate), g_i),
+                                   denominator)));
+  }
+
+  T learning_rate;
+  T decay;
+  T epsilon;
+};
+
+#endif
@@ -0,0 +1,27 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef SGD_H
+#define SGD_H
+
+#include <cstddef>
+
+/* w -= learning_rate * g */
+
+template<typename T>
+struct SGD {
+  static constexpr size_t states_no = 0ul;
+
+  explicit SGD(T learning_rate = (T)0.01) : learning_rate(learning_rate) { }
+
+  void next_step() { }
+
+  template<typename V>
+  inline void step(T* w, const T* g, T* const*, size_t i) const {
+    V::storeu(w + i, V::fnma(V::broadcast(learning_rate), V::loadu(g + i),
+                             V::loadu(w + i)));
+  }
+
+  T learning_rate;
+};
+
+#endif
@@ -0,0 +1,172 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef PARALLEL_COMPUTATION_H
+#define PARALLEL_COMPUTATION_H
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "cerebrum/size.h"
+#include "cerebrum/parallel/thread_pool.h"
+#include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/inference_computation.h"
+#include "cerebrum/neural_networks/gradient_computation.h"
+
+/* Batch-parallel execution: a batch is cut into slices_no slices of
+ * consecutive examples and every slice runs the whole network (GEMMs,
+ * transfer functions, dropout, pooling and the error function) on its own
+ * thread, with its own activations. Gradients are computed per slice and
+ * summed into the caller's Parameters at the end by all threads, each one
+ * reducing a contiguous chunk of the flat parameter arena.
+ *
+ * Every slice is allocated by the thread that is most likely to use it, so
+ * on NUMA machines its activations start on the right node. Forward slices
+ * are inference computations, with two activation buffers each.
+ */
+
+template<typename T, size_t batch_size, size_t slices_no,
+         typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+struct _ParallelForwardComputation {
+  static_assert(slices_no > 0ul && batch_size % slices_no == 0ul,
+                "batch_size must be a multiple of slices_no");
+
+  static constexpr size_t slice_size = batch_size / slices_no;
+
+  using Slice = _InferenceComputation<T, slice_size, ErrorFunction, computes,
+                                      InputSize, Layers...>;
+
+  using InputRow = typename Slice::Inputs::value_type;
+  using OutputRow = typename Slice::NetOutputs::value_type;
+  using OutputSize = Size<std::tuple_size<OutputRow>::value>;
+
+  using Inputs = std::array<InputRow, batch_size>;
+  using NetOutputs = std::array<OutputRow, batch_size>;
+  using Parameters = _Parameters<T, InputSize, Layers...>;
+
+  explicit
+  _ParallelForwardComputation(ThreadPool& pool = default_thread_pool())
+      : pool(pool), slices(slices_no) {
+    pool.run(slices_no, [this](size_t s) { slices[s].reset(new Slice); });
+  }
+
+  const NetOutputs&
+  forward(const Inputs& inputs, const Parameters& parameters) {
+    pool.run(slices_no, [&](size_t s) {
+        const typename Slice::NetOutputs& slice_outputs =
+          slices[s]->forward(
+            *reinterpret_cast<const typename Slice::Inputs*>(
+              &inputs[s * slice_size]),
+            parameters);
+        std::copy(slice_outputs.begin(), slice_outputs.end(),
+                  y.begin() + s * slice_size);
+      });
+    return y;
+  }
+
+  /* Some error functions (e.g. RMSE) do not decompose over examples, so the
+   * error is computed on the whole batch */
+  T error(const NetOutputs& labels) {
+    return ErrorFunction::template error<OutputSize, batch_size>(y, labels);
+  }
+
+  ThreadPool& pool;
+  std::vector<std::unique_ptr<Slice>> slices;
+  NetOutputs y;
+};
+
+template<typename T, size_t batch_size, size_t slices_no,
+         typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+struct _ParallelGradientComputation {
+  static_assert(slices_no > 0ul && batch_size % slices_no == 0ul,
+                "batch_size must be a multiple of slices_no");
+
+  static constexpr size_t slice_size = batch_size / slices_no;
+
+  using Slice = _GradientComputation<T, slice_size, ErrorFunction, computes,
+                                     InputSize, Layers...>;
+
+  using InputRow = typename Slice::Inputs::value_type;
+  using OutputRow = typename Slice::NetOutputs::value_type;
+
+  using Inputs = std::array<InputRow, batch_size>;
+  using NetOutputs = std::array<OutputRow, batch_size>;
+  using Parameters = _Parameters<T, InputSize, Layers...>;
+
+  using SliceInputs = typename Slice::Inputs;
+  using SliceNetOutputs = typename Slice::NetOutputs;
+
+  explicit
+  _ParallelGradientComputation(ThreadPool& pool = default_thread_pool())
+      : pool(pool), slices(slices_no), gradients(slices_no),
+        errors(slices_no) {
+    pool.run(slices_no, [this](size_t s) {
+        slices[s].reset(new Slice);
+        gradients[s].reset(new Parameters((T)0));
+      });
+  }
+
+  T computeGradient(const Inputs& inputs, const Parameters& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient) {
+    pool.run(slices_no, [&](size_t s) {
+        errors[s] = slices[s]->computeGradient(
+          *reinterpret_cast<const SliceInputs*>(&inputs[s * slice_size]),
+          parameters,
+          *reinterpret_cast<const SliceNetOutputs*>(&labels[s*slice_size]),
+          *reinterpret_cast<SliceInputs*>(&prev_errors[s * slice_size]),
+          *gradients[s]);
+      });
+    return reduce(gradient);
+  }
+
+  T computeGradient(const Inputs& inputs, const Parameters& parameters,
+                    const NetOutputs& labels, Parameters& gradient) {
+    pool.run(slices_no, [&](size_t s) {
+        errors[s] = slices[s]->computeGradient(
+          *reinterpret_cast<const SliceInputs*>(&inputs[s * slice_size]),
+          parameters,
+          *reinterpret_cast<const SliceNetOutputs*>(&labels[s*slice_size]),
+          *gradients[s]);
+      });
+    return reduce(gradient);
+  }
+
+ private:
+  /* The flat gradient arenas are summed in chunks: about four per thread,
+   * never split below a few cache lines */
+  T reduce(Parameters& gradient) {
+    const size_t chunk = std::max<size_t>(
+      1024ul, Parameters::size() / (4ul * pool.size()) + 1ul);
+    const size_t chunks_no = (Parameters::size() + chunk - 1ul) / chunk;
+    pool.run(chunks_no, [&](size_t c) {
+        const size_t begin = c * chunk;
+        const size_t end = std::min(Parameters::size(), begin + chunk);
+        T* const out = gradient.data();
+        const T* const first = gradients[0]->data();
+        std::copy(first + begin, first + end, out + begin);
+        for (size_t s = 1; s < slices_no; s++) {
+          const T* const in = gradients[s]->data();
+          for (size_t i = begin; i < end; i++)
+            out[i] += in[i];
+        }
+      });
+
+    T err = (T)0;
+    for (size_t s = 0; s < slices_no; s++)
+      err += errors[s];
+    return err;
+  }
+
+  ThreadPool& pool;
+  std::vector<std::unique_ptr<Slice>> slices;
+  std::vector<std::unique_ptr<Parameters>> gradients;
+  std::vector<T> errors;
+};
+
+#endif
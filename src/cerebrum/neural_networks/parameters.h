@@ -4,84 +4,171 @@
 #define PARAMETERS_H
 
 #include <cstddef>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <random>
 
-template<typename T, typename InputSize, typename... Other>
-struct _Parameters;
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/half.h"
+
+/* All the parameters of a network live in one arena aligned to a cache
+ * line. Every layer starts on a cache line of its own; the gaps between
+ * layers are kept at zero.
+ *
+ * _ParameterLayout gives, at compile time, where each layer starts and how
+ * many values it has. _Parameters owns the arena and is also a chain of
+ * typed views over it: `values` is the Parameters array of the current
+ * layer (what the layers' forward and backpropagate take) and `next` views
+ * the rest of the network. Whole-model operations work on data() and
+ * size() instead.
+ *
+ * The value type is usually the network's T, but the same parameters can
+ * be stored as Half or BFloat16 (see half.h) for computations that only
+ * read them: convert() copies a float master arena into such a copy.
+ */
+
+template<typename T, typename InputSize, typename... Layers>
+struct _ParameterLayout;
+
+template<typename T, typename InputSize>
+struct _ParameterLayout<T, InputSize> {
+  static constexpr size_t layers_no = 0ul;
+  static constexpr size_t size = 0ul;
+
+  static constexpr size_t layer_offset(size_t) { return 0ul; }
+  static constexpr size_t layer_size(size_t) { return 0ul; }
+};
+
+template<typename T, typename InputSize, typename CrtLayer, typename... Other>
+struct _ParameterLayout<T, InputSize, CrtLayer, Other...> {
+  using Next =
+    _ParameterLayout<T, typename CrtLayer::template OutputSize<InputSize>,
+                     Other...>;
 
-template<typename T, typename InputSize, typename LastLayer>
-struct _Parameters<T, InputSize, LastLayer> {
-  typename LastLayer::template Parameters<T, InputSize> values;
-  bool next;
+  /* Values per cache line */
+  static constexpr size_t line =
+    sizeof(T) < cache_line_size ? cache_line_size / sizeof(T) : 1ul;
 
-  _Parameters() {
-    LastLayer::template init_parameters<T, InputSize>(values);
-  }
+  static constexpr size_t crt_size =
+    CrtLayer::template parameters_array_size<InputSize>();
+  static constexpr size_t crt_stride = (crt_size + line - 1ul) / line * line;
+
+  static constexpr size_t layers_no = 1ul + Next::layers_no;
+  static constexpr size_t size = crt_stride + Next::size;
 
-  _Parameters(T value) {
-    for (size_t i = 0;
-         i < LastLayer::template parameters_array_size<InputSize>();
-         i++)
-      values[i] = value;
+  static constexpr size_t layer_offset(size_t layer) {
+    return layer == 0ul ? 0ul : crt_stride + Next::layer_offset(layer - 1ul);
   }
 
-  _Parameters(T min, T max) {
-    std::random_device rd { };
-    std::default_random_engine e {rd()};
-    std::uniform_real_distribution<T> next_parameter(min, max);
-    for (size_t i = 0;
-         i < LastLayer::template parameters_array_size<InputSize>();
-         i++)
-      values[i] = next_parameter(e);
+  static constexpr size_t layer_size(size_t layer) {
+    return layer == 0ul ? crt_size : Next::layer_size(layer - 1ul);
   }
+};
+
+template<typename T, typename InputSize, typename... Other>
+struct _Parameters;
+
+template<typename Parameters>
+class _MappedParameters;
+
+template<typename From, typename To, typename InputSize, typename... Layers>
+void convert(const _Parameters<From, InputSize, Layers...>& from,
+             _Parameters<To, InputSize, Layers...>& to);
+
+struct _ParametersView { };
+
+/* Past the last layer: nothing to hold */
+
+template<typename T, typename InputSize>
+struct _Parameters<T, InputSize> {
+  static constexpr size_t layers_no = 0ul;
 
   friend std::ostream&
-  operator<<(std::ostream& s, const _Parameters<T, InputSize, LastLayer>&){
-    s << std::endl;
+  operator<<(std::ostream& s, const _Parameters<T, InputSize>&) {
     return s;
   }
 
+ private:
+  template<typename, typename, typename...> friend struct _Parameters;
+
+  _Parameters(T*, _ParametersView) { }
+
+  void _init() { }
+  void _fill(T) { }
+  void _uniform(T, T) { }
 };
 
 template<typename T, typename InputSize, typename CrtLayer, typename... Other>
 struct _Parameters<T, InputSize, CrtLayer, Other...> {
+  using DataType = T;
+  using Layout = _ParameterLayout<T, InputSize, CrtLayer, Other...>;
   using NextParameters =
     _Parameters<T, typename CrtLayer::template OutputSize<InputSize>,
                 Other...>;
   using CrtParameters = typename CrtLayer::template Parameters<T, InputSize>;
- 
-  CrtParameters values;
-  NextParameters next;
 
   static constexpr size_t parameters_array_size =
     CrtLayer::template parameters_array_size<InputSize>();
   static constexpr size_t parameters_no =
     CrtLayer::template parameters_no<InputSize>();
+  static constexpr size_t layers_no = Layout::layers_no;
+
+ private:
+  AlignedBuffer<T> arena_;
+  T* data_;
+
+ public:
+  CrtParameters& values;
+  NextParameters next;
 
   /* Tudor:
    * Constructors: default / default value / uniform from interval [min, max]
    */
 
-  _Parameters() {
-    CrtLayer::template init_parameters<T, InputSize>(values);
+  _Parameters() : _Parameters(_Arena()) { _init(); }
+
+  _Parameters(T value) : _Parameters(_Arena()) { _fill(value); }
+
+  _Parameters(T min, T max) : _Parameters(_Arena()) { _uniform(min, max); }
+
+  _Parameters(const _Parameters& other) : _Parameters(_Arena()) {
+    *this = other;
   }
 
-  _Parameters(T value) : next {value} {
-    for (size_t i = 0;
-         i < CrtLayer::template parameters_array_size<InputSize>();
-         i++)
-      values[i] = value;
+  /* The same parameters in another value type, rounded to nearest */
+  template<typename U>
+  explicit _Parameters(const _Parameters<U, InputSize, CrtLayer, Other...>&
+                       other) : _Parameters(_Arena()) {
+    convert(other, *this);
   }
 
-  _Parameters(T min, T max) : next {min, max} {
-    std::random_device rd { };
-    std::default_random_engine e {rd()};
-    std::uniform_real_distribution<T> next_parameter(min, max);
-    for (size_t i = 0;
-         i < CrtLayer::template parameters_array_size<InputSize>();
-         i++)
-      values[i] = next_parameter(e);
+  _Parameters& operator=(const _Parameters& other) {
+    if (this != &other)
+      std::memcpy(data_, other.data_, size() * sizeof(T));
+    return *this;
+  }
+
+  /* The whole arena, from this layer on (gaps included) */
+
+  static constexpr size_t size() { return Layout::size; }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+
+  /* Raw access to the parameters of one layer (layers are numbered from 0)
+   */
+
+  T* layer_data(size_t layer) {
+    return data_ + Layout::layer_offset(layer);
+  }
+
+  const T* layer_data(size_t layer) const {
+    return data_ + Layout::layer_offset(layer);
+  }
+
+  size_t layer_size(size_t layer) const {
+    return Layout::layer_size(layer);
   }
 
   friend std::ostream&
@@ -93,6 +180,61 @@ struct _Parameters<T, InputSize, CrtLayer, Other...> {
     s << std::endl << "-----" << std::endl << p.next;
     return s;
   }
+
+ private:
+  template<typename, typename, typename...> friend struct _Parameters;
+  friend class _MappedParameters<_Parameters>;
+
+  /* A zeroed arena, at least one cache line long so that views of layers
+   * without parameters never point to null */
+  struct _Arena { };
+
+  static constexpr size_t _arena_size() {
+    return Layout::size > Layout::line ? Layout::size : Layout::line;
+  }
+
+  explicit _Parameters(_Arena)
+      : arena_(_arena_size()),
+        data_(arena_.data()),
+        values(*reinterpret_cast<CrtParameters*>(data_)),
+        next(data_ + Layout::crt_stride, _ParametersView()) {
+    std::fill_n(data_, _arena_size(), (T)0);
+  }
+
+  /* View of the arena of an enclosing _Parameters */
+  _Parameters(T* data, _ParametersView)
+      : data_(data),
+        values(*reinterpret_cast<CrtParameters*>(data)),
+        next(data + Layout::crt_stride, _ParametersView()) { }
+
+  void _init() {
+    CrtLayer::template init_parameters<T, InputSize>(values);
+    next._init();
+  }
+
+  void _fill(T value) {
+    std::fill_n(data_, parameters_array_size, value);
+    next._fill(value);
+  }
+
+  void _uniform(T min, T max) {
+    std::random_device rd { };
+    std::default_random_engine e {rd()};
+    std::uniform_real_distribution<T> next_parameter(min, max);
+    for (size_t i = 0; i < parameters_array_size; i++)
+      data_[i] = next_parameter(e);
+    next._uniform(min, max);
+  }
 };
 
+/* Copies parameters into an arena of another value type, layer by layer
+ * (the two arenas have different gaps) */
+
+template<typename From, typename To, typename InputSize, typename... Layers>
+void convert(const _Parameters<From, InputSize, Layers...>& from,
+             _Parameters<To, InputSize, Layers...>& to) {
+  for (size_t l = 0; l < from.layers_no; l++)
+    convert(from.layer_data(l), to.layer_data(l), from.layer_size(l));
+}
+
 #endif
@@ -0,0 +1,386 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef PIPELINE_COMPUTATION_H
+#define PIPELINE_COMPUTATION_H
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "cerebrum/parallel/thread_pool.h"
+#include "cerebrum/neural_networks/parameters.h"
+
+/* Pipeline-parallel gradients: the layers are cut into stages_no stages of
+ * consecutive layers, each stage runs on its own thread, and the batch is
+ * cut into micro_batches_no micro-batches that flow through the stages. The
+ * forward pass of a stage on micro-batch m + 1 overlaps the work of the
+ * next stage on micro-batch m, so networks whose layers are too small to be
+ * split between threads still keep several cores busy.
+ *
+ * Every stage follows the one-forward-one-backward schedule (PipeDream-
+ * Flush): stage s runs the forward pass of stages_no - 1 - s micro-batches,
+ * then alternates one forward and one backward pass, and ends with the
+ * backward passes left. Each micro-batch keeps its own activations, as in
+ * GPipe. Gradients are accumulated over the micro-batches: the first one
+ * backpropagates straight into the caller's gradient, the others into a
+ * scratch gradient that the stage adds in, layer by layer. No two stages
+ * touch the same layer.
+ *
+ * Unless the split is given, the first call runs the micro-batches one
+ * after the other on the calling thread and times every layer; the layers
+ * are then split into the stages_no ranges with the smallest largest time.
+ *
+ * The stages run on a ThreadPool of stages_no threads owned by the
+ * computation: a stage waits for its neighbours, so all of them must run at
+ * the same time.
+ */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename... OtherLayers>
+struct _MicroBatch;
+
+/* -------------------- Activations of one micro-batch -------------------- */
+
+template<typename T, size_t batch_size, typename ErrorFunction,
+         typename InputSize>
+struct _MicroBatch<T, batch_size, ErrorFunction, true, InputSize> {
+
+  using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  NetOutputs y;
+
+  void forward(size_t, const NetOutputs&, const _Parameters<T, InputSize>&) { }
+
+  void backward(size_t, const NetOutputs&, const _Parameters<T, InputSize>&,
+                NetOutputs&, _Parameters<T, InputSize>&) { }
+
+  T loss(const NetOutputs& outputs, const NetOutputs& labels,
+         NetOutputs& prev_errors) {
+    return ErrorFunction::template
+      f_dError<InputSize, batch_size>(outputs, labels, y, prev_errors);
+  }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction,
+         typename InputSize>
+struct _MicroBatch<T, batch_size, ErrorFunction, false, InputSize> {
+
+  using NetOutputs = std::array<std::array<T, InputSize::length>, batch_size>;
+
+  void forward(size_t, const NetOutputs&, const _Parameters<T, InputSize>&) { }
+
+  void backward(size_t, const NetOutputs&, const _Parameters<T, InputSize>&,
+                NetOutputs&, _Parameters<T, InputSize>&) { }
+
+  T loss(const NetOutputs& outputs, const NetOutputs& labels,
+         NetOutputs& prev_errors) {
+    ErrorFunction::template
+      dError<InputSize, batch_size>(outputs, labels, prev_errors);
+    return ErrorFunction::template
+      error<InputSize, batch_size>(outputs, labels);
+  }
+};
+
+/* Like _GradientComputation, but one layer at a time: layer counts from
+ * this layer on */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename CrtLayer, typename... Others>
+struct _MicroBatch<T, batch_size, ErrorFunction, computes,
+                   InputSize, CrtLayer, Others...> {
+
+  using Inputs  = typename CrtLayer::template Inputs<T, InputSize, batch_size>;
+  using Hidden  = typename CrtLayer::template Hidden<T, InputSize, batch_size>;
+  using Outputs = typename CrtLayer::template Outputs<T, InputSize, batch_size>;
+
+  using OutputSize = typename CrtLayer::template OutputSize<InputSize>;
+  using NextMicroBatch =
+    _MicroBatch<T, batch_size, ErrorFunction, computes, OutputSize,
+                Others...>;
+
+  using NetOutputs = typename NextMicroBatch::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, CrtLayer, Others...>;
+
+  Hidden hidden;
+  Outputs outputs;
+  Outputs errors;
+  NextMicroBatch next;
+
+  void forward(size_t layer, const Inputs& inputs,
+               const Parameters& parameters) {
+    if (layer == 0ul)
+      CrtLayer::template
+        forward<T, InputSize, batch_size, true>(inputs, parameters.values,
+                                                hidden, outputs);
+    else
+      next.forward(layer - 1ul, outputs, parameters.next);
+  }
+
+  void backward(size_t layer, const Inputs& inputs,
+                const Parameters& parameters, Inputs& prev_errors,
+                Parameters& gradient) {
+    if (layer == 0ul)
+      CrtLayer::template
+        backpropagate<T, InputSize, batch_size>(inputs, parameters.values,
+                                                hidden, outputs, errors,
+                                                gradient.values, prev_errors);
+    else
+      next.backward(layer - 1ul, outputs, parameters.next, errors,
+                    gradient.next);
+  }
+
+  /* The error of the micro-batch and its derivatives, once the forward
+   * pass has reached the last layer */
+  T loss(const NetOutputs& labels) {
+    return next.loss(outputs, labels, errors);
+  }
+
+  T loss(const Inputs&, const NetOutputs& labels, Inputs&) {
+    return loss(labels);
+  }
+};
+
+/* -------------------- The pipeline -------------------- */
+
+template<typename T, size_t batch_size, size_t micro_batches_no,
+         size_t stages_no, typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+struct _PipelineGradientComputation {
+  static_assert(micro_batches_no > 0ul &&
+                batch_size % micro_batches_no == 0ul,
+                "batch_size must be a multiple of micro_batches_no");
+  static_assert(stages_no > 0ul && stages_no <= sizeof...(Layers),
+                "every stage needs at least one layer");
+
+  static constexpr size_t layers_no = sizeof...(Layers);
+  static constexpr size_t micro_batch_size = batch_size / micro_batches_no;
+
+  using MicroBatch = _MicroBatch<T, micro_batch_size, ErrorFunction,
+                                 computes, InputSize, Layers...>;
+
+  using InputRow = typename MicroBatch::Inputs::value_type;
+  using OutputRow = typename MicroBatch::NetOutputs::value_type;
+
+  using Inputs = std::array<InputRow, batch_size>;
+  using NetOutputs = std::array<OutputRow, batch_size>;
+  using Parameters = _Parameters<T, InputSize, Layers...>;
+
+  using MicroInputs = typename MicroBatch::Inputs;
+  using MicroNetOutputs = typename MicroBatch::NetOutputs;
+
+  /* first_layers[s] is the first layer of stage s; if empty, the stages are
+   * balanced by the first call */
+  explicit
+  _PipelineGradientComputation(std::vector<size_t> first_layers = {})
+      : pool(stages_no), micro_batches(micro_batches_no),
+        scratch(new Parameters((T)0)), input_errors(new MicroInputs),
+        errors(micro_batches_no), forwarded(stages_no),
+        backwarded(stages_no) {
+    for (size_t m = 0; m < micro_batches_no; m++)
+      micro_batches[m].reset(new MicroBatch);
+    if (!first_layers.empty())
+      set_stages(first_layers);
+  }
+
+  _PipelineGradientComputation(const _PipelineGradientComputation&) = delete;
+  _PipelineGradientComputation&
+  operator=(const _PipelineGradientComputation&) = delete;
+
+  T computeGradient(const Inputs& inputs, const Parameters& parameters,
+                    const NetOutputs& labels, Inputs& prev_errors,
+                    Parameters& gradient) {
+    return _compute(inputs, parameters, labels, &prev_errors, gradient);
+  }
+
+  T computeGradient(const Inputs& inputs, const Parameters& parameters,
+                    const NetOutputs& labels, Parameters& gradient) {
+    return _compute(inputs, parameters, labels, nullptr, gradient);
+  }
+
+  /* First layer of every stage (empty before the stages are balanced) */
+  const std::vector<size_t>& stages() const { return first_layer; }
+
+  void set_stages(const std::vector<size_t>& first_layers) {
+    if (first_layers.size() != stages_no || first_layers[0] != 0ul)
+      throw std::invalid_argument("one first layer per stage, from 0");
+    for (size_t s = 1; s < stages_no; s++)
+      if (first_layers[s] <= first_layers[s - 1] ||
+          first_layers[s] >= layers_no)
+        throw std::invalid_argument("stages must be non-empty and ordered");
+    first_layer = first_layers;
+  }
+
+ private:
+  T _compute(const Inputs& inputs, const Parameters& parameters,
+             const NetOutputs& labels, Inputs* prev_errors,
+             Parameters& gradient) {
+    const Batch batch = {&inputs, &parameters, &labels, prev_errors,
+                         &gradient};
+    if (first_layer.empty()) {
+      _balance(batch);
+    } else {
+      std::fill(forwarded.begin(), forwarded.end(), 0ul);
+      std::fill(backwarded.begin(), backwarded.end(), 0ul);
+      pool.run(stages_no, [this, &batch](size_t s) { _stage(s, batch); });
+    }
+    T err = (T)0;
+    for (size_t m = 0; m < micro_batches_no; m++)
+      err += errors[m];
+    return err;
+  }
+
+  struct Batch {
+    const Inputs* inputs;
+    const Parameters* parameters;
+    const NetOutputs* labels;
+    Inputs* prev_errors;
+    Parameters* gradient;
+
+    const MicroInputs& micro_inputs(size_t m) const {
+      return *reinterpret_cast<const MicroInputs*>(
+        &(*inputs)[m * micro_batch_size]);
+    }
+
+    const MicroNetOutputs& micro_labels(size_t m) const {
+      return *reinterpret_cast<const MicroNetOutputs*>(
+        &(*labels)[m * micro_batch_size]);
+    }
+  };
+
+  void _forward(const Batch& batch, size_t m, size_t layer) {
+    micro_batches[m]->forward(layer, batch.micro_inputs(m),
+                              *batch.parameters);
+    if (layer + 1ul == layers_no)
+      errors[m] = micro_batches[m]->loss(batch.micro_labels(m));
+  }
+
+  void _backward(const Batch& batch, size_t m, size_t layer) {
+    MicroInputs& prev_errors = batch.prev_errors ?
+      *reinterpret_cast<MicroInputs*>(
+        &(*batch.prev_errors)[m * micro_batch_size]) :
+      *input_errors;
+    Parameters& gradient = m == 0ul ? *batch.gradient : *scratch;
+    micro_batches[m]->backward(layer, batch.micro_inputs(m),
+                               *batch.parameters, prev_errors, gradient);
+    if (m > 0ul) {
+      T* const out = batch.gradient->layer_data(layer);
+      const T* const in = scratch->layer_data(layer);
+      const size_t size = batch.gradient->layer_size(layer);
+      for (size_t i = 0; i < size; i++)
+        out[i] += in[i];
+    }
+  }
+
+  void _stage(size_t s, const Batch& batch) {
+    const size_t begin = first_layer[s];
+    const size_t end = s + 1ul < stages_no ? first_layer[s + 1ul] : layers_no;
+
+    const auto forward = [&](size_t m) {
+      if (s > 0ul)
+        _wait(forwarded, s - 1ul, m);
+      for (size_t l = begin; l < end; l++)
+        _forward(batch, m, l);
+      _advance(forwarded, s);
+    };
+    const auto backward = [&](size_t m) {
+      if (s + 1ul < stages_no)
+        _wait(backwarded, s + 1ul, m);
+      for (size_t l = end; l-- > begin; )
+        _backward(batch, m, l);
+      _advance(backwarded, s);
+    };
+
+    const size_t warmup = std::min(stages_no - 1ul - s, micro_batches_no);
+    size_t f = 0ul, b = 0ul;
+    while (f < warmup)
+      forward(f++);
+    while (f < micro_batches_no) {
+      forward(f++);
+      backward(b++);
+    }
+    while (b < micro_batches_no)
+      backward(b++);
+  }
+
+  /* Waits until stage s has passed micro-batch m */
+  void _wait(const std::vector<size_t>& done, size_t s, size_t m) {
+    std::unique_lock<std::mutex> lock(mutex);
+    progress.wait(lock, [&done, s, m]() { return done[s] > m; });
+  }
+
+  void _advance(std::vector<size_t>& done, size_t s) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done[s]++;
+    }
+    progress.notify_all();
+  }
+
+  /* Runs the batch on the calling thread, timing every layer, and splits
+   * the layers into the stages with the smallest largest time */
+  void _balance(const Batch& batch) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> times(layers_no, 0.0);
+    for (size_t m = 0; m < micro_batches_no; m++) {
+      for (size_t l = 0; l < layers_no; l++) {
+        const Clock::time_point start = Clock::now();
+        _forward(batch, m, l);
+        times[l] += std::chrono::duration<double>(Clock::now() - start)
+          .count();
+      }
+      for (size_t l = layers_no; l-- > 0ul; ) {
+        const Clock::time_point start = Clock::now();
+        _backward(batch, m, l);
+        times[l] += std::chrono::duration<double>(Clock::now() - start)
+          .count();
+      }
+    }
+
+    /* cost[k][i]: best largest time for the first i layers in k stages */
+    std::vector<double> prefix(layers_no + 1ul, 0.0);
+    for (size_t l = 0; l < layers_no; l++)
+      prefix[l + 1ul] = prefix[l] + times[l];
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<std::vector<double>> cost(
+      stages_no + 1ul, std::vector<double>(layers_no + 1ul, infinity));
+    std::vector<std::vector<size_t>> cut(
+      stages_no + 1ul, std::vector<size_t>(layers_no + 1ul, 0ul));
+    cost[0][0] = 0.0;
+    for (size_t k = 1; k <= stages_no; k++)
+      for (size_t i = k; i <= layers_no; i++)
+        for (size_t j = k - 1ul; j < i; j++) {
+          const double c = std::max(cost[k - 1ul][j], prefix[i] - prefix[j]);
+          if (c < cost[k][i]) {
+            cost[k][i] = c;
+            cut[k][i] = j;
+          }
+        }
+
+    std::vector<size_t> first_layers(stages_no);
+    for (size_t k = stages_no, i = layers_no; k > 0ul; k--) {
+      i = cut[k][i];
+      first_layers[k - 1ul] = i;
+    }
+    set_stages(first_layers);
+  }
+
+  ThreadPool pool;
+  std::vector<std::unique_ptr<MicroBatch>> micro_batches;
+  std::unique_ptr<Parameters> scratch;
+  std::unique_ptr<MicroInputs> input_errors;
+  std::vector<T> errors;
+  std::vector<size_t> first_layer;
+
+  std::mutex mutex;
+  std::condition_variable progress;
+  std::vector<size_t> forwarded;
+  std::vector<size_t> backwarded;
+};
+
+#endif
@@ -0,0 +1,471 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "cerebrum/perf_counters.h"
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
+         typename Mapping, template<typename> class TransferFunction,
+         typename Engine>
+struct Convolution;
+
+/* Per-layer profiling of the forward and gradient computations.
+ *
+ * The forward and gradient computations take a profiler as a template
+ * policy, as an extra argument:
+ *
+ *     LayerProfiler profiler;
+ *     gc->computeGradient(inputs, parameters, labels, gradient, profiler);
+ *     profiler.write_chrome_trace(file);        // chrome://tracing
+ *
+ * and call, around every layer's forward and backpropagate,
+ *
+ *     profiler.begin<T, Layer, InputSize>(layer, phase, rows);
+ *     profiler.end(layer, phase);
+ *
+ * The calls without a profiler use NoProfiler, whose empty inline members
+ * compile to nothing.
+ *
+ * LayerProfiler counts the calls and the wall time of every layer and
+ * phase, and keeps the calls as events for the trace (up to max_events).
+ * FLOPs and bytes come from the layer's type (LayerCost): two FLOPs per
+ * multiply-add; the bytes are those of the inputs, outputs and parameters
+ * (and, in backpropagation, of the errors and the gradient), each counted
+ * once. A profiler is not thread-safe: give each computation its own.
+ *
+ * CounterProfiler adds the hardware counters of perf_counters.h.
+ */
+
+enum class LayerPhase { forward = 0, backpropagate = 1 };
+
+inline const char* _phase_name(LayerPhase phase) {
+  return phase == LayerPhase::forward ? "forward" : "backpropagate";
+}
+
+struct NoProfiler {
+  template<typename T, typename Layer, typename InputSize>
+  void begin(size_t, LayerPhase, size_t) { }
+
+  void end(size_t, LayerPhase) { }
+};
+
+/* -------------------- Costs -------------------- */
+
+/* Multiply-adds of the forward pass of one example. Layers with
+ * parameters are dense by default (every weight is used once, next to one
+ * bias per output unit); convolutions use each weight once per output
+ * position. Layers without parameters do no multiply-adds. */
+
+template<typename Layer, typename InputSize>
+struct LayerCost {
+  using OutputSize = typename Layer::template OutputSize<InputSize>;
+  static constexpr size_t parameters_no =
+    Layer::template parameters_no<InputSize>();
+  static constexpr size_t multiply_adds =
+    parameters_no > OutputSize::length ?
+    parameters_no - OutputSize::length : 0ul;
+};
+
+template<size_t maps_no, size_t conv_height, size_t conv_width, size_t stride,
+         typename Mapping, template<typename> class TransferFunction,
+         typename Engine, typename InputSize>
+struct LayerCost<Convolution<maps_no, conv_height, conv_width, stride,
+                             Mapping, TransferFunction, Engine>, InputSize> {
+  using Layer = Convolution<maps_no, conv_height, conv_width, stride,
+                            Mapping, TransferFunction, Engine>;
+  using OutputSize = typename Layer::template OutputSize<InputSize>;
+  static constexpr size_t parameters_no =
+    Layer::template parameters_no<InputSize>();
+  static constexpr size_t multiply_adds =
+    (parameters_no - Layer::out_maps_no) * OutputSize::height *
+    OutputSize::width;
+};
+
+inline std::string _json_escape(const std::string& s) {
+  std::string escaped;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+/* -------------------- LayerProfiler -------------------- */
+
+class LayerProfiler {
+ public:
+  struct PhaseStats {
+    size_t calls = 0ul;
+    double seconds = 0.0;
+    double flops = 0.0;                       /* all calls */
+    double bytes = 0.0;
+  };
+
+  struct LayerStats {
+    std::string name;
+    size_t inputs_no = 0ul;                   /* per example */
+    size_t outputs_no = 0ul;
+    size_t parameters_no = 0ul;
+    PhaseStats phases[2];
+  };
+
+  struct Event {
+    size_t layer;
+    LayerPhase phase;
+    double start;                             /* seconds since creation */
+    double duration;
+    size_t rows;
+    double flops;
+    double bytes;
+  };
+
+  explicit LayerProfiler(size_t max_events = 1ul << 20)
+      : max_events_(max_events), dropped_events_(0ul),
+        origin_(Clock::now()) { }
+
+  template<typename T, typename Layer, typename InputSize>
+  void begin(size_t layer, LayerPhase phase, size_t rows) {
+    using Cost = LayerCost<Layer, InputSize>;
+    using OutputSize = typename Layer::template OutputSize<InputSize>;
+    if (layer >= layers_.size())
+      layers_.resize(layer + 1ul);
+    LayerStats& stats = layers_[layer];
+    if (stats.name.empty()) {
+      stats.name = _name<Layer>();
+      stats.inputs_no = InputSize::length;
+      stats.outputs_no = OutputSize::length;
+      stats.parameters_no = Cost::parameters_no;
+    }
+
+    const double activations =
+      (double)rows * (InputSize::length + OutputSize::length) * sizeof(T);
+    const double parameters = (double)Cost::parameters_no * sizeof(T);
+    if (phase == LayerPhase::forward) {
+      pending_flops_ = 2.0 * rows * Cost::multiply_adds;
+      pending_bytes_ = activations + parameters;
+    } else {
+      pending_flops_ = 4.0 * rows * Cost::multiply_adds;
+      pending_bytes_ = 2.0 * (activations + parameters);
+    }
+    pending_rows_ = rows;
+    start_ = Clock::now();
+  }
+
+  void end(size_t layer, LayerPhase phase) {
+    const Clock::time_point now = Clock::now();
+    const double seconds = std::chrono::duration<double>(now - start_).count();
+    PhaseStats& stats = layers_[layer].phases[(size_t)phase];
+    stats.calls++;
+    stats.seconds += seconds;
+    stats.flops += pending_flops_;
+    stats.bytes += pending_bytes_;
+    if (events_.size() < max_events_) {
+      const Event event = {
+        layer, phase,
+        std::chrono::duration<double>(start_ - origin_).count(), seconds,
+        pending_rows_, pending_flops_, pending_bytes_};
+      events_.push_back(event);
+    } else {
+      dropped_events_++;
+    }
+  }
+
+  const std::vector<LayerStats>& layers() const { return layers_; }
+  const std::vector<Event>& events() const { return events_; }
+  size_t dropped_events() const { return dropped_events_; }
+
+  void reset() {
+    layers_.clear();
+    events_.clear();
+    dropped_events_ = 0ul;
+    origin_ = Clock::now();
+  }
+
+  /* Totals per layer and phase:
+   *
+   *   {"layers": [{"layer": 0, "name": ..., "inputs": ..., "outputs": ...,
+   *                "parameters": ..., "forward": {"calls": ...,
+   *                "seconds": ..., "mean_us": ..., "gflops": ...,
+   *                "gbps": ...}, "backpropagate": {...}}, ...],
+   *    "dropped_events": ...}
+   */
+  void write_json(std::ostream& out) const {
+    out << "{\"layers\": [";
+    for (size_t l = 0; l < layers_.size(); l++) {
+      const LayerStats& stats = layers_[l];
+      out << (l ? ",\n  " : "\n  ") << "{\"layer\": " << l
+          << ", \"name\": \"" << _json_escape(stats.name) << "\""
+          << ", \"inputs\": " << stats.inputs_no
+          << ", \"outputs\": " << stats.outputs_no
+          << ", \"parameters\": " << stats.parameters_no;
+      for (size_t p = 0; p < 2ul; p++) {
+        const PhaseStats& phase = stats.phases[p];
+        const double seconds = phase.seconds > 0.0 ? phase.seconds : 1.0;
+        out << ", \"" << _phase_name((LayerPhase)p) << "\": {\"calls\": "
+            << phase.calls << ", \"seconds\": " << phase.seconds
+            << ", \"mean_us\": "
+            << (phase.calls ? phase.seconds * 1e6 / phase.calls : 0.0)
+            << ", \"flops\": " << phase.flops
+            << ", \"bytes\": " << phase.bytes
+            << ", \"gflops\": " << phase.flops / seconds * 1e-9
+            << ", \"gbps\": " << phase.bytes / seconds * 1e-9 << "}";
+      }
+      out << "}";
+    }
+    out << "\n], \"dropped_events\": " << dropped_events_ << "}" << std::endl;
+  }
+
+  /* The Trace Event Format of chrome://tracing (and Perfetto): one
+   * complete event per call, with its layer, rows, FLOPs and bytes */
+  void write_chrome_trace(std::ostream& out, int pid = 1, int tid = 1) const {
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (size_t e = 0; e < events_.size(); e++) {
+      const Event& event = events_[e];
+      const LayerStats& stats = layers_[event.layer];
+      out << (e ? ",\n  " : "\n  ") << "{\"name\": \"" << event.layer << " "
+          << _json_escape(stats.name) << "\", \"cat\": \""
+          << _phase_name(event.phase) << "\", \"ph\": \"X\", \"ts\": "
+          << std::fixed << std::setprecision(3) << event.start * 1e6
+          << ", \"dur\": " << event.duration * 1e6
+          << std::defaultfloat << std::setprecision(6)
+          << ", \"pid\": " << pid << ", \"tid\": " << tid
+          << ", \"args\": {\"layer\": " << event.layer
+          << ", \"rows\": " << event.rows
+          << ", \"flops\": " << event.flops
+          << ", \"bytes\": " << event.bytes << "}}";
+    }
+    out << "\n]}" << std::endl;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  template<typename Layer>
+  static std::string _name() {
+    const char* name = typeid(Layer).name();
+#if defined(__GNUG__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0 && demangled) {
+      const std::string result(demangled);
+      std::free(demangled);
+      return result;
+    }
+#endif
+    return name;
+  }
+
+  std::vector<LayerStats> layers_;
+  std::vector<Event> events_;
+  size_t max_events_;
+  size_t dropped_events_;
+  Clock::time_point origin_;
+  Clock::time_point start_;
+  double pending_flops_ = 0.0;
+  double pending_bytes_ = 0.0;
+  size_t pending_rows_ = 0ul;
+};
+
+/* -------------------- CounterProfiler -------------------- */
+
+/* A LayerProfiler that also reads hardware counters around every call.
+ * Next to the time, FLOPs and bytes, it reports per layer and phase the
+ * counts of the events and:
+ *
+ *   ipc                 instructions per cycle;
+ *   bytes_per_flop      the bytes the layer has to touch per FLOP (from
+ *                       LayerCost, the inverse of its arithmetic intensity);
+ *   llc_bytes_per_flop  the cache lines that missed the last level cache,
+ *                       in bytes, per FLOP: what really came from memory.
+ *
+ * A layer with a high IPC and few LLC bytes per FLOP is bound by compute;
+ * one whose LLC bytes approach its bytes is bound by memory, and dTLB
+ * misses point at strides that cross pages. Counters that are not
+ * available are null in the JSON, as are the ratios that need them.
+ */
+
+class CounterProfiler {
+ public:
+  static constexpr double cache_line = 64.0;
+
+  explicit CounterProfiler(const std::vector<PerfEvent>& events =
+                             PerfCounters::default_events(),
+                           size_t max_events = 1ul << 20)
+      : timing_(max_events), counters_(events), deltas_(events.size()),
+        cycles_(_find(events, "cycles")),
+        instructions_(_find(events, "instructions")),
+        llc_misses_(_find(events, "llc_misses")),
+        dtlb_misses_(_find(events, "dtlb_misses")) { }
+
+  template<typename T, typename Layer, typename InputSize>
+  void begin(size_t layer, LayerPhase phase, size_t rows) {
+    timing_.template begin<T, Layer, InputSize>(layer, phase, rows);
+    counters_.start();
+  }
+
+  void end(size_t layer, LayerPhase phase) {
+    counters_.stop(deltas_.data());
+    timing_.end(layer, phase);
+    const size_t events_no = counters_.size();
+    if (layer >= counts_.size())
+      counts_.resize(layer + 1ul, std::vector<double>(2ul * events_no, 0.0));
+    double* counts = counts_[layer].data() + (size_t)phase * events_no;
+    for (size_t e = 0; e < events_no; e++)
+      counts[e] += deltas_[e];
+  }
+
+  /* The times, FLOPs, bytes and events (for the trace) */
+  const LayerProfiler& timing() const { return timing_; }
+  const PerfCounters& counters() const { return counters_; }
+
+  /* Event e of layer's phase, summed over all calls */
+  double count(size_t layer, LayerPhase phase, size_t e) const {
+    return counts_[layer][(size_t)phase * counters_.size() + e];
+  }
+
+  void reset() {
+    timing_.reset();
+    counts_.clear();
+  }
+
+  void write_json(std::ostream& out) const {
+    const std::vector<LayerProfiler::LayerStats>& layers = timing_.layers();
+    out << "{\"counters\": {";
+    for (size_t e = 0; e < counters_.size(); e++)
+      out << (e ? ", " : "") << "\"" << _json_escape(counters_.name(e))
+          << "\": " << (counters_.available(e) ? "true" : "false");
+    out << "}, \"layers\": [";
+    for (size_t l = 0; l < layers.size(); l++) {
+      const LayerProfiler::LayerStats& stats = layers[l];
+      out << (l ? ",\n  " : "\n  ") << "{\"layer\": " << l
+          << ", \"name\": \"" << _json_escape(stats.name) << "\""
+          << ", \"inputs\": " << stats.inputs_no
+          << ", \"outputs\": " << stats.outputs_no
+          << ", \"parameters\": " << stats.parameters_no;
+      for (size_t p = 0; p < 2ul; p++) {
+        const LayerPhase phase = (LayerPhase)p;
+        const LayerProfiler::PhaseStats& totals = stats.phases[p];
+        out << ", \"" << _phase_name(phase) << "\": {\"calls\": "
+            << totals.calls << ", \"seconds\": " << totals.seconds
+            << ", \"mean_us\": "
+            << (totals.calls ? totals.seconds * 1e6 / totals.calls : 0.0)
+            << ", \"flops\": " << totals.flops
+            << ", \"bytes\": " << totals.bytes;
+        for (size_t e = 0; e < counters_.size(); e++) {
+          out << ", \"" << _json_escape(counters_.name(e)) << "\": ";
+          _number(out, counters_.available(e), _count(l, phase, e));
+        }
+        out << ", \"ipc\": ";
+        _ratio(out, _count(l, phase, instructions_),
+               _count(l, phase, cycles_),
+               _available(instructions_) && _available(cycles_));
+        out << ", \"bytes_per_flop\": ";
+        _ratio(out, totals.bytes, totals.flops, true);
+        out << ", \"llc_bytes_per_flop\": ";
+        _ratio(out, _count(l, phase, llc_misses_) * cache_line, totals.flops,
+               _available(llc_misses_));
+        out << "}";
+      }
+      out << "}";
+    }
+    out << "\n]}" << std::endl;
+  }
+
+  /* The same, as a table to read */
+  void write_table(std::ostream& out) const {
+    const std::vector<LayerProfiler::LayerStats>& layers = timing_.layers();
+    out << std::left << std::setw(40) << "layer" << std::setw(15) << "phase"
+        << std::right << std::setw(11) << "us/call" << std::setw(7) << "IPC"
+        << std::setw(9) << "B/FLOP" << std::setw(12) << "LLC B/FLOP"
+        << std::setw(13) << "dTLB/call" << std::endl;
+    for (size_t l = 0; l < layers.size(); l++) {
+      std::string name = std::to_string(l) + " " + layers[l].name;
+      if (name.size() > 39ul)
+        name = name.substr(0ul, 36ul) + "...";
+      for (size_t p = 0; p < 2ul; p++) {
+        const LayerPhase phase = (LayerPhase)p;
+        const LayerProfiler::PhaseStats& totals = layers[l].phases[p];
+        if (!totals.calls)
+          continue;
+        const double calls = (double)totals.calls;
+        out << std::left << std::setw(40) << name << std::setw(15)
+            << _phase_name(phase) << std::right << std::fixed
+            << std::setprecision(2) << std::setw(11)
+            << totals.seconds * 1e6 / calls;
+        _cell(out, 7, _count(l, phase, instructions_),
+              _count(l, phase, cycles_),
+              _available(instructions_) && _available(cycles_));
+        _cell(out, 9, totals.bytes, totals.flops, true);
+        _cell(out, 12, _count(l, phase, llc_misses_) * cache_line,
+              totals.flops, _available(llc_misses_));
+        _cell(out, 13, _count(l, phase, dtlb_misses_), calls,
+              _available(dtlb_misses_));
+        out << std::defaultfloat << std::setprecision(6) << std::endl;
+      }
+    }
+  }
+
+ private:
+  static size_t _find(const std::vector<PerfEvent>& events,
+                      const std::string& name) {
+    for (size_t e = 0; e < events.size(); e++)
+      if (events[e].name == name)
+        return e;
+    return events.size();
+  }
+
+  bool _available(size_t e) const {
+    return e < counters_.size() && counters_.available(e);
+  }
+
+  double _count(size_t layer, LayerPhase phase, size_t e) const {
+    return layer < counts_.size() && e < counters_.size() ?
+      count(layer, phase, e) : 0.0;
+  }
+
+  static void _number(std::ostream& out, bool available, double value) {
+    if (available)
+      out << value;
+    else
+      out << "null";
+  }
+
+  static void _ratio(std::ostream& out, double a, double b, bool available) {
+    _number(out, available && b > 0.0, available && b > 0.0 ? a / b : 0.0);
+  }
+
+  static void _cell(std::ostream& out, int width, double a, double b,
+                    bool available) {
+    out << std::setw(width);
+    if (available && b > 0.0)
+      out << a / b;
+    else
+      out << "-";
+  }
+
+  LayerProfiler timing_;
+  PerfCounters counters_;
+  std::vector<double> deltas_;
+  std::vector<std::vector<double>> counts_;   /* per layer: both phases */
+  size_t cycles_;
+  size_t instructions_;
+  size_t llc_misses_;
+  size_t dtlb_misses_;
+};
+
+#endif
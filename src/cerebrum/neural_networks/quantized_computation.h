@@ -0,0 +1,322 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef QUANTIZED_COMPUTATION_H
+#define QUANTIZED_COMPUTATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cerebrum/aligned_buffer.h"
+#include "cerebrum/size.h"
+#include "cerebrum/linear_algebra/int8_gemm.h"
+#include "cerebrum/neural_networks/parameters.h"
+#include "cerebrum/neural_networks/forward_computation.h"
+#include "cerebrum/neural_networks/layers/fully_connected.h"
+#include "cerebrum/neural_networks/layers/dropout.h"
+
+/* Int8 inference for stacks of FullyConnected layers.
+ *
+ * Weights are quantized symmetrically per output neuron (w ~ s_j * q,
+ * q in [-127, 127]) and the inputs of every layer asymmetrically per
+ * tensor (x ~ s * (q - z), q in [0, 255]), so the outputs of ReLU layers
+ * use all 256 levels. int8_gemm accumulates q_x * q_w in int32, and its
+ * epilogue, while the tile is in L1, turns the sums back into
+ *
+ *     s * s_j * (sum - z * sum_k q_w) + b_j
+ *
+ * (the second term and the bias are folded into one offset per neuron),
+ * applies the transfer function in T and quantizes the result again with
+ * the scale of the next layer; the last layer writes T outputs, which the
+ * error function transforms as usual.
+ *
+ * calibrate() runs the float _ForwardComputation over sample batches and
+ * records the range of the inputs of every layer, then quantizes the
+ * parameters with these ranges. The quantized weights are packed once and
+ * owned by the computation, so forward() takes only the inputs (and,
+ * optionally, how many rows of the batch to compute). Dropout is
+ * the identity in inference and is skipped; other layers cannot be
+ * quantized yet.
+ */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+struct _QuantizedLayers;
+
+/* Past the last layer: T outputs */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename LastSize>
+struct _QuantizedLayers<T, batch_size, ErrorFunction, computes, LastSize> {
+  using Inputs = std::array<std::array<T, LastSize::length>, batch_size>;
+  using NetOutputSize = LastSize;
+  using NetOutputs = Inputs;
+
+  NetOutputs outputs;
+  NetOutputs y;
+
+  void _reset_ranges() { }
+
+  template<typename Forward>
+  void _observe(const Inputs&, const Forward&) { }
+
+  void _quantize(const _Parameters<T, LastSize>&) { }
+
+  size_t _model_size() const { return 0ul; }
+
+  void _store(size_t n, size_t j0, const T* values, size_t cols) {
+    std::copy(values, values + cols, outputs[n].data() + j0);
+  }
+
+  void _forward(size_t rows) {
+    if (computes)
+      ErrorFunction::template f<LastSize, batch_size>(outputs, y, rows);
+  }
+
+  const NetOutputs& _outputs() const { return computes ? y : outputs; }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename CrtLayer, typename... Others>
+struct _QuantizedLayers<T, batch_size, ErrorFunction, computes, InputSize,
+                        CrtLayer, Others...> {
+  static_assert(sizeof(CrtLayer) == 0ul,
+                "only FullyConnected and Dropout layers can be quantized");
+};
+
+/* Dropout: the identity */
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, size_t active_no, typename... Others>
+struct _QuantizedLayers<T, batch_size, ErrorFunction, computes, InputSize,
+                        Dropout<active_no>, Others...> {
+  using Inputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  using Next = _QuantizedLayers<T, batch_size, ErrorFunction, computes,
+                                InputSize, Others...>;
+  using NetOutputSize = typename Next::NetOutputSize;
+  using NetOutputs = typename Next::NetOutputs;
+
+  Next next;
+
+  void _reset_ranges() { next._reset_ranges(); }
+
+  template<typename Forward>
+  void _observe(const Inputs&, const Forward& forward) {
+    next._observe(forward.outputs, forward.next);
+  }
+
+  template<typename Parameters>
+  void _quantize(const Parameters& parameters) {
+    next._quantize(parameters.next);
+  }
+
+  size_t _model_size() const { return next._model_size(); }
+
+  void _store(size_t n, size_t j0, const T* values, size_t cols) {
+    next._store(n, j0, values, cols);
+  }
+
+  void _forward(size_t rows) { next._forward(rows); }
+
+  const NetOutputs& _outputs() const { return next._outputs(); }
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, size_t length,
+         template<typename> class TransferFunction, typename... Others>
+struct _QuantizedLayers<T, batch_size, ErrorFunction, computes, InputSize,
+                        FullyConnected<length, TransferFunction>, Others...> {
+  using Layer = FullyConnected<length, TransferFunction>;
+  using Inputs = std::array<std::array<T, InputSize::length>, batch_size>;
+  using Next = _QuantizedLayers<T, batch_size, ErrorFunction, computes,
+                                Size<length>, Others...>;
+  using NetOutputSize = typename Next::NetOutputSize;
+  using NetOutputs = typename Next::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, Layer, Others...>;
+
+  static constexpr size_t inputs_no = InputSize::length;
+  static constexpr size_t depth = (inputs_no + 3ul) / 4ul * 4ul;
+  static constexpr size_t rows =
+    (batch_size + Int8Blocking::mr - 1ul) / Int8Blocking::mr *
+    Int8Blocking::mr;
+
+  _QuantizedLayers()
+      : inputs_(rows * depth), weights_(int8_packed_size(length, inputs_no)),
+        min_((T)0), max_((T)0), inverse_scale_((T)1), zero_point_(0) {
+    std::fill_n(inputs_.data(), rows * depth, (uint8_t)0);
+    std::fill_n(weights_.data(), int8_packed_size(length, inputs_no),
+                (int8_t)0);
+    multipliers_.fill((T)0);
+    offsets_.fill((T)0);
+  }
+
+  _QuantizedLayers(const _QuantizedLayers&) = delete;
+  _QuantizedLayers& operator=(const _QuantizedLayers&) = delete;
+
+  void _reset_ranges() {
+    min_ = max_ = (T)0;
+    next._reset_ranges();
+  }
+
+  template<typename Forward>
+  void _observe(const Inputs& inputs, const Forward& forward) {
+    const T* x = inputs.data()->data();
+    for (size_t i = 0; i < batch_size * inputs_no; i++) {
+      min_ = std::min(min_, x[i]);
+      max_ = std::max(max_, x[i]);
+    }
+    next._observe(forward.outputs, forward.next);
+  }
+
+  void _quantize(const Parameters& parameters) {
+    const T scale = max_ > min_ ? (max_ - min_) / (T)255 : (T)1;
+    inverse_scale_ = (T)1 / scale;
+    zero_point_ = (int32_t)std::min((T)255, std::max((T)0, std::round(
+      -min_ * inverse_scale_)));
+
+    const T* biases = parameters.values.data();
+    const T* weights = biases + length;
+    std::vector<int8_t> q(length * inputs_no);
+    for (size_t j = 0; j < length; j++) {
+      const T* row = weights + j * inputs_no;
+      T largest = (T)0;
+      for (size_t k = 0; k < inputs_no; k++)
+        largest = std::max(largest, std::fabs(row[k]));
+      const T row_scale = largest > (T)0 ? largest / (T)127 : (T)1;
+      int32_t sum = 0;
+      for (size_t k = 0; k < inputs_no; k++) {
+        const int32_t q_k = (int32_t)std::round(row[k] / row_scale);
+        q[j * inputs_no + k] = (int8_t)std::min(127, std::max(-127, q_k));
+        sum += q[j * inputs_no + k];
+      }
+      multipliers_[j] = scale * row_scale;
+      offsets_[j] = biases[j] -
+        multipliers_[j] * (T)zero_point_ * (T)sum;
+    }
+    pack_int8(length, inputs_no, q.data(), inputs_no, weights_.data());
+    next._quantize(parameters.next);
+  }
+
+  size_t _model_size() const {
+    return int8_packed_size(length, inputs_no) + 2ul * length * sizeof(T) +
+      next._model_size();
+  }
+
+  /* Quantizes a run of this layer's inputs */
+  void _store(size_t n, size_t j0, const T* values, size_t cols) {
+    uint8_t* q = inputs_.data() + n * depth + j0;
+    const T zero_point = (T)zero_point_;
+    for (size_t c = 0; c < cols; c++)
+      q[c] = (uint8_t)std::lrint(std::min((T)255, std::max((T)0,
+        values[c] * inverse_scale_ + zero_point)));
+  }
+
+  void _forward(size_t rows) {
+    const _Epilogue epilogue = {this};
+    int8_gemm(rows, length, inputs_no, inputs_.data(), depth,
+              weights_.data(), epilogue);
+    next._forward(rows);
+  }
+
+  const NetOutputs& _outputs() const { return next._outputs(); }
+
+ private:
+  struct _Epilogue {
+    _QuantizedLayers* layer;
+
+    inline void
+    finish(size_t i0, size_t j0, size_t rows, size_t cols,
+           const int32_t* tile, size_t ld_tile) const {
+      alignas(cache_line_size) T z[Int8Blocking::nr];
+      const T* multipliers = layer->multipliers_.data() + j0;
+      const T* offsets = layer->offsets_.data() + j0;
+      for (size_t i = 0; i < rows; i++) {
+        const int32_t* tile_row = tile + i * ld_tile;
+        for (size_t j = 0; j < cols; j++)
+          z[j] = (T)tile_row[j] * multipliers[j] + offsets[j];
+        TransferFunction<T>::f_array(z, z, cols);
+        layer->next._store(i0 + i, j0, z, cols);
+      }
+    }
+  };
+
+  AlignedBuffer<uint8_t> inputs_;
+  AlignedBuffer<int8_t> weights_;
+  std::array<T, length> multipliers_;
+  std::array<T, length> offsets_;
+  T min_;
+  T max_;
+  T inverse_scale_;
+  int32_t zero_point_;
+
+ public:
+  Next next;
+};
+
+template<typename T, size_t batch_size, typename ErrorFunction, bool computes,
+         typename InputSize, typename... Layers>
+class _QuantizedInferenceComputation {
+ public:
+  using Calibration = _ForwardComputation<T, batch_size, ErrorFunction,
+                                          computes, InputSize, Layers...>;
+  using QuantizedLayers = _QuantizedLayers<T, batch_size, ErrorFunction,
+                                           computes, InputSize, Layers...>;
+
+  using Inputs = typename Calibration::Inputs;
+  using NetOutputs = typename QuantizedLayers::NetOutputs;
+  using Parameters = _Parameters<T, InputSize, Layers...>;
+  using OutputSize = typename QuantizedLayers::NetOutputSize;
+
+  _QuantizedInferenceComputation() : y_(nullptr), rows_(batch_size) { }
+
+  _QuantizedInferenceComputation(const _QuantizedInferenceComputation&)
+    = delete;
+  _QuantizedInferenceComputation&
+  operator=(const _QuantizedInferenceComputation&) = delete;
+
+  /* Records the ranges of the activations of the float network on
+   * batches_no sample batches and quantizes `parameters` with them */
+  void calibrate(const Parameters& parameters, const Inputs* batches,
+                 size_t batches_no) {
+    std::unique_ptr<Calibration> calibration(new Calibration);
+    layers_._reset_ranges();
+    for (size_t b = 0; b < batches_no; b++) {
+      calibration->forward(batches[b], parameters);
+      layers_._observe(batches[b], *calibration);
+    }
+    layers_._quantize(parameters);
+  }
+
+  /* The outputs stay valid until the next call; only their first `rows`
+   * rows are computed */
+  const NetOutputs& forward(const Inputs& inputs, size_t rows = batch_size) {
+    if (rows == 0ul || rows > batch_size)
+      throw std::invalid_argument("rows must be between 1 and batch_size");
+    for (size_t n = 0; n < rows; n++)
+      layers_._store(n, 0ul, inputs[n].data(), InputSize::length);
+    layers_._forward(rows);
+    rows_ = rows;
+    y_ = &layers_._outputs();
+    return *y_;
+  }
+
+  T error(const NetOutputs& labels) {
+    return ErrorFunction::template error<OutputSize, batch_size>(*y_, labels,
+                                                                 rows_);
+  }
+
+  /* Bytes of quantized weights, multipliers and offsets */
+  size_t model_size() const { return layers_._model_size(); }
+
+ private:
+  QuantizedLayers layers_;
+  const NetOutputs* y_;
+  size_t rows_;
+};
+
+#endif
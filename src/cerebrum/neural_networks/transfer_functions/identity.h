@@ -17,6 +17,12 @@ struct Identity {
     return (T)1;
   }
 
+  /* A contiguous run of neurons (a may alias z) */
+  inline static void f_array(const T* z, T* a, size_t n) {
+    if (a != z)
+      std::memmove(a, z, n * sizeof(T));
+  }
+
   /* All neurons on a layer */
   template<typename LayerSize>
   using Neurons = std::array<T, LayerSize::length>;
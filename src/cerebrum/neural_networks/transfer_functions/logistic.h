@@ -3,22 +3,31 @@
 #ifndef LOGISTIC_H
 #define LOGISTIC_H
 
-#include <cmath>
+#include <cstddef>
 #include <array>
 
-template<typename T>
-struct Logistic;
+#include "cerebrum/simd.h"
+#include "cerebrum/vector_math.h"
+
+/* Precision is AccuratePrecision or FastPrecision (see vector_math.h) */
+
+template<typename T, typename Precision>
+struct _Logistic {
+  using Math = VectorMath<T, Precision>;
 
-template<typename T>
-struct Logistic {
   /* One at a time */
   inline static T f(T x) {
-    return (T)1 / ((T)1 + exp(-x));
+    return Math::template logistic<ScalarVector<T>>(x);
   }
   inline static T df(T y) {
     return y * ((T)1 - y);
   }
 
+  /* A contiguous run of neurons (a may alias z) */
+  inline static void f_array(const T* z, T* a, size_t n) {
+    Math::logistic_array(z, a, n);
+  }
+
   /* All neurons on a layer */
   template<typename LayerSize>
   using Neurons = std::array<T, LayerSize::length>;
@@ -26,9 +35,7 @@ struct Logistic {
   template<typename LayerSize>
   inline static void
   f_layer(const Neurons<LayerSize>& Z, Neurons<LayerSize>& A) {
-    for (size_t j = 0; j < LayerSize::length; j++) {
-      A[j] = f(Z[j]);
-    }
+    f_array(Z.data(), A.data(), LayerSize::length);
   }
 
   template<typename LayerSize>
@@ -47,14 +54,8 @@ struct Logistic {
   inline static void
   f_batch(const Batch<LayerSize, batch_size>& Z,
           Batch<LayerSize, batch_size>& A) {
-    constexpr size_t full_length = LayerSize::length * batch_size;
-    using LinearBatch = std::array<T, LayerSize::length * batch_size>;
-
-    const LinearBatch& z = *reinterpret_cast<const LinearBatch*>(Z.data());
-    LinearBatch& a = *reinterpret_cast<LinearBatch*>(A.data());
-
-    for (size_t j = 0; j < full_length; j++)
-      a[j] = f(z[j]);
+    f_array(Z.data()->data(), A.data()->data(),
+            LayerSize::length * batch_size);
   }
 
   template<typename LayerSize, size_t batch_size>
@@ -72,4 +73,10 @@ struct Logistic {
   }
 };
 
+template<typename T>
+using Logistic = _Logistic<T, AccuratePrecision>;
+
+template<typename T>
+using FastLogistic = _Logistic<T, FastPrecision>;
+
 #endif
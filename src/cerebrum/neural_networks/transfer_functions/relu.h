@@ -3,7 +3,10 @@
 #ifndef RELU_H
 #define RELU_H
 
-#include<array>
+#include <cstddef>
+#include <array>
+
+#include "cerebrum/simd.h"
 
 template <typename T>
 struct ReLU {
@@ -15,6 +18,16 @@ struct ReLU {
     return (y > 0) ? 1 : 0;
   }
 
+  /* A contiguous run of neurons (a may alias z) */
+  inline static void f_array(const T* z, T* a, size_t n) {
+    using V = Vector<T>;
+    const size_t body = n - n % V::length;
+    for (size_t i = 0ul; i < body; i += V::length)
+      V::storeu(a + i, V::max(V::loadu(z + i), V::zero()));
+    for (size_t i = body; i < n; i++)
+      a[i] = f(z[i]);
+  }
+
   /* All neurons on a layer */
   template<typename LayerSize>
   using Neurons = std::array<T, LayerSize::length>;
@@ -22,9 +35,7 @@ struct ReLU {
   template<typename LayerSize>
   inline static void
   f_layer(const Neurons<LayerSize>& Z, Neurons<LayerSize>& A) {
-    for (size_t j = 0; j < LayerSize::length; j++) {
-      A[j] = f(Z[j]);
-    }
+    f_array(Z.data(), A.data(), LayerSize::length);
   }
 
   template<typename LayerSize>
@@ -43,14 +54,8 @@ struct ReLU {
   inline static void
   f_batch(const Batch<LayerSize, batch_size>& Z,
           Batch<LayerSize, batch_size>& A) {
-    constexpr size_t full_length = LayerSize::length * batch_size;
-    using LinearBatch = std::array<T, LayerSize::length * batch_size>;
-
-    const LinearBatch& z = *reinterpret_cast<const LinearBatch*>(Z.data());
-    LinearBatch& a = *reinterpret_cast<LinearBatch*>(A.data());
-
-    for (size_t j = 0; j < full_length; j++)
-      a[j] = f(z[j]);
+    f_array(Z.data()->data(), A.data()->data(),
+            LayerSize::length * batch_size);
   }
 
   template<typename LayerSize, size_t batch_size>
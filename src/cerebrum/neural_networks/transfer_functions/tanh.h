@@ -3,23 +3,32 @@
 #ifndef HYPERBOLIC_TANGENT_H
 #define HYPERBOLIC_TANGENT_H
 
-#include <cmath>
+#include <cstddef>
 #include <array>
 
-template<typename T>
-struct HyperbolicTangent;
+#include "cerebrum/simd.h"
+#include "cerebrum/vector_math.h"
 
-template<typename T>
-struct HyperbolicTangent {
+/* Precision is AccuratePrecision or FastPrecision (see vector_math.h) */
+
+template<typename T, typename Precision>
+struct _HyperbolicTangent {
+  using Math = VectorMath<T, Precision>;
+
+  /* One at a time */
   inline static T f(T x) {
-    const T e2x = exp(-2 * x);
-    return ((T)1 - e2x) / ((T)1 + e2x);
+    return Math::template tanh<ScalarVector<T>>(x);
   }
 
   inline static T df(T y) {
     return (T)1 - y * y;
   }
 
+  /* A contiguous run of neurons (a may alias z) */
+  inline static void f_array(const T* z, T* a, size_t n) {
+    Math::tanh_array(z, a, n);
+  }
+
   /* All neurons on a layer */
   template<typename LayerSize>
   using Neurons = std::array<T, LayerSize::length>;
@@ -27,9 +36,7 @@ struct HyperbolicTangent {
   template<typename LayerSize>
   inline static void
   f_layer(const Neurons<LayerSize>& Z, Neurons<LayerSize>& A) {
-    for (size_t j = 0; j < LayerSize::length; j++) {
-      A[j] = f(Z[j]);
-    }
+    f_array(Z.data(), A.data(), LayerSize::length);
   }
 
   template<typename LayerSize>
@@ -48,14 +55,8 @@ struct HyperbolicTangent {
   inline static void
   f_batch(const Batch<LayerSize, batch_size>& Z,
           Batch<LayerSize, batch_size>& A) {
-    constexpr size_t full_length = LayerSize::length * batch_size;
-    using LinearBatch = std::array<T, LayerSize::length * batch_size>;
-
-    const LinearBatch& z = *reinterpret_cast<const LinearBatch*>(Z.data());
-    LinearBatch& a = *reinterpret_cast<LinearBatch*>(A.data());
-
-    for (size_t j = 0; j < full_length; j++)
-      a[j] = f(z[j]);
+    f_array(Z.data()->data(), A.data()->data(),
+            LayerSize::length * batch_size);
   }
 
   template<typename LayerSize, size_t batch_size>
@@ -73,4 +74,10 @@ struct HyperbolicTangent {
   }
 };
 
+template<typename T>
+using HyperbolicTangent = _HyperbolicTangent<T, AccuratePrecision>;
+
+template<typename T>
+using FastHyperbolicTangent = _HyperbolicTangent<T, FastPrecision>;
+
 #endif
@@ -0,0 +1,272 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef SHARED_ALL_REDUCE_H
+#define SHARED_ALL_REDUCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cerebrum/aligned_buffer.h"
+
+/* Sums buffers of `size` values across ranks_no processes on the same node,
+ * through a POSIX shared memory segment: data-parallel training with one
+ * process (and one GradientComputation) per shard of the data.
+ *
+ * The segment holds a header with a barrier, one page-aligned slot per
+ * rank and one page-aligned result. all_reduce() is a reduce-scatter
+ * followed by an all-gather:
+ *
+ *   1. every rank copies its buffer into its slot;            (barrier)
+ *   2. rank r adds up chunk r of all the slots, in rank order, into chunk
+ *      r of the result;                                        (barrier)
+ *   3. every rank copies the whole result back into its buffer.
+ *
+ * Every rank reads and writes about three times the buffer, whatever the
+ * number of ranks, and all ranks get exactly the same sums. Each slot and
+ * each chunk of the result is first written by the rank that owns it, so on
+ * NUMA machines it is allocated on that rank's node. A slot is only written
+ * again after the next barrier 1, by which time nobody reads it, so two
+ * barriers per call are enough.
+ *
+ * Rank 0 creates the segment; the others wait for it and check that it has
+ * the same number of ranks and values. Once every rank has attached, the
+ * name is unlinked, so nothing is left behind if a process dies. A rank
+ * that waits at a barrier for longer than `timeout` seconds (e.g. because
+ * another one died) throws instead of hanging.
+ *
+ * A run that crashed before the name was unlinked leaves a segment behind,
+ * which the other ranks of the next run could open before rank 0 replaces
+ * it. Rank 0 marks its segment as ready only once it is initialized, along
+ * with its process id and `session`, a value that all the ranks of a run
+ * are given (e.g. a job id, or the pid of the launcher). The other ranks
+ * only attach to a ready segment of the same session whose creator is
+ * still alive, and wait for rank 0 otherwise.
+ */
+
+template<typename T>
+class SharedAllReduce {
+ public:
+  SharedAllReduce(const std::string& name, size_t rank, size_t ranks_no,
+                  size_t size, double timeout = 60.0, uint64_t session = 0ul)
+      : name_(name[0] == '/' ? name : "/" + name), rank_(rank),
+        ranks_no_(ranks_no), size_(size), timeout_(timeout),
+        session_(session) {
+    if (ranks_no == 0ul || rank >= ranks_no)
+      throw std::invalid_argument("rank must be smaller than ranks_no");
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    stride_ = std::max<size_t>(1ul, (size * sizeof(T) + page - 1ul) / page)
+      * page;
+    offset_ = (sizeof(Header) + page - 1ul) / page * page;
+    length_ = offset_ + (ranks_no + 1ul) * stride_;
+    /* Chunks of whole cache lines */
+    const size_t line = cache_line_size / sizeof(T);
+    chunk_ = ((size + ranks_no - 1ul) / ranks_no + line - 1ul) / line * line;
+
+    if (rank == 0ul)
+      _create();
+    else
+      _attach();
+    try {
+      barrier();
+    } catch (...) {
+      if (rank == 0ul)
+        shm_unlink(name_.c_str());
+      munmap(address_, length_);
+      throw;
+    }
+    if (rank == 0ul)
+      shm_unlink(name_.c_str());
+  }
+
+  SharedAllReduce(const SharedAllReduce&) = delete;
+  SharedAllReduce& operator=(const SharedAllReduce&) = delete;
+
+  ~SharedAllReduce() { munmap(address_, length_); }
+
+  /* data[i] becomes the sum of data[i] over all ranks */
+  void all_reduce(T* data) {
+    std::memcpy(_slot(rank_), data, size_ * sizeof(T));
+    barrier();
+
+    const size_t begin = std::min(size_, rank_ * chunk_);
+    const size_t end = std::min(size_, begin + chunk_);
+    T* const out = _slot(ranks_no_);
+    std::copy(_slot(0ul) + begin, _slot(0ul) + end, out + begin);
+    for (size_t r = 1; r < ranks_no_; r++) {
+      const T* const in = _slot(r);
+      for (size_t i = begin; i < end; i++)
+        out[i] += in[i];
+    }
+    barrier();
+
+    std::memcpy(data, out, size_ * sizeof(T));
+  }
+
+  /* Sums the whole arena of a gradient (its size must be `size`) */
+  template<typename Parameters>
+  void all_reduce(Parameters& gradient) {
+    static_assert(sizeof(typename Parameters::DataType) == sizeof(T),
+                  "the gradient must hold values of type T");
+    if (Parameters::size() != size_)
+      throw std::invalid_argument("the gradient does not have size values");
+    all_reduce(gradient.data());
+  }
+
+  /* Sense-reversing barrier: the last rank to arrive starts a new
+   * generation. Waiters spin for a while, then yield their core. */
+  void barrier() {
+    Header& header = *static_cast<Header*>(address_);
+    const uint64_t generation =
+      header.generation.load(std::memory_order_acquire);
+    if (header.arrived.fetch_add(1ul, std::memory_order_acq_rel) + 1ul ==
+        ranks_no_) {
+      header.arrived.store(0ul, std::memory_order_relaxed);
+      header.generation.fetch_add(1ul, std::memory_order_acq_rel);
+      return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t spins = 0;
+         header.generation.load(std::memory_order_acquire) == generation;
+         spins++) {
+      if (spins < 1024ul)
+        continue;
+      std::this_thread::yield();
+      if ((spins & 1023ul) == 0ul &&
+          std::chrono::steady_clock::now() - start >
+          std::chrono::duration<double>(timeout_))
+        throw std::runtime_error("all-reduce " + name_ +
+                                 ": timed out waiting for other ranks");
+    }
+  }
+
+  size_t rank() const { return rank_; }
+  size_t ranks_no() const { return ranks_no_; }
+  size_t size() const { return size_; }
+
+ private:
+  struct Header {
+    std::atomic<uint64_t> ready;
+    std::atomic<uint64_t> arrived;
+    std::atomic<uint64_t> generation;
+    uint64_t session;
+    uint64_t creator;
+    uint64_t ranks_no;
+    uint64_t size;
+    uint64_t value_size;
+  };
+
+  static constexpr uint64_t ready_mark = 0x5245445543455221ul;
+
+  T* _slot(size_t r) const {
+    return reinterpret_cast<T*>(static_cast<char*>(address_) + offset_ +
+                                r * stride_);
+  }
+
+  void _create() {
+    shm_unlink(name_.c_str());
+    const int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+      _fail("cannot create");
+    if (ftruncate(fd, (off_t)length_) != 0) {
+      close(fd);
+      shm_unlink(name_.c_str());
+      _fail("cannot size");
+    }
+    _map(fd);
+    Header* header = new (address_) Header;
+    header->arrived.store(0ul);
+    header->generation.store(0ul);
+    header->ranks_no = ranks_no_;
+    header->size = size_;
+    header->value_size = sizeof(T);
+    header->session = session_;
+    header->creator = (uint64_t)getpid();
+    header->ready.store(ready_mark, std::memory_order_release);
+  }
+
+  /* Waits (up to the timeout) for rank 0 to create and initialize the
+   * segment of this session; segments left by other runs are skipped */
+  void _attach() {
+    const auto start = std::chrono::steady_clock::now();
+    for (;;) {
+      const int fd = shm_open(name_.c_str(), O_RDWR, 0600);
+      struct stat info;
+      if (fd >= 0 && fstat(fd, &info) == 0 &&
+          (size_t)info.st_size == length_) {
+        _map(fd);
+        if (_current()) {
+          const Header& header = *static_cast<const Header*>(address_);
+          if (header.ranks_no != ranks_no_ || header.size != size_ ||
+              header.value_size != sizeof(T)) {
+            munmap(address_, length_);
+            throw std::runtime_error("all-reduce " + name_ +
+                                     ": created for other ranks or sizes");
+          }
+          return;
+        }
+        munmap(address_, length_);
+      } else if (fd >= 0) {
+        close(fd);
+      }
+      if (std::chrono::steady_clock::now() - start >
+          std::chrono::duration<double>(timeout_))
+        _fail("timed out waiting for rank 0 to create");
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  /* Whether the mapped segment is ready, of this session, and its creator
+   * is alive (kill with no signal only checks that the process exists) */
+  bool _current() const {
+    const Header& header = *static_cast<const Header*>(address_);
+    if (header.ready.load(std::memory_order_acquire) != ready_mark ||
+        header.session != session_)
+      return false;
+    return kill((pid_t)header.creator, 0) == 0 || errno == EPERM;
+  }
+
+  void _map(int fd) {
+    address_ = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    close(fd);
+    if (address_ == MAP_FAILED)
+      _fail("cannot map");
+  }
+
+  void _fail(const char* what) const {
+    throw std::runtime_error(std::string("all-reduce: ") + what + " " +
+                             name_ + ": " + std::strerror(errno));
+  }
+
+  std::string name_;
+  size_t rank_;
+  size_t ranks_no_;
+  size_t size_;
+  double timeout_;
+  uint64_t session_;
+  size_t stride_;
+  size_t offset_;
+  size_t length_;
+  size_t chunk_;
+  void* address_;
+};
+
+template<typename T>
+constexpr uint64_t SharedAllReduce<T>::ready_mark;
+
+#endif
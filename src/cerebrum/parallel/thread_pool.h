@@ -0,0 +1,135 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads that live as long as the pool does.
+ *
+ * run(tasks_no, task) calls task(0), ..., task(tasks_no - 1) on the workers
+ * and on the calling thread, and returns when all of them are done. Tasks
+ * are handed out dynamically, so there may be more tasks than threads. Calls
+ * to run() from different threads are serialized; calling run() from inside
+ * a task of the same pool is not supported.
+ */
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads_no = default_size())
+      : task_(nullptr), tasks_no_(0ul), next_(0ul), busy_(0ul),
+        generation_(0ul), stop_(false) {
+    for (size_t t = 1; t < threads_no; t++)
+      workers_.emplace_back(&ThreadPool::work, this);
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (std::thread& worker : workers_)
+      worker.join();
+  }
+
+  /* Number of threads taking part in run(), the caller included */
+  size_t size() const { return workers_.size() + 1ul; }
+
+  template<typename Task>
+  void run(size_t tasks_no, const Task& task) {
+    if (tasks_no == 0ul)
+      return;
+    if (workers_.empty() || tasks_no == 1ul) {
+      for (size_t t = 0; t < tasks_no; t++)
+        task(t);
+      return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    const std::function<void(size_t)> job(std::cref(task));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &job;
+      tasks_no_ = tasks_no;
+      next_.store(0ul);
+      busy_ = workers_.size();
+      generation_++;
+    }
+    start_.notify_all();
+
+    execute(job, tasks_no);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return busy_ == 0ul; });
+    task_ = nullptr;
+  }
+
+  static size_t default_size() {
+    const size_t cores = std::thread::hardware_concurrency();
+    return cores > 0ul ? cores : 1ul;
+  }
+
+ private:
+  void execute(const std::function<void(size_t)>& job, size_t tasks_no) {
+    for (size_t t = next_++; t < tasks_no; t = next_++)
+      job(t);
+  }
+
+  void work() {
+    size_t seen = 0ul;
+    while (true) {
+      const std::function<void(size_t)>* job;
+      size_t tasks_no;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [this, seen]() {
+            return stop_ || generation_ != seen;
+          });
+        if (stop_)
+          return;
+        seen = generation_;
+        job = task_;
+        tasks_no = tasks_no_;
+      }
+
+      execute(*job, tasks_no);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--busy_ == 0ul)
+        done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+
+  const std::function<void(size_t)>* task_;
+  size_t tasks_no_;
+  std::atomic<size_t> next_;
+  size_t busy_;
+  size_t generation_;
+  bool stop_;
+};
+
+/* Process-wide pool with one thread per core */
+
+inline ThreadPool& default_thread_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+#endif
@@ -0,0 +1,161 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Hardware performance counters of the calling thread, read with Linux's
+ * perf_event_open.
+ *
+ *     PerfCounters counters;            // cycles, instructions, LLC and
+ *     counters.start();                 //  dTLB misses by default
+ *     ...
+ *     counters.stop(deltas);            // one value per event
+ *
+ * The events are opened as a single group, so that they are counted over
+ * the same intervals; when the PMU has to multiplex them, the deltas are
+ * scaled by the time the group was enabled over the time it ran. Only user
+ * space is counted, and only on the calling thread: threads started by a
+ * BLAS library are not (use OPENBLAS_NUM_THREADS=1 or the like).
+ *
+ * Events that cannot be opened (not Linux, a virtual machine without a
+ * PMU, perf_event_paranoid too high) are not available; their deltas are
+ * zero. The counters are still usable, with whatever could be opened.
+ */
+
+struct PerfEvent {
+  std::string name;
+  uint32_t type;
+  uint64_t config;
+};
+
+class PerfCounters {
+ public:
+  static std::vector<PerfEvent> default_events() {
+#if defined(__linux__)
+    const uint64_t read_miss =
+      ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    return {
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | read_miss},
+      {"dtlb_misses", PERF_TYPE_HW_CACHE,
+       PERF_COUNT_HW_CACHE_DTLB | read_miss}};
+#else
+    return {{"cycles", 0u, 0ul}, {"instructions", 0u, 0ul},
+            {"llc_misses", 0u, 0ul}, {"dtlb_misses", 0u, 0ul}};
+#endif
+  }
+
+  explicit PerfCounters(const std::vector<PerfEvent>& events =
+                          default_events())
+      : events_(events), fds_(events.size(), -1),
+        slots_(events.size(), -1), opened_(0ul),
+        start_(events.size(), 0.0), now_(events.size(), 0.0),
+        start_enabled_(0.0), start_running_(0.0) {
+#if defined(__linux__)
+    int leader = -1;
+    for (size_t e = 0; e < events_.size(); e++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events_[e].type;
+      attr.config = events_[e].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+      const int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1,
+                                  leader, 0ul);
+      if (fd < 0)
+        continue;
+      if (leader < 0)
+        leader = fd;
+      fds_[e] = fd;
+      slots_[e] = (int)opened_++;
+    }
+    buffer_.resize(3ul + opened_);
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (size_t e = 0; e < events_.size(); e++)
+      if (fds_[e] >= 0)
+        close(fds_[e]);
+#endif
+  }
+
+  size_t size() const { return events_.size(); }
+  const std::string& name(size_t e) const { return events_[e].name; }
+  bool available(size_t e) const { return fds_[e] >= 0; }
+  bool any_available() const { return opened_ > 0ul; }
+
+  void start() {
+    _read(start_, start_enabled_, start_running_);
+  }
+
+  /* deltas[e] gets the count of event e since start() */
+  void stop(double* deltas) {
+    double enabled = 0.0;
+    double running = 0.0;
+    _read(now_, enabled, running);
+    const double ran = running - start_running_;
+    const double scale =
+      ran > 0.0 ? (enabled - start_enabled_) / ran : 1.0;
+    for (size_t e = 0; e < events_.size(); e++)
+      deltas[e] = (now_[e] - start_[e]) * scale;
+  }
+
+ private:
+  void _read(std::vector<double>& values, double& enabled,
+             double& running) {
+    if (!opened_)
+      return;
+#if defined(__linux__)
+    /* nr, time_enabled, time_running, then one value per event */
+    const int leader = fds_[_leader()];
+    if (read(leader, buffer_.data(), buffer_.size() * sizeof(uint64_t)) <= 0)
+      return;
+    enabled = (double)buffer_[1];
+    running = (double)buffer_[2];
+    for (size_t e = 0; e < events_.size(); e++)
+      if (slots_[e] >= 0)
+        values[e] = (double)buffer_[3 + slots_[e]];
+#endif
+  }
+
+  size_t _leader() const {
+    size_t e = 0ul;
+    while (fds_[e] < 0)
+      e++;
+    return e;
+  }
+
+  std::vector<PerfEvent> events_;
+  std::vector<int> fds_;
+  std::vector<int> slots_;                     /* in the group's reads */
+  size_t opened_;
+  std::vector<double> start_;
+  std::vector<double> now_;
+  std::vector<uint64_t> buffer_;
+  double start_enabled_;
+  double start_running_;
+};
+
+#endif
@@ -0,0 +1,83 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+/* Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * 3", SC 2011), a counter-based generator: block b of stream s is a pure
+ * function of (key, s, b), so blocks can be generated in any order, by any
+ * thread, and with no state besides the key. Every block gives four 32-bit
+ * words.
+ *
+ * generate() works on `lanes` blocks at a time, one array per word of the
+ * counter, so the compiler turns every round into a few vector multiplies
+ * and xors.
+ */
+
+class Philox {
+ public:
+  static constexpr size_t lanes = 16ul;
+
+  explicit Philox(uint64_t seed) : key_(seed) { }
+
+  /* Seeded from std::random_device */
+  Philox() {
+    std::random_device rd { };
+    key_ = ((uint64_t)rd() << 32) | (uint64_t)rd();
+  }
+
+  uint64_t key() const { return key_; }
+
+  /* out[4 b + j] = word j of block first_block + b of the stream, for b in
+   * [0, blocks_no) */
+  void generate(uint64_t stream, uint64_t first_block, size_t blocks_no,
+                uint32_t* out) const {
+    for (size_t b = 0; b < blocks_no; b += lanes) {
+      uint32_t x0[lanes], x1[lanes], x2[lanes], x3[lanes];
+      for (size_t l = 0; l < lanes; l++) {
+        const uint64_t block = first_block + b + l;
+        x0[l] = (uint32_t)block;
+        x1[l] = (uint32_t)(block >> 32);
+        x2[l] = (uint32_t)stream;
+        x3[l] = (uint32_t)(stream >> 32);
+      }
+      _rounds(x0, x1, x2, x3);
+      const size_t count = blocks_no - b < lanes ? blocks_no - b : lanes;
+      for (size_t l = 0; l < count; l++) {
+        out[4ul * (b + l)] = x0[l];
+        out[4ul * (b + l) + 1ul] = x1[l];
+        out[4ul * (b + l) + 2ul] = x2[l];
+        out[4ul * (b + l) + 3ul] = x3[l];
+      }
+    }
+  }
+
+ private:
+  inline void _rounds(uint32_t* x0, uint32_t* x1, uint32_t* x2,
+                      uint32_t* x3) const {
+    uint32_t k0 = (uint32_t)key_;
+    uint32_t k1 = (uint32_t)(key_ >> 32);
+    for (size_t r = 0; r < 10ul; r++) {
+      for (size_t l = 0; l < lanes; l++) {
+        const uint64_t p0 = (uint64_t)0xD2511F53u * x0[l];
+        const uint64_t p1 = (uint64_t)0xCD9E8D57u * x2[l];
+        const uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1[l] ^ k0;
+        const uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3[l] ^ k1;
+        x1[l] = (uint32_t)p1;
+        x3[l] = (uint32_t)p0;
+        x0[l] = y0;
+        x2[l] = y2;
+      }
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+  }
+
+  uint64_t key_;
+};
+
+#endif
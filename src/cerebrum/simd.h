@@ -0,0 +1,440 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Vector<T> wraps the widest SIMD register available at compile time
+ * (AVX-512, AVX2 + FMA, SSE2, or plain scalars). Kernels are written once
+ * against this interface and the instruction set is picked by the compiler
+ * flags (e.g. `make native`).
+ *
+ * Besides arithmetic, vectors support what elementary functions need:
+ * comparisons returning a Mask, select(mask, if_true, if_false),
+ * horizontal reductions (reduce_add, reduce_max),
+ * round() to the nearest integer (for |x| < 2^31) and scale2(x, n) = x * 2^n
+ * for integral n that keep 2^n a normal number.
+ */
+
+/* One lane; also used for the tails of vectorized loops */
+
+template<typename T>
+struct ScalarVector {
+  using Type = T;
+  using Mask = bool;
+  static constexpr size_t length = 1ul;
+
+  inline static Type zero() { return (T)0; }
+  inline static Type broadcast(T x) { return x; }
+  inline static Type load(const T* p) { return *p; }
+  inline static Type loadu(const T* p) { return *p; }
+  inline static void store(T* p, Type x) { *p = x; }
+  inline static void storeu(T* p, Type x) { *p = x; }
+  inline static Type add(Type a, Type b) { return a + b; }
+  inline static Type sub(Type a, Type b) { return a - b; }
+  inline static Type mul(Type a, Type b) { return a * b; }
+  inline static Type div(Type a, Type b) { return a / b; }
+  inline static Type sqrt(Type a) { return std::sqrt(a); }
+  inline static Type min(Type a, Type b) { return b < a ? b : a; }
+  inline static Type max(Type a, Type b) { return a < b ? b : a; }
+  inline static Type abs(Type a) { return std::fabs(a); }
+  inline static Mask less(Type a, Type b) { return a < b; }
+  inline static Type select(Mask m, Type a, Type b) { return m ? a : b; }
+  inline static T reduce_add(Type a) { return a; }
+  inline static T reduce_max(Type a) { return a; }
+
+  /* a * b + c and c - a * b, fused whenever the vector code is, so that
+   * tails give the same results as full vectors */
+  inline static Type fma(Type a, Type b, Type c) {
+#if defined(__FMA__) || defined(__AVX512F__)
+    return std::fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+  }
+  inline static Type fnma(Type a, Type b, Type c) { return fma(-a, b, c); }
+
+  /* Ties are rounded away from zero; vectors round them to even */
+  inline static Type round(Type a) {
+    return (T)(long long)(a + (a < (T)0 ? (T)-0.5 : (T)0.5));
+  }
+
+  inline static Type scale2(Type a, Type n) {
+    if (sizeof(T) == 8ul) {
+      const uint64_t bits = (uint64_t)((int64_t)n + 1023) << 52;
+      double factor;
+      std::memcpy(&factor, &bits, sizeof(factor));
+      return a * (T)factor;
+    } else {
+      const uint32_t bits = (uint32_t)((int32_t)n + 127) << 23;
+      float factor;
+      std::memcpy(&factor, &bits, sizeof(factor));
+      return a * (T)factor;
+    }
+  }
+};
+
+template<typename T>
+struct Vector : public ScalarVector<T> { };
+
+#if defined(__AVX512F__)
+
+#define CEREBRUM_SIMD "avx512"
+
+/* The masked forms (with every lane enabled) are used where GCC's plain
+ * intrinsics start from an uninitialized register and warn about it */
+
+template<>
+struct Vector<double> {
+  using Type = __m512d;
+  using Mask = __mmask8;
+  static constexpr size_t length = 8ul;
+
+  inline static Type zero() { return _mm512_setzero_pd(); }
+  inline static Type broadcast(double x) { return _mm512_set1_pd(x); }
+  inline static Type load(const double* p) { return _mm512_load_pd(p); }
+  inline static Type loadu(const double* p) { return _mm512_loadu_pd(p); }
+  inline static void store(double* p, Type x) { _mm512_store_pd(p, x); }
+  inline static void storeu(double* p, Type x) { _mm512_storeu_pd(p, x); }
+  inline static Type add(Type a, Type b) { return _mm512_add_pd(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm512_sub_pd(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm512_mul_pd(a, b); }
+  inline static Type div(Type a, Type b) { return _mm512_div_pd(a, b); }
+  inline static Type sqrt(Type a) { return _mm512_mask_sqrt_pd(a, 0xFF, a); }
+  inline static Type min(Type a, Type b) {
+    return _mm512_mask_min_pd(a, 0xFF, a, b);
+  }
+  inline static Type max(Type a, Type b) {
+    return _mm512_mask_max_pd(a, 0xFF, a, b);
+  }
+  inline static Type abs(Type a) { return _mm512_abs_pd(a); }
+  inline static Mask less(Type a, Type b) {
+    return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+  }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm512_mask_blend_pd(m, b, a);
+  }
+  /* Reductions stay in 512-bit registers: GCC implements the casts to
+   * __m256d with the same uninitialized source */
+  inline static double reduce_add(Type a) {
+    a = _mm512_add_pd(a, _mm512_mask_shuffle_f64x2(a, 0xFF, a, a, 0x4E));
+    a = _mm512_add_pd(a, _mm512_mask_shuffle_f64x2(a, 0xFF, a, a, 0xB1));
+    a = _mm512_add_pd(a, _mm512_mask_permute_pd(a, 0xFF, a, 0x55));
+    return _mm512_cvtsd_f64(a);
+  }
+  inline static double reduce_max(Type a) {
+    a = max(a, _mm512_mask_shuffle_f64x2(a, 0xFF, a, a, 0x4E));
+    a = max(a, _mm512_mask_shuffle_f64x2(a, 0xFF, a, a, 0xB1));
+    a = max(a, _mm512_mask_permute_pd(a, 0xFF, a, 0x55));
+    return _mm512_cvtsd_f64(a);
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm512_fmadd_pd(a, b, c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm512_fnmadd_pd(a, b, c);
+  }
+  inline static Type round(Type a) {
+    return _mm512_mask_roundscale_pd(a, 0xFF, a, _MM_FROUND_TO_NEAREST_INT |
+                                     _MM_FROUND_NO_EXC);
+  }
+  inline static Type scale2(Type a, Type n) {
+    return _mm512_mask_scalef_pd(a, 0xFF, a, n);
+  }
+};
+
+template<>
+struct Vector<float> {
+  using Type = __m512;
+  using Mask = __mmask16;
+  static constexpr size_t length = 16ul;
+
+  inline static Type zero() { return _mm512_setzero_ps(); }
+  inline static Type broadcast(float x) { return _mm512_set1_ps(x); }
+  inline static Type load(const float* p) { return _mm512_load_ps(p); }
+  inline static Type loadu(const float* p) { return _mm512_loadu_ps(p); }
+  inline static void store(float* p, Type x) { _mm512_store_ps(p, x); }
+  inline static void storeu(float* p, Type x) { _mm512_storeu_ps(p, x); }
+  inline static Type add(Type a, Type b) { return _mm512_add_ps(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm512_sub_ps(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm512_mul_ps(a, b); }
+  inline static Type div(Type a, Type b) { return _mm512_div_ps(a, b); }
+  inline static Type sqrt(Type a) {
+    return _mm512_mask_sqrt_ps(a, 0xFFFF, a);
+  }
+  inline static Type min(Type a, Type b) {
+    return _mm512_mask_min_ps(a, 0xFFFF, a, b);
+  }
+  inline static Type max(Type a, Type b) {
+    return _mm512_mask_max_ps(a, 0xFFFF, a, b);
+  }
+  inline static Type abs(Type a) { return _mm512_abs_ps(a); }
+  inline static Mask less(Type a, Type b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+  }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm512_mask_blend_ps(m, b, a);
+  }
+  inline static float reduce_add(Type a) {
+    a = _mm512_add_ps(a, _mm512_mask_shuffle_f32x4(a, 0xFFFF, a, a, 0x4E));
+    a = _mm512_add_ps(a, _mm512_mask_shuffle_f32x4(a, 0xFFFF, a, a, 0xB1));
+    a = _mm512_add_ps(a, _mm512_mask_permute_ps(a, 0xFFFF, a, 0x4E));
+    a = _mm512_add_ps(a, _mm512_mask_permute_ps(a, 0xFFFF, a, 0xB1));
+    return _mm512_cvtss_f32(a);
+  }
+  inline static float reduce_max(Type a) {
+    a = max(a, _mm512_mask_shuffle_f32x4(a, 0xFFFF, a, a, 0x4E));
+    a = max(a, _mm512_mask_shuffle_f32x4(a, 0xFFFF, a, a, 0xB1));
+    a = max(a, _mm512_mask_permute_ps(a, 0xFFFF, a, 0x4E));
+    a = max(a, _mm512_mask_permute_ps(a, 0xFFFF, a, 0xB1));
+    return _mm512_cvtss_f32(a);
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm512_fnmadd_ps(a, b, c);
+  }
+  inline static Type round(Type a) {
+    return _mm512_mask_roundscale_ps(a, 0xFFFF, a, _MM_FROUND_TO_NEAREST_INT |
+                                     _MM_FROUND_NO_EXC);
+  }
+  inline static Type scale2(Type a, Type n) {
+    return _mm512_mask_scalef_ps(a, 0xFFFF, a, n);
+  }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+#define CEREBRUM_SIMD "avx2"
+
+template<>
+struct Vector<double> {
+  using Type = __m256d;
+  using Mask = __m256d;
+  static constexpr size_t length = 4ul;
+
+  inline static Type zero() { return _mm256_setzero_pd(); }
+  inline static Type broadcast(double x) { return _mm256_set1_pd(x); }
+  inline static Type load(const double* p) { return _mm256_load_pd(p); }
+  inline static Type loadu(const double* p) { return _mm256_loadu_pd(p); }
+  inline static void store(double* p, Type x) { _mm256_store_pd(p, x); }
+  inline static void storeu(double* p, Type x) { _mm256_storeu_pd(p, x); }
+  inline static Type add(Type a, Type b) { return _mm256_add_pd(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm256_sub_pd(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm256_mul_pd(a, b); }
+  inline static Type div(Type a, Type b) { return _mm256_div_pd(a, b); }
+  inline static Type sqrt(Type a) { return _mm256_sqrt_pd(a); }
+  inline static Type min(Type a, Type b) { return _mm256_min_pd(a, b); }
+  inline static Type max(Type a, Type b) { return _mm256_max_pd(a, b); }
+  inline static Type abs(Type a) {
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);
+  }
+  inline static Mask less(Type a, Type b) {
+    return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+  }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm256_blendv_pd(b, a, m);
+  }
+  inline static double reduce_add(Type a) {
+    const __m128d x = _mm_add_pd(_mm256_castpd256_pd128(a),
+                                 _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
+  }
+  inline static double reduce_max(Type a) {
+    const __m128d x = _mm_max_pd(_mm256_castpd256_pd128(a),
+                                 _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(x, _mm_unpackhi_pd(x, x)));
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm256_fmadd_pd(a, b, c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm256_fnmadd_pd(a, b, c);
+  }
+  inline static Type round(Type a) {
+    return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT |
+                           _MM_FROUND_NO_EXC);
+  }
+  inline static Type scale2(Type a, Type n) {
+    const __m256i e = _mm256_cvtepi32_epi64(
+      _mm_add_epi32(_mm256_cvtpd_epi32(n), _mm_set1_epi32(1023)));
+    return _mm256_mul_pd(a, _mm256_castsi256_pd(_mm256_slli_epi64(e, 52)));
+  }
+};
+
+template<>
+struct Vector<float> {
+  using Type = __m256;
+  using Mask = __m256;
+  static constexpr size_t length = 8ul;
+
+  inline static Type zero() { return _mm256_setzero_ps(); }
+  inline static Type broadcast(float x) { return _mm256_set1_ps(x); }
+  inline static Type load(const float* p) { return _mm256_load_ps(p); }
+  inline static Type loadu(const float* p) { return _mm256_loadu_ps(p); }
+  inline static void store(float* p, Type x) { _mm256_store_ps(p, x); }
+  inline static void storeu(float* p, Type x) { _mm256_storeu_ps(p, x); }
+  inline static Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+  inline static Type div(Type a, Type b) { return _mm256_div_ps(a, b); }
+  inline static Type sqrt(Type a) { return _mm256_sqrt_ps(a); }
+  inline static Type min(Type a, Type b) { return _mm256_min_ps(a, b); }
+  inline static Type max(Type a, Type b) { return _mm256_max_ps(a, b); }
+  inline static Type abs(Type a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+  }
+  inline static Mask less(Type a, Type b) {
+    return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+  }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm256_blendv_ps(b, a, m);
+  }
+  inline static float reduce_add(Type a) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(a),
+                          _mm256_extractf128_ps(a, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ss(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  inline static float reduce_max(Type a) {
+    __m128 x = _mm_max_ps(_mm256_castps256_ps128(a),
+                          _mm256_extractf128_ps(a, 1));
+    x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_max_ss(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm256_fnmadd_ps(a, b, c);
+  }
+  inline static Type round(Type a) {
+    return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT |
+                           _MM_FROUND_NO_EXC);
+  }
+  inline static Type scale2(Type a, Type n) {
+    const __m256i e =
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_mul_ps(a, _mm256_castsi256_ps(_mm256_slli_epi32(e, 23)));
+  }
+};
+
+#elif defined(__SSE2__)
+
+#define CEREBRUM_SIMD "sse2"
+
+template<>
+struct Vector<double> {
+  using Type = __m128d;
+  using Mask = __m128d;
+  static constexpr size_t length = 2ul;
+
+  inline static Type zero() { return _mm_setzero_pd(); }
+  inline static Type broadcast(double x) { return _mm_set1_pd(x); }
+  inline static Type load(const double* p) { return _mm_load_pd(p); }
+  inline static Type loadu(const double* p) { return _mm_loadu_pd(p); }
+  inline static void store(double* p, Type x) { _mm_store_pd(p, x); }
+  inline static void storeu(double* p, Type x) { _mm_storeu_pd(p, x); }
+  inline static Type add(Type a, Type b) { return _mm_add_pd(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm_sub_pd(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm_mul_pd(a, b); }
+  inline static Type div(Type a, Type b) { return _mm_div_pd(a, b); }
+  inline static Type sqrt(Type a) { return _mm_sqrt_pd(a); }
+  inline static Type min(Type a, Type b) { return _mm_min_pd(a, b); }
+  inline static Type max(Type a, Type b) { return _mm_max_pd(a, b); }
+  inline static Type abs(Type a) {
+    return _mm_andnot_pd(_mm_set1_pd(-0.0), a);
+  }
+  inline static Mask less(Type a, Type b) { return _mm_cmplt_pd(a, b); }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+  }
+  inline static double reduce_add(Type a) {
+    return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+  }
+  inline static double reduce_max(Type a) {
+    return _mm_cvtsd_f64(_mm_max_sd(a, _mm_unpackhi_pd(a, a)));
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm_add_pd(_mm_mul_pd(a, b), c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm_sub_pd(c, _mm_mul_pd(a, b));
+  }
+  inline static Type round(Type a) {
+    return _mm_cvtepi32_pd(_mm_cvtpd_epi32(a));
+  }
+  inline static Type scale2(Type a, Type n) {
+    const __m128i e =
+      _mm_add_epi32(_mm_cvtpd_epi32(n), _mm_set1_epi32(1023));
+    const __m128i bits =
+      _mm_slli_epi64(_mm_unpacklo_epi32(e, _mm_setzero_si128()), 52);
+    return _mm_mul_pd(a, _mm_castsi128_pd(bits));
+  }
+};
+
+template<>
+struct Vector<float> {
+  using Type = __m128;
+  using Mask = __m128;
+  static constexpr size_t length = 4ul;
+
+  inline static Type zero() { return _mm_setzero_ps(); }
+  inline static Type broadcast(float x) { return _mm_set1_ps(x); }
+  inline static Type load(const float* p) { return _mm_load_ps(p); }
+  inline static Type loadu(const float* p) { return _mm_loadu_ps(p); }
+  inline static void store(float* p, Type x) { _mm_store_ps(p, x); }
+  inline static void storeu(float* p, Type x) { _mm_storeu_ps(p, x); }
+  inline static Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+  inline static Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+  inline static Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+  inline static Type div(Type a, Type b) { return _mm_div_ps(a, b); }
+  inline static Type sqrt(Type a) { return _mm_sqrt_ps(a); }
+  inline static Type min(Type a, Type b) { return _mm_min_ps(a, b); }
+  inline static Type max(Type a, Type b) { return _mm_max_ps(a, b); }
+  inline static Type abs(Type a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+  }
+  inline static Mask less(Type a, Type b) { return _mm_cmplt_ps(a, b); }
+  inline static Type select(Mask m, Type a, Type b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+  }
+  inline static float reduce_add(Type a) {
+    const __m128 x = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    return _mm_cvtss_f32(_mm_add_ss(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  inline static float reduce_max(Type a) {
+    const __m128 x = _mm_max_ps(a, _mm_movehl_ps(a, a));
+    return _mm_cvtss_f32(_mm_max_ss(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  inline static Type fma(Type a, Type b, Type c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+  inline static Type fnma(Type a, Type b, Type c) {
+    return _mm_sub_ps(c, _mm_mul_ps(a, b));
+  }
+  inline static Type round(Type a) {
+    return _mm_cvtepi32_ps(_mm_cvtps_epi32(a));
+  }
+  inline static Type scale2(Type a, Type n) {
+    const __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+    return _mm_mul_ps(a, _mm_castsi128_ps(_mm_slli_epi32(e, 23)));
+  }
+};
+
+#else
+
+#define CEREBRUM_SIMD "scalar"
+
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#ifndef VECTOR_MATH_H
+#define VECTOR_MATH_H
+
+#include <cstddef>
+#include <type_traits>
+
+#include "cerebrum/simd.h"
+
+/* Vectorized exp, logistic and tanh for float and double.
+ *
+ * Every function is written once against the Vector<T> interface: the
+ * register versions (exp<V>, logistic<V>, tanh<V>) work on one Vector<T>
+ * or ScalarVector<T>, and the array versions run the register versions
+ * over whole vectors first and finish the tail one element at a time with
+ * ScalarVector<T>, so results do not depend on where an element falls.
+ *
+ * exp(x) = 2^n * exp(r), with n = round(x / ln 2) and r = x - n * ln 2
+ * computed in two steps (Cody-Waite), so |r| <= ln(2) / 2. exp(r) is a
+ * polynomial whose degree is set by the precision policy. Inputs are
+ * clamped to the range where the result is a normal number, so exp never
+ * returns 0 or inf. tanh uses a Cephes approximation below 0.625 and
+ * (exp(2|x|) - 1) / (exp(2|x|) + 1) above.
+ *
+ * Maximum errors in ulps, measured against long double references on
+ * [-86, 86] for floats and [-700, 700] for doubles (tanh on [-10, 10]) with
+ * the AVX-512, AVX2, SSE2 and scalar code, rounded up:
+ *
+ *                          exp    logistic    tanh
+ *     float,  accurate      2        4          5
+ *     float,  fast         44       45         19
+ *     double, accurate      2        3          3
+ *     double, fast        123      124         48
+ *
+ * Fast precision drops the polynomial for exp(r) from degree 6 to 4 (float)
+ * and from 11 to 9 (double). Float divisions may be turned into reciprocal
+ * approximations by -Ofast; the table includes that.
+ */
+
+struct AccuratePrecision { };
+struct FastPrecision { };
+
+template<typename T>
+struct _ExpConstants;
+
+template<>
+struct _ExpConstants<double> {
+  static constexpr double min = -708.0;
+  static constexpr double max = 709.0;
+  static constexpr double ln2_high = 6.93145751953125E-1;
+  static constexpr double ln2_low = 1.42860682030941723212E-6;
+};
+
+template<>
+struct _ExpConstants<float> {
+  static constexpr float min = -87.0f;
+  static constexpr float max = 88.0f;
+  static constexpr float ln2_high = 0.693359375f;
+  static constexpr float ln2_low = -2.12194440e-4f;
+};
+
+/* exp(r) on |r| <= ln(2) / 2, fitted at Chebyshev nodes; the relative
+ * error of each polynomial (before rounding) is given next to its degree */
+
+template<typename T, typename Precision>
+struct _ExpPolynomial;
+
+/* degree 11, 4.3e-18 */
+template<>
+struct _ExpPolynomial<double, AccuratePrecision> {
+  template<typename V, typename Math>
+  inline static typename V::Type evaluate(typename V::Type r) {
+    return Math::template horner<V>(r,
+      1.0, 1.0, 5.00000000000001887379e-1, 1.66666666666666796193e-1,
+      4.16666666664873772130e-2, 8.33333333331954563550e-3,
+      1.38888889525054059874e-3, 1.98412698901937053445e-4,
+      2.48014852783700617150e-5, 2.75572407617392574634e-6,
+      2.76327150716322553292e-7, 2.51100956118862365510e-8);
+  }
+};
+
+/* degree 9, 1.9e-14 */
+template<>
+struct _ExpPolynomial<double, FastPrecision> {
+  template<typename V, typename Math>
+  inline static typename V::Type evaluate(typename V::Type r) {
+    return Math::template horner<V>(r,
+      1.00000000000001354472, 1.00000000000000133227,
+      4.99999999994363397704e-1, 1.66666666666154428267e-1,
+      4.16666670416757783935e-2, 8.33333336741372797396e-3,
+      1.38888015750770251605e-3, 1.98411904889069933174e-4,
+      2.48845427676500564505e-5, 2.76327161100978737409e-6);
+  }
+};
+
+/* degree 6, 2.5e-9 */
+template<>
+struct _ExpPolynomial<float, AccuratePrecision> {
+  template<typename V, typename Math>
+  inline static typename V::Type evaluate(typename V::Type r) {
+    return Math::template horner<V>(r,
+      1.0, 1.00000003782961455201, 5.00000004725939861672e-1,
+      1.66664150112900588674e-1, 4.16663522680825251787e-2,
+      8.37516828895420138712e-3, 1.39411607538254714127e-3);
+  }
+};
+
+/* degree 4, 3.5e-6 */
+template<>
+struct _ExpPolynomial<float, FastPrecision> {
+  template<typename V, typename Math>
+  inline static typename V::Type evaluate(typename V::Type r) {
+    return Math::template horner<V>(r,
+      1.0, 9.99962219048423306411e-1, 4.99993708802734970753e-1,
+      1.67922688836286165825e-1, 4.18758539313210248478e-2);
+  }
+};
+
+template<typename T, typename Precision = AccuratePrecision>
+struct VectorMath {
+  static_assert(std::is_same<T, float>::value ||
+                std::is_same<T, double>::value,
+                "VectorMath supports float and double");
+
+  using Constants = _ExpConstants<T>;
+
+  /* -------------------- One register -------------------- */
+
+  template<typename V>
+  inline static typename V::Type exp(typename V::Type x) {
+    x = V::min(V::max(x, V::broadcast((T)Constants::min)),
+               V::broadcast((T)Constants::max));
+    const typename V::Type n =
+      V::round(V::mul(x, V::broadcast((T)1.44269504088896340736)));
+    typename V::Type r = V::fnma(n, V::broadcast((T)Constants::ln2_high), x);
+    r = V::fnma(n, V::broadcast((T)Constants::ln2_low), _opaque<V>(r));
+    return V::scale2(_ExpPolynomial<T, Precision>::template
+                     evaluate<V, VectorMath>(r), n);
+  }
+
+  template<typename V>
+  inline static typename V::Type logistic(typename V::Type x) {
+    const typename V::Type one = V::broadcast((T)1);
+    return V::div(one, V::add(one, exp<V>(V::sub(V::zero(), x))));
+  }
+
+  /* Both branches end in a division, so it is shared:
+   *   |x| <  0.625:  x (Q + x^2 P) / Q
+   *   |x| >= 0.625:  sign(x) (exp(2|x|) - 1) / (exp(2|x|) + 1)
+   */
+  template<typename V>
+  inline static typename V::Type tanh(typename V::Type x) {
+    const typename V::Type one = V::broadcast((T)1);
+    const typename V::Type ax = V::abs(x);
+    const typename V::Type e = exp<V>(V::add(ax, ax));
+    const typename V::Type large = V::sub(e, one);
+
+    const typename V::Type s = V::mul(x, x);
+    typename V::Type p, q;
+    _small_tanh<V>(s, p, q);
+    const typename V::Type small = V::mul(x, V::fma(s, p, q));
+
+    const typename V::Mask is_small = V::less(ax, V::broadcast((T)0.625));
+    const typename V::Type numerator =
+      V::select(is_small, small,
+                V::select(V::less(x, V::zero()),
+                          V::sub(V::zero(), large), large));
+    return V::div(numerator, V::select(is_small, q, V::add(e, one)));
+  }
+
+  /* c0 + c1 x + c2 x^2 + ... */
+  template<typename V, typename... Coefficients>
+  inline static typename V::Type
+  horner(typename V::Type x, double c0, double c1,
+         Coefficients... coefficients) {
+    return V::fma(horner<V>(x, c1, coefficients...), x,
+                  V::broadcast((T)c0));
+  }
+
+  template<typename V>
+  inline static typename V::Type horner(typename V::Type, double c0) {
+    return V::broadcast((T)c0);
+  }
+
+  /* -------------------- Arrays (y may alias x) -------------------- */
+
+  inline static void exp_array(const T* x, T* y, size_t n) {
+    _apply<_ExpFunction>(x, y, n);
+  }
+
+  inline static void logistic_array(const T* x, T* y, size_t n) {
+    _apply<_LogisticFunction>(x, y, n);
+  }
+
+  inline static void tanh_array(const T* x, T* y, size_t n) {
+    _apply<_TanhFunction>(x, y, n);
+  }
+
+ private:
+  /* Without FMA, -Ofast (the default build) may reassociate the two steps
+   * of the Cody-Waite reduction back into one, losing the low bits of r */
+  template<typename V>
+  inline static typename V::Type _opaque(typename V::Type x) {
+#if defined(__GNUC__) && !defined(__FMA__)
+#if defined(__SSE2__)
+    __asm__("" : "+x"(x));
+#else
+    __asm__("" : "+m"(x));
+#endif
+#endif
+    return x;
+  }
+
+  struct _ExpFunction {
+    template<typename V>
+    inline static typename V::Type f(typename V::Type x) {
+      return exp<V>(x);
+    }
+  };
+
+  struct _LogisticFunction {
+    template<typename V>
+    inline static typename V::Type f(typename V::Type x) {
+      return logistic<V>(x);
+    }
+  };
+
+  struct _TanhFunction {
+    template<typename V>
+    inline static typename V::Type f(typename V::Type x) {
+      return tanh<V>(x);
+    }
+  };
+
+  template<typename Function>
+  inline static void _apply(const T* x, T* y, size_t n) {
+    using V = Vector<T>;
+    using S = ScalarVector<T>;
+    const size_t body = n - n % V::length;
+    for (size_t i = 0ul; i < body; i += V::length)
+      V::storeu(y + i, Function::template f<V>(V::loadu(x + i)));
+    for (size_t i = body; i < n; i++)
+      y[i] = Function::template f<S>(x[i]);
+  }
+
+  /* tanh(x) = x (Q(x^2) + x^2 P(x^2)) / Q(x^2) on |x| < 0.625, with P / Q
+   * from Cephes: a rational function for doubles, a polynomial for floats */
+  template<typename V>
+  inline static void
+  _small_tanh(typename V::Type s, typename V::Type& p, typename V::Type& q) {
+    if (sizeof(T) == sizeof(double)) {
+      p = horner<V>(s, -1.61468768441708447952E3, -9.92877231001918586564E1,
+                    -9.64399179425052238628E-1);
+      q = horner<V>(s, 4.84406305325125486048E3, 2.23548839060100448583E3,
+                    1.12811678491632931402E2, 1.0);
+    } else {
+      p = horner<V>(s, -3.33332819422E-1, 1.33314422036E-1,
+                    -5.37397155531E-2, 2.06390887954E-2, -5.70498872745E-3);
+      q = V::broadcast((T)1);
+    }
+  }
+};
+
+#endif
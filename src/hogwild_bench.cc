@@ -0,0 +1,111 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "cerebrum/size.h"
+#include "cerebrum/neural_networks.h"
+
+/* Throughput of Hogwild! training against the number of threads.
+ *
+ * The batches are made up in advance (the labels come from a fixed random
+ * linear model, so there is something to learn), then every configuration
+ * trains fresh parameters for the same number of steps. The error column
+ * is SoftMax's mean log-likelihood, which rises toward 0 as the model
+ * learns.
+ */
+
+template<typename NN, size_t batch_size>
+struct Batches {
+  using Inputs = std::array<std::array<typename NN::DataType,
+                                       NN::InputSize::length>, batch_size>;
+  using Labels = std::array<std::array<typename NN::DataType,
+                                       NN::OutputSize::length>, batch_size>;
+
+  explicit Batches(size_t batches_no)
+      : inputs(batches_no), labels(batches_no) {
+    using T = typename NN::DataType;
+    std::default_random_engine e{42};
+    std::uniform_real_distribution<T> next(-1, 1);
+    std::vector<T> model(NN::InputSize::length * NN::OutputSize::length);
+    for (T& w : model)
+      w = next(e);
+    for (size_t b = 0; b < batches_no; b++) {
+      for (size_t n = 0; n < batch_size; n++) {
+        for (T& x : inputs[b][n])
+          x = next(e);
+        size_t best = 0;
+        T best_score = (T)0;
+        for (size_t c = 0; c < NN::OutputSize::length; c++) {
+          T score = (T)0;
+          for (size_t j = 0; j < NN::InputSize::length; j++)
+            score += model[c * NN::InputSize::length + j] * inputs[b][n][j];
+          if (c == 0 || score > best_score) {
+            best = c;
+            best_score = score;
+          }
+          labels[b][n][c] = (T)0;
+        }
+        labels[b][n][best] = (T)1;
+      }
+    }
+  }
+
+  std::vector<Inputs> inputs;
+  std::vector<Labels> labels;
+};
+
+template<typename NN, size_t batch_size>
+void bench(size_t steps_no) {
+  using H = typename NN::template Hogwild<batch_size, SoftMax, SGD>;
+  using T = typename NN::DataType;
+  Batches<NN, batch_size> data(256);
+  const auto source = [&data](size_t step, typename H::Inputs& inputs,
+                              typename H::NetOutputs& labels) {
+    inputs = data.inputs[step % data.inputs.size()];
+    labels = data.labels[step % data.labels.size()];
+  };
+
+  const size_t cores = std::thread::hardware_concurrency();
+  std::cout << "hardware threads: " << cores << std::endl
+            << "threads  striped  steps/s  examples/s  speedup     error"
+            << std::endl;
+  double single = 0.0;
+  for (size_t threads_no = 1; threads_no <= std::max<size_t>(8ul, cores);
+       threads_no *= 2) {
+    for (int striped = 1; striped >= 0; striped--) {
+      typename NN::Parameters* p = new typename NN::Parameters;
+      H* h = new H(*p, threads_no, SGD<T>(0.001), striped);
+      h->train(threads_no * 4, source);                          /* warm up */
+      const auto a = std::chrono::steady_clock::now();
+      const T error = h->train(steps_no, source);
+      const auto b = std::chrono::steady_clock::now();
+      const double seconds = std::chrono::duration<double>(b - a).count();
+      const double rate = steps_no / seconds;
+      if (threads_no == 1 && striped)
+        single = rate;
+      std::cout << std::setw(7) << threads_no << std::setw(9)
+                << (striped ? "yes" : "no") << std::setw(9)
+                << std::fixed << std::setprecision(0) << rate
+                << std::setw(12) << rate * batch_size << std::setw(9)
+                << std::setprecision(2) << rate / single << std::setw(10)
+                << std::setprecision(3) << error << std::endl;
+      delete h;
+      delete p;
+    }
+  }
+}
+
+int main() {
+  using NN = FeedForwardNet<float,
+                            Size<784>,
+                            FullyConnected<256, ReLU>,
+                            FullyConnected<128, ReLU>,
+                            FullyConnected<10, Identity>>;
+  bench<NN, 16>(2000);
+  return 0;
+}
@@ -0,0 +1,810 @@
+// Copyright (C) 2015 Tudor Berariu <tudor.berariu@gmail.com>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <immintrin.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cerebrum/size.h"
+#include "cerebrum/half.h"
+#include "cerebrum/neural_networks.h"
+#include "cerebrum/linear_algebra/gemm.h"
+#include "cerebrum/parallel/shared_all_reduce.h"
+
+/* -------------------- Matrix multiplication -------------------- */
+
+/* Writes op(A) * op(B) (C keeps the partial sums) to out, and counts how
+ * many times finish() reached every element */
+template<typename T>
+struct _CopyEpilogue : PartialSumEpilogue<T> {
+  T* out;
+  size_t* finished;
+  size_t ldo;
+
+  inline void
+  finish(size_t i, size_t j, size_t rows, size_t cols, const T* tile,
+         size_t ld_tile, T* c, size_t ldc, bool first) const {
+    for (size_t r = 0; r < rows; r++)
+      for (size_t q = 0; q < cols; q++) {
+        out[(i + r) * ldo + j + q] =
+          (first ? (T)0 : c[r * ldc + q]) + tile[r * ld_tile + q];
+        finished[(i + r) * ldo + j + q]++;
+      }
+  }
+};
+
+/* gemm against a naive triple loop, with padded leading dimensions */
+template<typename T, bool trans_a, bool trans_b>
+bool _test_gemm(size_t m, size_t n, size_t k, const char* name) {
+  const size_t a_rows = trans_a ? k : m, a_cols = trans_a ? m : k;
+  const size_t b_rows = trans_b ? n : k, b_cols = trans_b ? k : n;
+  const size_t lda = a_cols + 3ul, ldb = b_cols + 5ul, ldc = n + 2ul;
+  std::default_random_engine e(m * 10007ul + n * 101ul + k);
+  std::uniform_real_distribution<T> next(-1.0, 1.0);
+  std::vector<T> a(std::max<size_t>(1ul, a_rows * lda));
+  std::vector<T> b(std::max<size_t>(1ul, b_rows * ldb));
+  std::vector<T> c(std::max<size_t>(1ul, m * ldc));
+  for (T& x : a) x = next(e);
+  for (T& x : b) x = next(e);
+  for (T& x : c) x = next(e);
+
+  const T alpha = (T)0.5, beta = (T)-2.0;
+  std::vector<T> expected(c);
+  std::vector<T> product(m * n);
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < n; j++) {
+      double sum = 0.0;
+      for (size_t p = 0; p < k; p++)
+        sum += (double)(trans_a ? a[p * lda + i] : a[i * lda + p]) *
+          (double)(trans_b ? b[j * ldb + p] : b[p * ldb + j]);
+      product[i * n + j] = (T)sum;
+      expected[i * ldc + j] = (T)(alpha * sum + beta * c[i * ldc + j]);
+    }
+
+  std::vector<T> scaled(c);
+  gemm<trans_a, trans_b>(m, n, k, alpha, a.data(), lda, b.data(), ldb, beta,
+                         scaled.data(), ldc);
+
+  std::vector<T> partial(c);
+  std::vector<T> out(m * n, std::numeric_limits<T>::quiet_NaN());
+  std::vector<size_t> finished(m * n, 0ul);
+  _CopyEpilogue<T> epilogue;
+  epilogue.out = out.data();
+  epilogue.finished = finished.data();
+  epilogue.ldo = n;
+  gemm<trans_a, trans_b>(m, n, k, a.data(), lda, b.data(), ldb,
+                         partial.data(), ldc, epilogue);
+
+  const T tolerance =
+    (T)16 * std::numeric_limits<T>::epsilon() * (T)(k + 1ul);
+  T scaled_error = 0, epilogue_error = 0;
+  bool once = true, untouched = true;
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      scaled_error = std::max(scaled_error, std::fabs(
+          scaled[i * ldc + j] - expected[i * ldc + j]));
+      epilogue_error = std::max(epilogue_error, std::fabs(
+          out[i * n + j] - product[i * n + j]));
+      once &= finished[i * n + j] == 1ul;
+    }
+    for (size_t j = n; j < ldc; j++)
+      untouched &= scaled[i * ldc + j] == c[i * ldc + j];
+  }
+  bool ok = true;
+  if (!(scaled_error <= tolerance) || !untouched) {
+    std::cout << name << " " << m << "x" << n << "x" << k
+              << ": C = alpha op(A) op(B) + beta C is off by "
+              << scaled_error << (untouched ? "" : " (padding written)")
+              << std::endl;
+    ok = false;
+  }
+  if (!(epilogue_error <= tolerance) || !once) {
+    std::cout << name << " " << m << "x" << n << "x" << k
+              << ": the epilogue got sums off by " << epilogue_error
+              << (once ? "" : " (finish() not called once per element)")
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+/* Sizes that are not multiples of mr, nr, kc or mc, more than one kc
+ * block (so partial() runs before finish()) and an empty product */
+template<typename T, bool trans_a, bool trans_b>
+bool test_gemm(const char* name) {
+  using Blocking = GemmBlocking<T>;
+  const size_t mr = Blocking::mr, nr = Blocking::nr, kc = Blocking::kc;
+  const size_t mc = Blocking::mc;
+  bool ok = true;
+  ok &= _test_gemm<T, trans_a, trans_b>(1, 1, 1, name);
+  ok &= _test_gemm<T, trans_a, trans_b>(mr + 1, nr - 1, 7, name);
+  ok &= _test_gemm<T, trans_a, trans_b>(2 * mr - 1, 2 * nr + 3, kc + 1,
+                                        name);
+  ok &= _test_gemm<T, trans_a, trans_b>(mc + 5, nr + 1, 2 * kc + 13, name);
+  ok &= _test_gemm<T, trans_a, trans_b>(mr + 3, nr + 5, 0, name);
+  return ok;
+}
+
+/* -------------------- Backpropagation -------------------- */
+
+/* computeGradient against central differences of the error, for every
+ * parameter; SoftMax's gradient is the one of minus its log-likelihood */
+template<template<typename> class ErrorFunction>
+bool test_gradient(const char* name) {
+  using NN = FeedForwardNet<double, Size<5>,
+                            FullyConnected<7, Logistic>,
+                            FullyConnected<6, HyperbolicTangent>,
+                            FullyConnected<5, ReLU>,
+                            FullyConnected<4, Identity>>;
+  constexpr size_t batch_size = 3;
+  using GC = typename NN::template GradientComputation<batch_size,
+                                                       ErrorFunction>;
+  const double sign =
+    std::is_same<ErrorFunction<double>, SoftMax<double>>::value ? -1.0 : 1.0;
+
+  std::default_random_engine e(23);
+  std::uniform_real_distribution<double> next(-1.0, 1.0);
+  typename GC::Inputs* x = new typename GC::Inputs;
+  typename GC::NetOutputs* t = new typename GC::NetOutputs;
+  for (size_t n = 0; n < batch_size; n++) {
+    for (double& v : (*x)[n])
+      v = next(e);
+    for (size_t i = 0; i < (*t)[n].size(); i++)
+      (*t)[n][i] = sign < 0.0 ? (double)(i == n) : next(e);
+  }
+  typename NN::Parameters* p = new typename NN::Parameters(-1.0, 1.0);
+  typename NN::Parameters* g = new typename NN::Parameters(0.0);
+  GC* gc = new GC;
+  gc->computeGradient(*x, *p, *t, *g);
+
+  const double h = 1e-6;
+  double max_error = 0.0;
+  size_t worst = 0;
+  for (size_t i = 0; i < NN::Parameters::size(); i++) {
+    const double w = p->data()[i];
+    p->data()[i] = w + h;
+    gc->forward(*x, *p);
+    const double plus = sign * gc->error(*t);
+    p->data()[i] = w - h;
+    gc->forward(*x, *p);
+    const double minus = sign * gc->error(*t);
+    p->data()[i] = w;
+    const double error = std::fabs((plus - minus) / (2.0 * h) - g->data()[i])
+      / std::max(1.0, std::fabs(g->data()[i]));
+    if (error > max_error) {
+      max_error = error;
+      worst = i;
+    }
+  }
+  const bool ok = max_error < 1e-6;
+  if (!ok)
+    std::cout << name << ": gradient of parameter " << worst
+              << " differs from central differences by " << max_error
+              << std::endl;
+  delete gc;
+  delete g;
+  delete p;
+  delete t;
+  delete x;
+  return ok;
+}
+
+/* -------------------- Pipeline parallelism -------------------- */
+
+using PipelineNet = FeedForwardNet<float, Size<20>,
+                                   FullyConnected<32, ReLU>,
+                                   FullyConnected<24, HyperbolicTangent>,
+                                   FullyConnected<16, Logistic>,
+                                   FullyConnected<10, Identity>>;
+
+/* Largest difference between two gradients, relative to the larger of 1
+ * and the reference value */
+template<typename Parameters>
+float _gradient_difference(const Parameters& g, const Parameters& expected) {
+  float difference = 0.0f;
+  for (size_t i = 0; i < Parameters::size(); i++)
+    difference = std::max(difference,
+                          std::fabs(g.data()[i] - expected.data()[i]) /
+                          std::max(1.0f, std::fabs(expected.data()[i])));
+  return difference;
+}
+
+/* The pipeline must give the gradient and the error of GradientComputation
+ * (up to the order of the sums over micro-batches), on the first call that
+ * balances the stages, on the calls after it and with a given split */
+template<size_t micro_batches_no, size_t stages_no>
+bool test_pipeline(const char* name) {
+  using NN = PipelineNet;
+  constexpr size_t batch_size = 8;
+  constexpr size_t layers_no = 4;
+  using GC = NN::GradientComputation<batch_size, SoftMax>;
+  using PGC = NN::PipelineGradientComputation<batch_size, SoftMax,
+                                              micro_batches_no, stages_no>;
+
+  std::default_random_engine e(29);
+  std::uniform_real_distribution<float> next(-1.0f, 1.0f);
+  GC::Inputs* x = new GC::Inputs;
+  GC::NetOutputs* t = new GC::NetOutputs;
+  for (size_t n = 0; n < batch_size; n++) {
+    for (float& v : (*x)[n])
+      v = next(e);
+    for (size_t i = 0; i < (*t)[n].size(); i++)
+      (*t)[n][i] = (float)(i == n % (*t)[n].size());
+  }
+  NN::Parameters* p = new NN::Parameters(-0.5f, 0.5f);
+  NN::Parameters* expected = new NN::Parameters(0.0f);
+  GC* gc = new GC;
+  const float expected_error = gc->computeGradient(*x, *p, *t, *expected);
+
+  std::vector<size_t> split(stages_no);
+  for (size_t s = 0; s < stages_no; s++)
+    split[s] = s * layers_no / stages_no;
+  PGC* balanced = new PGC;
+  PGC* given = new PGC(split);
+  PGC* runs[3] = {balanced, balanced, given};
+  const char* calls[3] = {"balancing call", "balanced call", "given split"};
+
+  bool ok = true;
+  for (size_t r = 0; r < 3; r++) {
+    NN::Parameters* g = new NN::Parameters(1.0f);
+    const float error = runs[r]->computeGradient(*x, *p, *t, *g);
+    const float difference = _gradient_difference(*g, *expected);
+    if (!(difference <= 5e-7f) ||
+        !(std::fabs(error - expected_error) <=
+          5e-7f * std::max(1.0f, std::fabs(expected_error)))) {
+      std::cout << name << " (" << calls[r] << "): gradient off by "
+                << difference << ", error " << error << " instead of "
+                << expected_error << std::endl;
+      ok = false;
+    }
+    delete g;
+  }
+  if (balanced->stages().size() != stages_no) {
+    std::cout << name << ": the first call did not balance the stages"
+              << std::endl;
+    ok = false;
+  }
+  delete given;
+  delete balanced;
+  delete gc;
+  delete expected;
+  delete p;
+  delete t;
+  delete x;
+  return ok;
+}
+
+/* set_stages keeps the split it has when given a wrong one */
+bool test_pipeline_stages(const char* name) {
+  using PGC = PipelineNet::PipelineGradientComputation<8, SoftMax, 2, 3>;
+  const std::vector<std::vector<size_t>> wrong = {
+    {}, {0, 1}, {1, 2, 3}, {0, 2, 2}, {0, 3, 1}, {0, 1, 4}
+  };
+  PGC* pgc = new PGC({0, 1, 3});
+  bool ok = true;
+  for (const std::vector<size_t>& split : wrong) {
+    bool thrown = false;
+    try {
+      pgc->set_stages(split);
+    } catch (const std::invalid_argument&) {
+      thrown = true;
+    }
+    if (!thrown || pgc->stages() != std::vector<size_t>({0, 1, 3})) {
+      std::cout << name << ": a wrong split of " << split.size()
+                << " stages was accepted" << std::endl;
+      ok = false;
+    }
+  }
+  delete pgc;
+  return ok;
+}
+
+/* -------------------- Int8 inference -------------------- */
+
+/* The constructors of Parameters draw from std::random_device: tests
+ * whose bounds depend on the weights draw them from a seeded engine, with
+ * the distribution of FullyConnected's initial weights */
+template<typename Parameters>
+void _seeded_parameters(Parameters& parameters, unsigned seed) {
+  using T = typename Parameters::DataType;
+  std::default_random_engine e(seed);
+  std::normal_distribution<T> next((T)0, (T)0.1);
+  for (size_t l = 0; l < Parameters::layers_no; l++)
+    for (size_t i = 0; i < parameters.layer_size(l); i++)
+      parameters.layer_data(l)[i] = next(e);
+}
+
+/* Calibrated on a few batches, the quantized network must stay close to
+ * the float one on another batch (with inputs around 0, so the first
+ * layer has a zero point) of which only `rows` rows are used, and pick the
+ * same class unless the float network's two best classes are closer than
+ * the error allowed */
+bool test_quantized(const char* name) {
+  using NN = FeedForwardNet<float, Size<64>,
+                            FullyConnected<128, ReLU>,
+                            Dropout<96>,
+                            FullyConnected<64, ReLU>,
+                            FullyConnected<10, Identity>>;
+  constexpr size_t batch_size = 32;
+  constexpr size_t samples_no = 4;
+  constexpr size_t rows = 27;
+  using FC = NN::ForwardComputation<batch_size, SoftMax>;
+  using QC = NN::QuantizedInferenceComputation<batch_size, SoftMax>;
+
+  std::default_random_engine e(31);
+  std::uniform_real_distribution<float> next(-1.0f, 1.0f);
+  FC::Inputs* x = new FC::Inputs[samples_no + 1];
+  for (size_t b = 0; b <= samples_no; b++)
+    for (size_t n = 0; n < batch_size; n++)
+      for (float& v : x[b][n])
+        v = next(e);
+  NN::Parameters* p = new NN::Parameters(0.0f);
+  _seeded_parameters(*p, 37);
+  FC* fc = new FC;
+  QC* qc = new QC;
+  qc->calibrate(*p, x, samples_no);
+  const FC::NetOutputs& expected = fc->forward(x[samples_no], *p);
+  const QC::NetOutputs& y = qc->forward(x[samples_no], rows);
+
+  constexpr float bound = 5e-3f;
+  float max_error = 0.0f;
+  size_t agreed = 0;
+  for (size_t n = 0; n < rows; n++) {
+    for (size_t i = 0; i < y[n].size(); i++)
+      max_error = std::max(max_error, std::fabs(y[n][i] - expected[n][i]));
+    const size_t best = std::max_element(y[n].begin(), y[n].end()) -
+      y[n].begin();
+    agreed += expected[n][best] + 2.0f * bound >=
+      *std::max_element(expected[n].begin(), expected[n].end());
+  }
+  const bool ok = max_error <= bound && agreed == rows;
+  if (!ok)
+    std::cout << name << ": probabilities off by " << max_error << ", "
+              << rows - agreed << " of " << rows << " examples in another"
+              << " class" << std::endl;
+  delete qc;
+  delete fc;
+  delete p;
+  delete[] x;
+  return ok;
+}
+
+/* -------------------- Convolution -------------------- */
+
+/* Output map o only sees the input maps i with Mapping(o, i) */
+using SparseMapping = MetaMatrix<bool, 2ul, 3ul,
+                                 true, false, true,
+                                 false, true, false>;
+
+/* Parameters filled with one value (or drawn from an interval) are not
+ * zero between unconnected maps: the forward pass must ignore them. */
+template<size_t conv_size, size_t stride>
+bool test_sparse_convolution(const char* name) {
+  using InputSize = Size<3, 13, 13>;
+  using Layer = Convolution<0, conv_size, conv_size, stride, SparseMapping,
+                            Identity>;
+  using NN = FeedForwardNet<double, InputSize, Layer>;
+  using OutputSize = typename NN::OutputSize;
+  constexpr size_t batch_size = 2;
+  using FC = typename NN::template ForwardComputation<batch_size,
+                                                      SumOfSquares>;
+
+  std::default_random_engine e(17);
+  std::uniform_real_distribution<double> next(-1.0, 1.0);
+  typename FC::Inputs* x = new typename FC::Inputs;
+  for (size_t n = 0; n < batch_size; n++)
+    for (size_t j = 0; j < InputSize::length; j++)
+      (*x)[n][j] = next(e);
+
+  bool ok = true;
+  for (int fill = 0; fill < 2; fill++) {
+    typename NN::Parameters* p = fill == 0 ?
+      new typename NN::Parameters(0.5) :
+      new typename NN::Parameters(-1.0, 1.0);
+    FC* fc = new FC;
+    const auto& y = fc->forward(*x, *p);
+
+    const double* bias = p->values.data();
+    const double* weights = bias + OutputSize::maps_no;
+    double max_error = 0.0;
+    for (size_t n = 0; n < batch_size; n++)
+      for (size_t o = 0; o < OutputSize::maps_no; o++)
+        for (size_t r = 0; r < OutputSize::height; r++)
+          for (size_t c = 0; c < OutputSize::width; c++) {
+            double expected = bias[o];
+            for (size_t m = 0; m < InputSize::maps_no; m++) {
+              if (!SparseMapping::get(o, m))
+                continue;
+              for (size_t i = 0; i < conv_size; i++)
+                for (size_t j = 0; j < conv_size; j++)
+                  expected +=
+                    weights[((o * InputSize::maps_no + m) * conv_size + i) *
+                            conv_size + j] *
+                    (*x)[n][(m * InputSize::height + r * stride + i) *
+                            InputSize::width + c * stride + j];
+            }
+            const double actual =
+              y[n][(o * OutputSize::height + r) * OutputSize::width + c];
+            max_error = std::max(max_error, std::fabs(actual - expected));
+          }
+    if (max_error > 1e-9) {
+      std::cout << name << ": output differs from the masked convolution"
+                << " by " << max_error << std::endl;
+      ok = false;
+    }
+    delete fc;
+    delete p;
+  }
+  delete x;
+  return ok;
+}
+
+/* -------------------- Gradient checkpointing -------------------- */
+
+/* The checkpointed computation must hold less than the plain one */
+template<typename NN, size_t batch_size>
+bool test_checkpointing_memory(const char* name) {
+  using GC = typename NN::template GradientComputation<batch_size, SoftMax>;
+  using CGC =
+    typename NN::template CheckpointedGradientComputation<batch_size,
+                                                          SoftMax>;
+  if (CGC::footprint() < sizeof(GC))
+    return true;
+  std::cout << name << ": checkpointing uses " << CGC::footprint()
+            << " bytes, without it " << sizeof(GC) << std::endl;
+  return false;
+}
+
+using DeepNet = FeedForwardNet<float, Size<256>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<256, ReLU>,
+                               FullyConnected<10, Identity>>;
+
+using ConvNet = FeedForwardNet<float, Size<1, 28, 28>,
+                               Convolution<8, 5, 5, 1, FullConnection, ReLU>,
+                               MaxPooling<2, 2>,
+                               Convolution<16, 5, 5, 1, FullConnection,
+                                           ReLU>,
+                               MaxPooling<2, 2>,
+                               FullyConnected<64, ReLU>,
+                               FullyConnected<32, ReLU>,
+                               FullyConnected<10, Identity>>;
+
+/* -------------------- Shared memory all-reduce -------------------- */
+
+/* Rank r adds (r + 1) * (i + 1) + call / 2 at position i: the sums are
+ * exact in double, so every rank must get exactly the expected values */
+bool _all_reduce_rank(const std::string& name, size_t rank, size_t ranks_no,
+                      size_t size, size_t calls_no, uint64_t session) {
+  SharedAllReduce<double> all_reduce(name, rank, ranks_no, size, 10.0,
+                                     session);
+  std::vector<double> data(size);
+  for (size_t call = 0; call < calls_no; call++) {
+    for (size_t i = 0; i < size; i++)
+      data[i] = (double)((rank + 1ul) * (i + 1ul)) + 0.5 * (double)call;
+    all_reduce.all_reduce(data.data());
+    const double ranks_sum = (double)(ranks_no * (ranks_no + 1ul) / 2ul);
+    for (size_t i = 0; i < size; i++)
+      if (data[i] != ranks_sum * (double)(i + 1ul) +
+          0.5 * (double)(call * ranks_no))
+        return false;
+  }
+  return true;
+}
+
+/* Forks ranks_no - 1 processes and runs rank 0 in this one */
+bool test_shared_all_reduce(size_t ranks_no, size_t size, const char* name) {
+  const std::string segment =
+    "/cerebrum_tests_" + std::to_string(getpid()) + "_" +
+    std::to_string(ranks_no);
+  const uint64_t session = (uint64_t)getpid();
+  constexpr size_t calls_no = 5;
+  std::vector<pid_t> children;
+  for (size_t rank = 1; rank < ranks_no; rank++) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      bool ok;
+      try {
+        ok = _all_reduce_rank(segment, rank, ranks_no, size, calls_no,
+                              session);
+      } catch (...) {
+        ok = false;
+      }
+      _exit(ok ? 0 : 1);
+    }
+    children.push_back(pid);
+  }
+  bool ok;
+  try {
+    ok = _all_reduce_rank(segment, 0ul, ranks_no, size, calls_no, session);
+  } catch (const std::exception& e) {
+    std::cout << name << ": " << e.what() << std::endl;
+    ok = false;
+  }
+  for (pid_t pid : children) {
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+      ok = false;
+  }
+  if (!ok)
+    std::cout << name << ": a rank did not get the exact sums" << std::endl;
+  return ok;
+}
+
+/* The other rank attaches, then leaves without calling all_reduce: rank 0
+ * must throw once the timeout has passed instead of waiting forever */
+bool test_shared_all_reduce_timeout(const char* name) {
+  const std::string segment =
+    "/cerebrum_tests_" + std::to_string(getpid()) + "_timeout";
+  const uint64_t session = (uint64_t)getpid();
+  constexpr size_t size = 100;
+  const pid_t pid = fork();
+  if (pid == 0) {
+    try {
+      SharedAllReduce<double> all_reduce(segment, 1ul, 2ul, size, 10.0,
+                                         session);
+    } catch (...) {
+      _exit(1);
+    }
+    _exit(0);
+  }
+  bool ok = false;
+  try {
+    SharedAllReduce<double> all_reduce(segment, 0ul, 2ul, size, 0.2,
+                                       session);
+    std::vector<double> data(size, 1.0);
+    all_reduce.all_reduce(data.data());
+    std::cout << name << ": all_reduce returned without the other rank"
+              << std::endl;
+  } catch (const std::runtime_error& e) {
+    ok = std::strstr(e.what(), "timed out waiting for other ranks") !=
+      nullptr;
+    if (!ok)
+      std::cout << name << ": unexpected error: " << e.what() << std::endl;
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return ok;
+}
+
+/* -------------------- Checkpoints -------------------- */
+
+using CheckpointNet = FeedForwardNet<double, Size<1, 8, 8>,
+                                     Convolution<2, 3, 3, 1, FullConnection,
+                                                 ReLU>,
+                                     MaxPooling<2, 2>,
+                                     Dropout<12>,
+                                     FullyConnected<5, Logistic>>;
+
+/* The same sizes, with another transfer function in the last layer */
+using OtherCheckpointNet = FeedForwardNet<double, Size<1, 8, 8>,
+                                          Convolution<2, 3, 3, 1,
+                                                      FullConnection, ReLU>,
+                                          MaxPooling<2, 2>,
+                                          Dropout<12>,
+                                          FullyConnected<5,
+                                                         HyperbolicTangent>>;
+
+/* Whether f throws a runtime_error that mentions `what` */
+template<typename F>
+bool _throws(F f, const char* what) {
+  try {
+    f();
+  } catch (const std::runtime_error& e) {
+    return std::strstr(e.what(), what) != nullptr;
+  }
+  return false;
+}
+
+/* Saved parameters come back byte for byte, whether loaded or mapped; a
+ * flipped byte of the arena and another network are rejected */
+bool test_checkpoint(const char* name) {
+  using NN = CheckpointNet;
+  using Parameters = NN::Parameters;
+  const std::string path =
+    "/tmp/cerebrum_tests_" + std::to_string(getpid()) + ".ckpt";
+  constexpr size_t bytes = Parameters::size() * sizeof(double);
+
+  Parameters* saved = new Parameters(-1.0, 1.0);
+  Parameters* loaded = new Parameters(0.0);
+  bool ok = true;
+  save_checkpoint(*saved, path);
+  load_checkpoint(*loaded, path);
+  if (std::memcmp(loaded->data(), saved->data(), bytes)) {
+    std::cout << name << ": loaded parameters differ" << std::endl;
+    ok = false;
+  }
+  {
+    NN::MappedParameters mapped(path);
+    if (std::memcmp(mapped.parameters().data(), saved->data(), bytes) ||
+        mapped.parameters().layer_data(3ul) - mapped.parameters().data() !=
+        saved->layer_data(3ul) - saved->data()) {
+      std::cout << name << ": mapped parameters differ" << std::endl;
+      ok = false;
+    }
+  }
+
+  OtherCheckpointNet::Parameters* other =
+    new OtherCheckpointNet::Parameters(0.0);
+  if (!_throws([&path, other]() { load_checkpoint(*other, path); },
+               "saved from a different network")) {
+    std::cout << name << ": loaded into another network" << std::endl;
+    ok = false;
+  }
+  delete other;
+
+  _CheckpointHeader header;
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    const std::streamoff at = (std::streamoff)(header.data_offset + 13ul);
+    char byte;
+    file.seekg(at);
+    file.read(&byte, 1);
+    byte ^= 0x10;
+    file.seekp(at);
+    file.write(&byte, 1);
+  }
+  if (!_throws([&path, loaded]() { load_checkpoint(*loaded, path); },
+               "checksum mismatch") ||
+      !_throws([&path]() { NN::MappedParameters mapped(path); },
+               "checksum mismatch")) {
+    std::cout << name << ": a corrupted checkpoint was accepted"
+              << std::endl;
+    ok = false;
+  }
+
+  std::remove(path.c_str());
+  delete loaded;
+  delete saved;
+  return ok;
+}
+
+/* -------------------- 16-bit floats -------------------- */
+
+/* On the bits: -Ofast lets the compiler assume that std::isnan is false */
+inline bool _is_nan(float x) {
+  return (_float_bits(x) & 0x7FFFFFFFu) > 0x7F800000u;
+}
+
+/* The software conversions of Half against F16C (compiled in here even
+ * when the rest is not, and run if the CPU has it): every finite float,
+ * and every Half back to float (NaNs need only stay NaNs) */
+__attribute__((target("f16c")))
+bool _test_half_f16c(const char* name) {
+  size_t wrong = 0;
+  uint32_t first_wrong = 0;
+  alignas(16) float x[4];
+  alignas(16) uint16_t h[8];
+  for (uint64_t u = 0; u <= 0xFFFFFFFFul; u += 4ul) {
+    for (size_t i = 0; i < 4; i++)
+      x[i] = _bits_float((uint32_t)u + (uint32_t)i);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(h),
+                     _mm_cvtps_ph(_mm_load_ps(x), _MM_FROUND_TO_NEAREST_INT));
+    for (size_t i = 0; i < 4; i++)
+      if ((u & 0x7F800000ul) != 0x7F800000ul &&
+          _half_from_float(x[i]) != h[i] && wrong++ == 0ul)
+        first_wrong = (uint32_t)u + (uint32_t)i;
+  }
+  if (wrong > 0ul)
+    std::cout << name << ": " << wrong << " floats rounded differently,"
+              << " the first is 0x" << std::hex << first_wrong << std::dec
+              << std::endl;
+
+  size_t wrong_back = 0;
+  for (uint32_t b = 0; b <= 0xFFFFu; b++) {
+    const float soft = _half_to_float((uint16_t)b);
+    const float hard = _cvtsh_ss((uint16_t)b);
+    if (_is_nan(hard) ? !_is_nan(soft) :
+        _float_bits(soft) != _float_bits(hard))
+      wrong_back++;
+  }
+  if (wrong_back > 0ul)
+    std::cout << name << ": " << wrong_back << " halves converted back"
+              << " differently" << std::endl;
+  return wrong == 0ul && wrong_back == 0ul;
+}
+
+bool test_half(const char* name) {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("f16c")) {
+    std::cout << name << ": no F16C, skipped" << std::endl;
+    return true;
+  }
+  return _test_half_f16c(name);
+}
+
+/* Ties go to the even neighbour, overflows to infinity, and NaNs stay NaNs
+ * (even those whose rounding would carry into the exponent or the sign) */
+bool test_bfloat16(const char* name) {
+  const uint32_t cases[][2] = {
+    {0x3F800000u, 0x3F80u},                         /* 1 */
+    {0x3F807FFFu, 0x3F80u},                         /* below the tie */
+    {0x3F808000u, 0x3F80u},                         /* tie, to even */
+    {0x3F808001u, 0x3F81u},                         /* above the tie */
+    {0x3F818000u, 0x3F82u},                         /* tie, to even */
+    {0xBF818000u, 0xBF82u},
+    {0x3FFFFFFFu, 0x4000u},                         /* carries into e */
+    {0x00018000u, 0x0002u},                         /* subnormal tie */
+    {0x7F7F7FFFu, 0x7F7Fu},                         /* largest finite */
+    {0x7F7FFFFFu, 0x7F80u},                         /* FLT_MAX: inf */
+    {0x7F800000u, 0x7F80u},                         /* inf */
+    {0xFF800000u, 0xFF80u},                         /* -inf */
+    {0x80000000u, 0x8000u}                          /* -0 */
+  };
+  bool ok = true;
+  for (const auto& c : cases) {
+    const uint16_t bits = BFloat16(_bits_float(c[0])).bits;
+    if (bits != c[1]) {
+      std::cout << name << ": 0x" << std::hex << c[0] << " became 0x"
+                << bits << " instead of 0x" << c[1] << std::dec << std::endl;
+      ok = false;
+    }
+  }
+  size_t lost = 0;
+  for (uint32_t m = 1; m <= 0x7FFFFFu; m++)
+    for (uint32_t sign = 0; sign <= 1u; sign++) {
+      const BFloat16 y(_bits_float(sign << 31 | 0x7F800000u | m));
+      lost += !_is_nan((float)y) || (y.bits >> 15) != sign;
+    }
+  if (lost > 0ul) {
+    std::cout << name << ": " << lost << " NaNs became numbers or changed"
+              << " sign" << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+int main() {
+  bool ok = true;
+  ok &= test_gemm<double, false, false>("gemm (NN)");
+  ok &= test_gemm<double, false, true>("gemm (NT)");
+  ok &= test_gemm<double, true, false>("gemm (TN)");
+  ok &= test_gemm<double, true, true>("gemm (TT)");
+  ok &= test_gemm<float, false, true>("gemm (float, NT)");
+  ok &= test_gradient<SumOfSquares>("gradient (SumOfSquares)");
+  ok &= test_gradient<SoftMax>("gradient (SoftMax)");
+  ok &= test_pipeline<1, 1>("pipeline (1 micro-batch, 1 stage)");
+  ok &= test_pipeline<2, 2>("pipeline (2 micro-batches, 2 stages)");
+  ok &= test_pipeline<4, 3>("pipeline (4 micro-batches, 3 stages)");
+  ok &= test_pipeline<8, 4>("pipeline (8 micro-batches, 4 stages)");
+  ok &= test_pipeline<2, 4>("pipeline (2 micro-batches, 4 stages)");
+  ok &= test_pipeline_stages("pipeline (set_stages)");
+  ok &= test_quantized("quantized inference");
+  ok &= test_sparse_convolution<3, 1>("convolution (Winograd)");
+  ok &= test_sparse_convolution<5, 1>("convolution (FFT)");
+  ok &= test_sparse_convolution<3, 2>("convolution (im2col)");
+  ok &= test_checkpointing_memory<DeepNet, 32>("checkpointing (MLP)");
+  ok &= test_checkpointing_memory<ConvNet, 4>("checkpointing (CNN)");
+  ok &= test_half("Half");
+  ok &= test_bfloat16("BFloat16");
+  ok &= test_checkpoint("checkpoint");
+  ok &= test_shared_all_reduce(2, 1001, "all-reduce (2 ranks)");
+  ok &= test_shared_all_reduce(3, 1001, "all-reduce (3 ranks)");
+  ok &= test_shared_all_reduce_timeout("all-reduce (timeout)");
+  std::cout << (ok ? "ok" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}